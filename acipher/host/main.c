@@ -107,6 +107,7 @@
 	 char *command;
 	 void *input_data;
 	 size_t input_data_len;
+	 TEEC_SharedMemory input_shm = { };
 	 void *signature = NULL;
 	 size_t signature_size;
 	 void *digest = NULL;
@@ -134,6 +135,14 @@
 	 if (res)
 		 teec_err(res, eo, "TEEC_OpenSession");
  
+	 /* 注册输入数据为共享内存, 避免每次调用都拷贝整个文件 */
+	 input_shm.buffer = input_data;
+	 input_shm.size = input_data_len;
+	 input_shm.flags = TEEC_MEM_INPUT;
+	 res = TEEC_RegisterSharedMemory(&ctx, &input_shm);
+	 if (res)
+		 errx(1, "TEEC_RegisterSharedMemory failed: %#" PRIx32, res);
+ 
 	 /* 生成 RSA 密钥对 */
 	 memset(&op, 0, sizeof(op));
 	 op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE,
@@ -150,11 +159,10 @@
 		  * 2. 使用 TA_ACIPHER_CMD_SIGN 对摘要进行签名
 		  */
 		 memset(&op, 0, sizeof(op));
-		 op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+		 op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_WHOLE,
 						  TEEC_MEMREF_TEMP_OUTPUT,
 						  TEEC_NONE, TEEC_NONE);
-		 op.params[0].tmpref.buffer = input_data;
-		 op.params[0].tmpref.size = input_data_len;
+		 op.params[0].memref.parent = &input_shm;
 		 op.params[1].tmpref.buffer = digest;
 		 op.params[1].tmpref.size = DIGEST_SIZE;
 		 res = TEEC_InvokeCommand(&sess, TA_ACIPHER_CMD_DIGEST, &op, &eo);
@@ -192,11 +200,10 @@
 		  * 3. 调用 TA_ACIPHER_CMD_VERIFY 对摘要和签名进行验证
 		  */
 		 memset(&op, 0, sizeof(op));
-		 op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+		 op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_WHOLE,
 						  TEEC_MEMREF_TEMP_OUTPUT,
 						  TEEC_NONE, TEEC_NONE);
-		 op.params[0].tmpref.buffer = input_data;
-		 op.params[0].tmpref.size = input_data_len;
+		 op.params[0].memref.parent = &input_shm;
 		 op.params[1].tmpref.buffer = digest;
 		 op.params[1].tmpref.size = DIGEST_SIZE;
 		 res = TEEC_InvokeCommand(&sess, TA_ACIPHER_CMD_DIGEST, &op, &eo);
@@ -230,6 +237,7 @@
 		 usage(argc, argv);
 	 }
  
+	 TEEC_ReleaseSharedMemory(&input_shm);
 	 TEEC_CloseSession(&sess);
 	 TEEC_FinalizeContext(&ctx);
 	 free(input_data);
@@ -81,19 +81,19 @@
          errx(1, "AES SET_IV failed: 0x%x, origin 0x%x", res, origin);
  }
  
+ /* Cipher sz bytes of a shared memory block in place */
  static void cipher_buffer(TEEC_Session *sess,
-                           char *in, char *out, size_t sz) {
+                           TEEC_SharedMemory *shm, size_t sz) {
      TEEC_Operation op = {0};
      uint32_t origin;
  
+     /* A single INOUT memref, the TA writes the output over the input */
      op.paramTypes = TEEC_PARAM_TYPES(
-         TEEC_MEMREF_TEMP_INPUT,
-         TEEC_MEMREF_TEMP_OUTPUT,
-         TEEC_NONE, TEEC_NONE);
-     op.params[0].tmpref.buffer = in;
-     op.params[0].tmpref.size   = sz;
-     op.params[1].tmpref.buffer = out;
-     op.params[1].tmpref.size   = sz;
+         TEEC_MEMREF_PARTIAL_INOUT,
+         TEEC_NONE, TEEC_NONE, TEEC_NONE);
+     op.params[0].memref.parent = shm;
+     op.params[0].memref.offset = 0;
+     op.params[0].memref.size   = sz;
  
      TEEC_Result res = TEEC_InvokeCommand(sess,
                                           TA_AES_CMD_CIPHER,
@@ -115,10 +115,25 @@
  
      char key[AES_TEST_KEY_SIZE];
      char iv[AES_BLOCK_SIZE];
-     char inbuf[AES_TEST_BUFFER_SIZE];
-     char outbuf[AES_TEST_BUFFER_SIZE];
+     TEEC_SharedMemory shm = {0};
+     void *mem;
      size_t r;
  
+     /*
+      * One AES_TEST_BUFFER_SIZE chunk buffer, reused for every chunk of
+      * the file and ciphered in place. It is registered with the TEE once
+      * (page aligned, as registration maps whole pages), so there is no
+      * per-invoke bounce copy and no second block for the output.
+      */
+     if (posix_memalign(&mem, 4096, AES_TEST_BUFFER_SIZE))
+         errx(1, "Out of memory");
+     shm.buffer = mem;
+     shm.size  = AES_TEST_BUFFER_SIZE;
+     shm.flags = TEEC_MEM_INPUT | TEEC_MEM_OUTPUT;
+     TEEC_Result res = TEEC_RegisterSharedMemory(ctx, &shm);
+     if (res != TEEC_SUCCESS)
+         errx(1, "TEEC_RegisterSharedMemory failed: 0x%x", res);
+ 
      /* Dummy key/IV */
      memset(key, 0xa5, sizeof(key));
      memset(iv, 0,    sizeof(iv));
@@ -127,11 +142,14 @@
      set_key(sess, key, sizeof(key));
      set_iv(sess, iv,  sizeof(iv));
  
-     while ((r = fread(inbuf, 1, sizeof(inbuf), fin)) > 0) {
-         cipher_buffer(sess, inbuf, outbuf, r);
-         fwrite(outbuf, 1, r, fout);
+     while ((r = fread(shm.buffer, 1, shm.size, fin)) > 0) {
+         cipher_buffer(sess, &shm, r);
+         fwrite(shm.buffer, 1, r, fout);
      }
  
+     /* TEEC_ReleaseSharedMemory() clears shm.buffer */
+     TEEC_ReleaseSharedMemory(&shm);
+     free(mem);
      fclose(fin);
      fclose(fout);
  }
@@ -173,17 +191,21 @@
          size_t sz = ftell(fp);
          fseek(fp, 0, SEEK_SET);
  
-         void *buf = malloc(sz);
-         if (!buf) errx(1, "malloc failed");
-         fread(buf, 1, sz, fp);
+         TEEC_SharedMemory shm = {0};
+         shm.size  = sz;
+         shm.flags = TEEC_MEM_INPUT;
+         res = TEEC_AllocateSharedMemory(&ctx, &shm);
+         if (res != TEEC_SUCCESS)
+             errx(1, "TEEC_AllocateSharedMemory failed: 0x%x", res);
+         if (fread(shm.buffer, 1, sz, fp) != sz)
+             errx(1, "fread failed");
          fclose(fp);
  
          TEEC_Operation op = {0};
          op.paramTypes = TEEC_PARAM_TYPES(
-             TEEC_MEMREF_TEMP_INPUT,
+             TEEC_MEMREF_WHOLE,
              TEEC_NONE, TEEC_NONE, TEEC_NONE);
-         op.params[0].tmpref.buffer = buf;
-         op.params[0].tmpref.size   = sz;
+         op.params[0].memref.parent = &shm;
  
          res = TEEC_InvokeCommand(&sess,
                                   TA_OCRAM_LOAD_CMD_STORE,
@@ -191,7 +213,7 @@
                                   &err_origin);
          if (res != TEEC_SUCCESS)
              errx(1, "STORE failed: 0x%x, origin 0x%x", res, err_origin);
-         free(buf);
+         TEEC_ReleaseSharedMemory(&shm);
          printf("Stored %zu bytes.\n", sz);
  
      } else if (strcmp(argv[1], "load") == 0) {
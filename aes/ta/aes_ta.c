@@ -37,7 +37,8 @@
 #define AES256_KEY_BYTE_SIZE		(AES256_KEY_BIT_SIZE / 8)
 
 /*
- * Ciphering context: each opened session relates to a cipehring operation.
+ * Ciphering context: each context relates to a cipehring operation, and a
+ * session holds a few of them (struct aes_session).
  * - configure the AES flavour from a command.
  * - load key from a command (here the key is provided by the REE)
  * - reset init vector (here IV is provided by the REE)
@@ -49,6 +50,18 @@ struct aes_cipher {
 	uint32_t key_size;		/* AES key size in byte */
 	TEE_OperationHandle op_handle;	/* AES ciphering operation */
 	TEE_ObjectHandle key_handle;	/* transient object to load the key */
+	bool iv_set;			/* iv given by SET_IV since PREPARE */
+	uint8_t iv[16];			/* CTR stream start, for CIPHER_AT */
+};
+
+/*
+ * Session: ctx[0] is the context prepared without a handle, ctx[h] the
+ * one for handle h while held[h]. Commands without a handle use ctx[cur].
+ */
+struct aes_session {
+	struct aes_cipher ctx[TA_AES_HANDLES + 1];
+	bool held[TA_AES_HANDLES + 1];
+	uint32_t cur;
 };
 
 /*
@@ -140,6 +153,8 @@ static TEE_Result alloc_resources(void *session, uint32_t param_types,
 	if (res != TEE_SUCCESS)
 		return res;
 
+	sess->iv_set = false;
+
 	/*
 	 * Ready to allocate the resources which are:
 	 * - an operation handle, for an AES ciphering of given configuration
@@ -321,6 +336,11 @@ static TEE_Result reset_aes_iv(void *session, uint32_t param_types,
 	 */
 	TEE_CipherInit(sess->op_handle, iv, iv_sz);
 
+	/* Keep it for CIPHER_AT to derive counter blocks from */
+	sess->iv_set = iv_sz == sizeof(sess->iv);
+	if (sess->iv_set)
+		TEE_MemMove(sess->iv, iv, sizeof(sess->iv));
+
 	return TEE_SUCCESS;
 }
 
@@ -335,12 +355,31 @@ static TEE_Result cipher_buffer(void *session, uint32_t param_types,
 				TEE_PARAM_TYPE_MEMREF_OUTPUT,
 				TEE_PARAM_TYPE_NONE,
 				TEE_PARAM_TYPE_NONE);
+	const uint32_t exp_inplace_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INOUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
 	struct aes_cipher *sess;
 
 	/* Get ciphering context from session ID */
 	DMSG("Session %p: cipher buffer", session);
 	sess = (struct aes_cipher *)session;
 
+	/*
+	 * In place: a single buffer, so the client needs no second copy of
+	 * the data in shared memory.
+	 */
+	if (param_types == exp_inplace_types) {
+		if (sess->op_handle == TEE_HANDLE_NULL)
+			return TEE_ERROR_BAD_STATE;
+		return TEE_CipherUpdate(sess->op_handle,
+					params[0].memref.buffer,
+					params[0].memref.size,
+					params[0].memref.buffer,
+					&params[0].memref.size);
+	}
+
 	/* Safely get the invocation parameters */
 	if (param_types != exp_param_types)
 		return TEE_ERROR_BAD_PARAMETERS;
@@ -362,6 +401,437 @@ static TEE_Result cipher_buffer(void *session, uint32_t param_types,
 				params[1].memref.buffer, &params[1].memref.size);
 }
 
+static bool memref_type(uint32_t type)
+{
+	return type == TEE_PARAM_TYPE_MEMREF_INPUT ||
+	       type == TEE_PARAM_TYPE_MEMREF_OUTPUT ||
+	       type == TEE_PARAM_TYPE_MEMREF_INOUT;
+}
+
+/*
+ * Build parameter p of a batched command from its descriptor entry: a
+ * value, or a window into the descriptor copy or into a batch memref.
+ */
+static TEE_Result batch_param(uint8_t *desc, uint32_t desc_sz,
+			      uint32_t ops_end, uint32_t type,
+			      const struct ta_batch_param *bp,
+			      uint32_t param_types, TEE_Param params[4],
+			      TEE_Param *p)
+{
+	uint32_t btype, size, lo = 0;
+	uint8_t *base;
+
+	switch (type) {
+	case TEE_PARAM_TYPE_NONE:
+		return TEE_SUCCESS;
+	case TEE_PARAM_TYPE_VALUE_INPUT:
+	case TEE_PARAM_TYPE_VALUE_OUTPUT:
+	case TEE_PARAM_TYPE_VALUE_INOUT:
+		p->value.a = bp->a;
+		p->value.b = bp->b;
+		return TEE_SUCCESS;
+	default:
+		if (!memref_type(type))
+			return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	if (bp->ref == TA_BATCH_REF_DESC) {
+		/* Inline blobs shall not alias the op table */
+		base = desc;
+		size = desc_sz;
+		lo = ops_end;
+	} else {
+		if (bp->ref >= TEE_NUM_PARAMS)
+			return TEE_ERROR_BAD_PARAMETERS;
+		btype = TEE_PARAM_TYPE_GET(param_types, bp->ref);
+		if (!memref_type(btype) ||
+		    (type != TEE_PARAM_TYPE_MEMREF_OUTPUT &&
+		     btype == TEE_PARAM_TYPE_MEMREF_OUTPUT) ||
+		    (type != TEE_PARAM_TYPE_MEMREF_INPUT &&
+		     btype == TEE_PARAM_TYPE_MEMREF_INPUT))
+			return TEE_ERROR_BAD_PARAMETERS;
+		base = params[bp->ref].memref.buffer;
+		size = params[bp->ref].memref.size;
+	}
+	if (bp->a < lo || bp->a > size || bp->b > size - bp->a)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	p->memref.buffer = base + bp->a;
+	p->memref.size = bp->b;
+	return TEE_SUCCESS;
+}
+
+/*
+ * Process command TA_AES_CMD_BATCH. API in aes_ta.h
+ *
+ * The descriptor is copied into the TA before any op runs, so the
+ * client cannot change the ops or the inline key material meanwhile.
+ * The copy is written back with the results, then wiped.
+ */
+static TEE_Result batch_commands(void *session, uint32_t param_types,
+				 TEE_Param params[4])
+{
+	struct ta_batch_hdr *hdr;
+	struct ta_batch_op *ops;
+	uint32_t desc_sz, ops_end, i, j;
+	TEE_Result res = TEE_SUCCESS;
+	uint8_t *desc;
+
+	DMSG("Session %p: batch", session);
+
+	if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_MEMREF_INOUT)
+		return TEE_ERROR_BAD_PARAMETERS;
+	for (i = 1; i < TEE_NUM_PARAMS; i++)
+		if (TEE_PARAM_TYPE_GET(param_types, i) != TEE_PARAM_TYPE_NONE &&
+		    !memref_type(TEE_PARAM_TYPE_GET(param_types, i)))
+			return TEE_ERROR_BAD_PARAMETERS;
+
+	desc_sz = params[0].memref.size;
+	if (desc_sz < sizeof(*hdr) || desc_sz > TA_BATCH_DESC_MAX)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	desc = TEE_Malloc(desc_sz, 0);
+	if (!desc)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	TEE_MemMove(desc, params[0].memref.buffer, desc_sz);
+
+	hdr = (struct ta_batch_hdr *)desc;
+	ops = (struct ta_batch_op *)(hdr + 1);
+	if (hdr->count > TA_BATCH_MAX_OPS) {
+		res = TEE_ERROR_BAD_PARAMETERS;
+		goto out;
+	}
+	ops_end = sizeof(*hdr) + hdr->count * sizeof(*ops);
+	if (ops_end > desc_sz) {
+		res = TEE_ERROR_BAD_PARAMETERS;
+		goto out;
+	}
+
+	hdr->done = 0;
+	for (i = 0; i < hdr->count; i++) {
+		struct ta_batch_op *op = &ops[i];
+		TEE_Param sub[TEE_NUM_PARAMS];
+
+		TEE_MemFill(sub, 0, sizeof(sub));
+		res = op->cmd == TA_AES_CMD_BATCH ?
+		      TEE_ERROR_BAD_PARAMETERS : TEE_SUCCESS;
+		for (j = 0; j < TEE_NUM_PARAMS && res == TEE_SUCCESS; j++)
+			res = batch_param(desc, desc_sz, ops_end,
+					  TEE_PARAM_TYPE_GET(op->param_types, j),
+					  &op->p[j], param_types, params,
+					  &sub[j]);
+		if (res == TEE_SUCCESS)
+			res = TA_InvokeCommandEntryPoint(session, op->cmd,
+							 op->param_types, sub);
+
+		/* Output values and memref sizes go back into the op */
+		for (j = 0; j < TEE_NUM_PARAMS; j++) {
+			switch (TEE_PARAM_TYPE_GET(op->param_types, j)) {
+			case TEE_PARAM_TYPE_VALUE_OUTPUT:
+			case TEE_PARAM_TYPE_VALUE_INOUT:
+				op->p[j].a = sub[j].value.a;
+				op->p[j].b = sub[j].value.b;
+				break;
+			case TEE_PARAM_TYPE_MEMREF_OUTPUT:
+			case TEE_PARAM_TYPE_MEMREF_INOUT:
+				op->p[j].b = sub[j].memref.size;
+				break;
+			default:
+				break;
+			}
+		}
+		op->result = res;
+		hdr->done++;
+		if (res != TEE_SUCCESS) {
+			EMSG("Batch op %" PRIu32 " (command 0x%" PRIx32
+			     ") failed %x", i, op->cmd, res);
+			break;
+		}
+	}
+
+out:
+	TEE_MemMove(params[0].memref.buffer, desc, desc_sz);
+	TEE_MemFill(desc, 0, desc_sz);
+	TEE_Free(desc);
+	return res;
+}
+
+/*
+ * Process command TA_AES_CMD_CIPHER_SG. API in aes_ta.h
+ *
+ * The table is copied out of shared memory and fully checked before the
+ * first segment is ciphered, so a bad entry or a short output buffer
+ * leaves the cipher state untouched.
+ */
+static TEE_Result cipher_segments(void *session, uint32_t param_types,
+				  TEE_Param params[4])
+{
+	uint32_t data_type = TEE_PARAM_TYPE_GET(param_types, 1);
+	uint32_t out_type = TEE_PARAM_TYPE_GET(param_types, 2);
+	uint32_t count, data_sz, total = 0, done = 0, n, i;
+	struct aes_cipher *sess;
+	struct ta_aes_sg *table;
+	uint8_t *data, *out;
+	TEE_Result res = TEE_SUCCESS;
+
+	DMSG("Session %p: cipher segments", session);
+	sess = (struct aes_cipher *)session;
+
+	if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_MEMREF_INPUT ||
+	    TEE_PARAM_TYPE_GET(param_types, 3) != TEE_PARAM_TYPE_NONE)
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (out_type == TEE_PARAM_TYPE_NONE) {
+		if (data_type != TEE_PARAM_TYPE_MEMREF_INOUT)
+			return TEE_ERROR_BAD_PARAMETERS;
+	} else if (out_type != TEE_PARAM_TYPE_MEMREF_OUTPUT ||
+		   (data_type != TEE_PARAM_TYPE_MEMREF_INPUT &&
+		    data_type != TEE_PARAM_TYPE_MEMREF_INOUT)) {
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	if (sess->op_handle == TEE_HANDLE_NULL)
+		return TEE_ERROR_BAD_STATE;
+
+	count = params[0].memref.size / sizeof(*table);
+	if (!count)
+		return TEE_ERROR_BAD_PARAMETERS;
+	table = TEE_Malloc(count * sizeof(*table), 0);
+	if (!table)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	TEE_MemMove(table, params[0].memref.buffer, count * sizeof(*table));
+
+	data = params[1].memref.buffer;
+	data_sz = params[1].memref.size;
+	out = out_type == TEE_PARAM_TYPE_NONE ? NULL : params[2].memref.buffer;
+
+	/* ECB and CBC (NOPAD) output exactly what full blocks they get */
+	for (i = 0; i < count; i++) {
+		if (table[i].offset > data_sz ||
+		    table[i].length > data_sz - table[i].offset ||
+		    table[i].length > UINT32_MAX - total ||
+		    (sess->algo != TEE_ALG_AES_CTR && table[i].length % 16)) {
+			res = TEE_ERROR_BAD_PARAMETERS;
+			goto out;
+		}
+		total += table[i].length;
+	}
+	if (out && params[2].memref.size < total) {
+		params[2].memref.size = total;
+		res = TEE_ERROR_SHORT_BUFFER;
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		uint8_t *seg = data + table[i].offset;
+
+		n = table[i].length;
+		res = TEE_CipherUpdate(sess->op_handle, seg, table[i].length,
+				       out ? out + done : seg, &n);
+		if (res != TEE_SUCCESS) {
+			EMSG("TEE_CipherUpdate failed on segment %" PRIu32
+			     ", %x", i, res);
+			goto out;
+		}
+		done += n;
+	}
+	if (out)
+		params[2].memref.size = done;
+
+out:
+	TEE_Free(table);
+	return res;
+}
+
+/*
+ * Process command TA_AES_CMD_CIPHER_AT. API in aes_ta.h
+ *
+ * The operation is re-initialized at the counter block holding the
+ * offset: the IV as a big-endian 128-bit counter plus the block index.
+ * The keystream before the offset in that block is ciphered into a
+ * scratch block and dropped.
+ */
+static TEE_Result cipher_at(void *session, uint32_t param_types,
+			    TEE_Param params[4])
+{
+	uint32_t data_type = TEE_PARAM_TYPE_GET(param_types, 1);
+	uint32_t out_type = TEE_PARAM_TYPE_GET(param_types, 2);
+	struct aes_cipher *sess;
+	uint8_t ctr[16], skip[16];
+	uint64_t off, carry;
+	TEE_Result res;
+	uint32_t n;
+	void *out;
+	int i;
+
+	DMSG("Session %p: cipher at offset", session);
+	sess = (struct aes_cipher *)session;
+
+	if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_VALUE_INPUT ||
+	    TEE_PARAM_TYPE_GET(param_types, 3) != TEE_PARAM_TYPE_NONE)
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (out_type == TEE_PARAM_TYPE_NONE) {
+		if (data_type != TEE_PARAM_TYPE_MEMREF_INOUT)
+			return TEE_ERROR_BAD_PARAMETERS;
+	} else if (out_type != TEE_PARAM_TYPE_MEMREF_OUTPUT ||
+		   (data_type != TEE_PARAM_TYPE_MEMREF_INPUT &&
+		    data_type != TEE_PARAM_TYPE_MEMREF_INOUT)) {
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	if (sess->op_handle == TEE_HANDLE_NULL || !sess->iv_set)
+		return TEE_ERROR_BAD_STATE;
+	if (sess->algo != TEE_ALG_AES_CTR)
+		return TEE_ERROR_NOT_SUPPORTED;
+
+	if (out_type == TEE_PARAM_TYPE_NONE) {
+		out = params[1].memref.buffer;
+	} else {
+		if (params[2].memref.size < params[1].memref.size) {
+			params[2].memref.size = params[1].memref.size;
+			return TEE_ERROR_SHORT_BUFFER;
+		}
+		out = params[2].memref.buffer;
+	}
+
+	off = ((uint64_t)params[0].value.b << 32) | params[0].value.a;
+	carry = off / sizeof(ctr);
+	for (i = sizeof(ctr) - 1; i >= 0; i--) {
+		carry += sess->iv[i];
+		ctr[i] = carry & 0xff;
+		carry >>= 8;
+	}
+	TEE_CipherInit(sess->op_handle, ctr, sizeof(ctr));
+
+	n = off % sizeof(ctr);
+	if (n) {
+		TEE_MemFill(skip, 0, n);
+		res = TEE_CipherUpdate(sess->op_handle, skip, n, skip, &n);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+
+	n = params[1].memref.size;
+	res = TEE_CipherUpdate(sess->op_handle, params[1].memref.buffer,
+			       params[1].memref.size, out, &n);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	if (out_type == TEE_PARAM_TYPE_NONE)
+		params[1].memref.size = n;
+	else
+		params[2].memref.size = n;
+	return TEE_SUCCESS;
+}
+
+static void free_context(struct aes_cipher *ctx)
+{
+	if (ctx->key_handle != TEE_HANDLE_NULL)
+		TEE_FreeTransientObject(ctx->key_handle);
+	ctx->key_handle = TEE_HANDLE_NULL;
+	if (ctx->op_handle != TEE_HANDLE_NULL)
+		TEE_FreeOperation(ctx->op_handle);
+	ctx->op_handle = TEE_HANDLE_NULL;
+}
+
+/* param_types with param[3], the context handle, dropped */
+static uint32_t without_handle(uint32_t param_types)
+{
+	return TEE_PARAM_TYPES(TEE_PARAM_TYPE_GET(param_types, 0),
+			       TEE_PARAM_TYPE_GET(param_types, 1),
+			       TEE_PARAM_TYPE_GET(param_types, 2),
+			       TEE_PARAM_TYPE_NONE);
+}
+
+/*
+ * Context for SET_KEY, SET_IV, CIPHER, CIPHER_SG and CIPHER_AT: the one
+ * named by a handle in param[3], which then becomes the current one, or
+ * else the current one. NULL if param[3] is not a held handle.
+ */
+static struct aes_cipher *get_context(struct aes_session *s,
+				      uint32_t *param_types,
+				      TEE_Param params[4])
+{
+	uint32_t h;
+
+	switch (TEE_PARAM_TYPE_GET(*param_types, 3)) {
+	case TEE_PARAM_TYPE_NONE:
+		return &s->ctx[s->cur];
+	case TEE_PARAM_TYPE_VALUE_INPUT:
+		h = params[3].value.a;
+		if (!h || h > TA_AES_HANDLES || !s->held[h])
+			return NULL;
+		s->cur = h;
+		*param_types = without_handle(*param_types);
+		return &s->ctx[h];
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Process command TA_AES_CMD_PREPARE. Without a handle it (re)prepares
+ * ctx[0]; with param[3] as value output it prepares a free context and
+ * returns its handle.
+ */
+static TEE_Result prepare_context(struct aes_session *s,
+				  uint32_t param_types, TEE_Param params[4])
+{
+	TEE_Result res;
+	uint32_t h;
+
+	if (TEE_PARAM_TYPE_GET(param_types, 3) !=
+	    TEE_PARAM_TYPE_VALUE_OUTPUT) {
+		s->cur = 0;
+		return alloc_resources(&s->ctx[0], param_types, params);
+	}
+
+	for (h = 1; h <= TA_AES_HANDLES; h++)
+		if (!s->held[h])
+			break;
+	if (h > TA_AES_HANDLES) {
+		EMSG("All %d context handles in use", TA_AES_HANDLES);
+		return TEE_ERROR_OUT_OF_MEMORY;
+	}
+
+	res = alloc_resources(&s->ctx[h], without_handle(param_types),
+			      params);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	s->held[h] = true;
+	s->cur = h;
+	params[3].value.a = h;
+	params[3].value.b = 0;
+	return TEE_SUCCESS;
+}
+
+/*
+ * Process command TA_AES_CMD_RELEASE. API in aes_ta.h
+ */
+static TEE_Result release_context(struct aes_session *s,
+				  uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	uint32_t h;
+
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	h = params[0].value.a;
+	if (!h || h > TA_AES_HANDLES || !s->held[h])
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	free_context(&s->ctx[h]);
+	s->held[h] = false;
+	if (s->cur == h)
+		s->cur = 0;
+	return TEE_SUCCESS;
+}
+
 TEE_Result TA_CreateEntryPoint(void)
 {
 	/* Nothing to do */
@@ -377,7 +847,8 @@ TEE_Result TA_OpenSessionEntryPoint(uint32_t __unused param_types,
 					TEE_Param __unused params[4],
 					void __unused **session)
 {
-	struct aes_cipher *sess;
+	struct aes_session *sess;
+	uint32_t h;
 
 	/*
 	 * Allocate and init ciphering materials for the session.
@@ -388,8 +859,12 @@ TEE_Result TA_OpenSessionEntryPoint(uint32_t __unused param_types,
 	if (!sess)
 		return TEE_ERROR_OUT_OF_MEMORY;
 
-	sess->key_handle = TEE_HANDLE_NULL;
-	sess->op_handle = TEE_HANDLE_NULL;
+	for (h = 0; h <= TA_AES_HANDLES; h++) {
+		sess->ctx[h].key_handle = TEE_HANDLE_NULL;
+		sess->ctx[h].op_handle = TEE_HANDLE_NULL;
+		sess->held[h] = false;
+	}
+	sess->cur = 0;
 
 	*session = (void *)sess;
 	DMSG("Session %p: newly allocated", *session);
@@ -399,17 +874,16 @@ TEE_Result TA_OpenSessionEntryPoint(uint32_t __unused param_types,
 
 void TA_CloseSessionEntryPoint(void *session)
 {
-	struct aes_cipher *sess;
+	struct aes_session *sess;
+	uint32_t h;
 
 	/* Get ciphering context from session ID */
 	DMSG("Session %p: release session", session);
-	sess = (struct aes_cipher *)session;
+	sess = (struct aes_session *)session;
 
 	/* Release the session resources */
-	if (sess->key_handle != TEE_HANDLE_NULL)
-		TEE_FreeTransientObject(sess->key_handle);
-	if (sess->op_handle != TEE_HANDLE_NULL)
-		TEE_FreeOperation(sess->op_handle);
+	for (h = 0; h <= TA_AES_HANDLES; h++)
+		free_context(&sess->ctx[h]);
 	TEE_Free(sess);
 }
 
@@ -418,17 +892,41 @@ TEE_Result TA_InvokeCommandEntryPoint(void *session,
 					uint32_t param_types,
 					TEE_Param params[4])
 {
+	struct aes_session *sess = (struct aes_session *)session;
+	struct aes_cipher *ctx;
+
 	switch (cmd) {
 	case TA_AES_CMD_PREPARE:
-		return alloc_resources(session, param_types, params);
+		return prepare_context(sess, param_types, params);
+	case TA_AES_CMD_RELEASE:
+		return release_context(sess, param_types, params);
+	case TA_AES_CMD_BATCH:
+		return batch_commands(session, param_types, params);
 	case TA_AES_CMD_SET_KEY:
-		return set_aes_key(session, param_types, params);
 	case TA_AES_CMD_SET_IV:
-		return reset_aes_iv(session, param_types, params);
 	case TA_AES_CMD_CIPHER:
-		return cipher_buffer(session, param_types, params);
+	case TA_AES_CMD_CIPHER_SG:
+	case TA_AES_CMD_CIPHER_AT:
+		break;
 	default:
 		EMSG("Command ID 0x%x is not supported", cmd);
 		return TEE_ERROR_NOT_SUPPORTED;
 	}
+
+	ctx = get_context(sess, &param_types, params);
+	if (!ctx)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	switch (cmd) {
+	case TA_AES_CMD_SET_KEY:
+		return set_aes_key(ctx, param_types, params);
+	case TA_AES_CMD_SET_IV:
+		return reset_aes_iv(ctx, param_types, params);
+	case TA_AES_CMD_CIPHER:
+		return cipher_buffer(ctx, param_types, params);
+	case TA_AES_CMD_CIPHER_AT:
+		return cipher_at(ctx, param_types, params);
+	default:
+		return cipher_segments(ctx, param_types, params);
+	}
 }
@@ -28,6 +28,8 @@
 #ifndef __AES_TA_H__
 #define __AES_TA_H__
 
+#include <stdint.h>
+
 /* UUID of the AES example trusted application */
 #define TA_AES_UUID \
 	{ 0x5dbac793, 0xf574, 0x4871, \
@@ -38,10 +40,19 @@
  * param[0] (value) a: TA_AES_ALGO_xxx, b: unused
  * param[1] (value) a: key size in bytes, b: unused
  * param[2] (value) a: TA_AES_MODE_ENCODE/_DECODE, b: unused
- * param[3] unused
+ * param[3] unused, or (value) output a: handle of a new context, b: unused
+ *
+ * A session holds up to TA_AES_HANDLES cipher contexts by handle, next
+ * to the one prepared without a handle. SET_KEY, SET_IV, CIPHER,
+ * CIPHER_SG and CIPHER_AT take a handle as param[3] (value) input a;
+ * without one they use the context last prepared or named by a handle.
+ * Handles are never 0 and stay valid until TA_AES_CMD_RELEASE or the
+ * end of the session.
  */
 #define TA_AES_CMD_PREPARE		0
 
+#define TA_AES_HANDLES			4
+
 #define TA_AES_ALGO_ECB			0
 #define TA_AES_ALGO_CBC			1
 #define TA_AES_ALGO_CTR			2
@@ -57,7 +68,7 @@
  * param[0] (memref) key data, size shall equal key length
  * param[1] unused
  * param[2] unused
- * param[3] unused
+ * param[3] unused, or (value) a: context handle, b: unused
  */
 #define TA_AES_CMD_SET_KEY		1
 
@@ -66,7 +77,7 @@
  * param[0] (memref) initial vector, size shall equal block length
  * param[1] unused
  * param[2] unused
- * param[3] unused
+ * param[3] unused, or (value) a: context handle, b: unused
  */
 #define TA_AES_CMD_SET_IV		2
 
@@ -75,8 +86,100 @@
  * param[0] (memref) input buffer
  * param[1] (memref) output buffer (shall be bigger than input buffer)
  * param[2] unused
- * param[3] unused
+ * param[3] unused, or (value) a: context handle, b: unused
+ *
+ * Or in place, in a single buffer:
+ * param[0] (memref) inout: data, size set to the bytes output
+ * param[1] unused
  */
 #define TA_AES_CMD_CIPHER		3
 
+/*
+ * TA_AES_CMD_CIPHER_SG - Cipher a list of segments of one buffer
+ * param[0] (memref) input: table of struct ta_aes_sg
+ * param[1] (memref) data buffer holding the segments: inout, or input
+ *          when param[2] is used
+ * param[2] (memref) output buffer, or unused to cipher in place
+ * param[3] unused, or (value) a: context handle, b: unused
+ *
+ * The segments are ciphered in table order as one stream, so CBC and CTR
+ * chaining carries from one segment to the next. With param[2], the
+ * ciphered segments are packed back to back into it and its size is set
+ * to the total. For ECB and CBC each length shall be a multiple of the
+ * AES block size.
+ */
+#define TA_AES_CMD_CIPHER_SG		5
+
+struct ta_aes_sg {
+	uint32_t offset;	/* into param[1] */
+	uint32_t length;
+};
+
+/*
+ * TA_AES_CMD_RELEASE - Drop a context handle from TA_AES_CMD_PREPARE
+ * param[0] (value) a: handle, b: unused
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_AES_CMD_RELEASE		6
+
+/*
+ * TA_AES_CMD_CIPHER_AT - Cipher a range of an AES-CTR stream
+ * param[0] (value) a: byte offset of the range in the stream, low 32 bits
+ *                  b: high 32 bits
+ * param[1] (memref) data: inout, or input when param[2] is used
+ * param[2] (memref) output buffer, or unused to cipher in place
+ * param[3] unused, or (value) a: context handle, b: unused
+ *
+ * The counter block is derived from the IV last given to SET_IV and the
+ * offset, which need not be block aligned: the keystream of the bytes
+ * before it in its block is skipped. Ranges can so be ciphered in any
+ * order, or split over sessions holding the same key and IV, and a
+ * following TA_AES_CMD_CIPHER continues right after the range. CTR only,
+ * and SET_IV shall have been given since PREPARE.
+ */
+#define TA_AES_CMD_CIPHER_AT		7
+
+/*
+ * TA_AES_CMD_BATCH - Run several commands in one invoke
+ * param[0] (memref) inout: descriptor, struct ta_batch_hdr followed by
+ *          count struct ta_batch_op, then the inline blobs they use
+ * param[1] (memref) data buffer the ops may refer to, or unused
+ * param[2] (memref) data buffer the ops may refer to, or unused
+ * param[3] (memref) data buffer the ops may refer to, or unused
+ *
+ * The ops run in order and the batch stops at the first one that fails.
+ * Each op gives TEE_PARAM_TYPES() for its own params: a value param is
+ * a/b, a memref param is offset a and size b into the descriptor
+ * (ref TA_BATCH_REF_DESC, past the op table) or into batch param[ref].
+ * Output values and memref sizes are written back into the op along
+ * with its result, and hdr.done counts the ops that ran. The invoke
+ * returns the result of the failing op, else TEE_SUCCESS. BATCH cannot
+ * be nested.
+ */
+#define TA_AES_CMD_BATCH		4
+
+#define TA_BATCH_MAX_OPS		8
+#define TA_BATCH_DESC_MAX		1024
+#define TA_BATCH_REF_DESC		0
+
+struct ta_batch_param {
+	uint32_t a;
+	uint32_t b;
+	uint32_t ref;		/* memrefs: TA_BATCH_REF_DESC or 1..3 */
+};
+
+struct ta_batch_op {
+	uint32_t cmd;
+	uint32_t param_types;
+	uint32_t result;	/* out: TEE_Result of the op */
+	struct ta_batch_param p[4];
+};
+
+struct ta_batch_hdr {
+	uint32_t count;
+	uint32_t done;		/* out: ops that ran */
+};
+
 #endif /* __AES_TA_H */
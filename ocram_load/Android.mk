@@ -5,7 +5,14 @@ include $(CLEAR_VARS)
 LOCAL_CFLAGS += -DANDROID_BUILD
 LOCAL_CFLAGS += -Wall
 
-LOCAL_SRC_FILES += host/main.c
+LOCAL_SRC_FILES += host/main.c \
+		   host/shm_pool.c \
+		   host/sha256.c \
+		   host/merkle.c \
+		   host/lz.c \
+		   host/daemon.c \
+		   host/rproc.c \
+		   host/stats.c
 
 LOCAL_C_INCLUDES := $(LOCAL_PATH)/ta/include
 
@@ -15,4 +22,19 @@ LOCAL_VENDOR_MODULE := true
 LOCAL_MODULE_TAGS := optional
 include $(BUILD_EXECUTABLE)
 
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -DANDROID_BUILD
+LOCAL_CFLAGS += -Wall
+
+LOCAL_SRC_FILES += host/aes_bench.c \
+		   host/shm_pool.c
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/ta/include
+
+LOCAL_SHARED_LIBRARIES := libteec
+LOCAL_MODULE := optee_example_ocram_load_aes_bench
+LOCAL_VENDOR_MODULE := true
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
 include $(LOCAL_PATH)/ta/Android.mk
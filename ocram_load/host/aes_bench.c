@@ -0,0 +1,220 @@
+/*
+ * aes_bench.c
+ *
+ * Throughput of the ocram_load TA AES path (TA_AES_CMD_CIPHER) over a
+ * sweep of chunk sizes, ECB/CBC/CTR, 128/256-bit keys and the way the
+ * buffers reach the TA:
+ *
+ *   tmpref  TEEC_MEMREF_TEMP_*, libteec bounces through fresh shm per call
+ *   shm     TEEC_AllocateSharedMemory() blocks from the shm pool
+ *   reg     malloc()ed memory registered with TEEC_RegisterSharedMemory()
+ *
+ * Every point ciphers the same number of bytes (at least BENCH_MIN_INVOKES
+ * invokes) after one untimed warm-up call, and reports MB/s and invokes/s.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <tee_client_api.h>
+#include "ocram_load_ta.h"
+#include "shm_pool.h"
+
+#define BENCH_DEFAULT_MIB       4
+#define BENCH_MIN_INVOKES       8
+#define BENCH_CHUNK_MIN         256
+#define BENCH_CHUNK_MAX         (1024 * 1024)
+#define AES_BLOCK_SIZE          16
+
+enum bench_mem { MEM_TMPREF, MEM_SHM, MEM_REG };
+
+static const char *const algo_names[] = {
+    [TA_AES_ALGO_ECB] = "ECB",
+    [TA_AES_ALGO_CBC] = "CBC",
+    [TA_AES_ALGO_CTR] = "CTR",
+};
+
+static const char *const mem_names[] = {
+    [MEM_TMPREF] = "tmpref",
+    [MEM_SHM]    = "shm",
+    [MEM_REG]    = "reg",
+};
+
+static void invoke(TEEC_Session *sess, uint32_t cmd, TEEC_Operation *op,
+                   const char *what)
+{
+    uint32_t origin;
+    TEEC_Result res = TEEC_InvokeCommand(sess, cmd, op, &origin);
+
+    if (res != TEEC_SUCCESS)
+        errx(1, "%s failed: 0x%x origin 0x%x", what, res, origin);
+}
+
+/* PREPARE, SET_KEY and SET_IV for one algorithm and key size */
+static void aes_setup(TEEC_Session *sess, uint32_t algo, uint32_t key_size)
+{
+    uint8_t key[TA_AES_SIZE_256BIT], iv[AES_BLOCK_SIZE];
+    TEEC_Operation op = {0};
+
+    memset(key, 0xa5, sizeof(key));
+    memset(iv, 0x00, sizeof(iv));
+
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_VALUE_INPUT,
+                                     TEEC_VALUE_INPUT, TEEC_NONE);
+    op.params[0].value.a = algo;
+    op.params[1].value.a = key_size;
+    op.params[2].value.a = TA_AES_MODE_ENCODE;
+    invoke(sess, TA_AES_CMD_PREPARE, &op, "AES PREPARE");
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_NONE,
+                                     TEEC_NONE, TEEC_NONE);
+    op.params[0].tmpref.buffer = key;
+    op.params[0].tmpref.size = key_size;
+    invoke(sess, TA_AES_CMD_SET_KEY, &op, "AES SET_KEY");
+
+    /* ECB ignores the IV, but the TA always initialises the operation */
+    op.params[0].tmpref.buffer = iv;
+    op.params[0].tmpref.size = sizeof(iv);
+    invoke(sess, TA_AES_CMD_SET_IV, &op, "AES SET_IV");
+}
+
+/* Operation for one CIPHER call on chunk bytes */
+static void cipher_op(TEEC_Operation *op, enum bench_mem mem, void *in,
+                      void *out, TEEC_SharedMemory *shm_in,
+                      TEEC_SharedMemory *shm_out, size_t chunk)
+{
+    memset(op, 0, sizeof(*op));
+    if (mem == MEM_TMPREF) {
+        op->paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+                                          TEEC_MEMREF_TEMP_OUTPUT,
+                                          TEEC_NONE, TEEC_NONE);
+        op->params[0].tmpref.buffer = in;
+        op->params[0].tmpref.size = chunk;
+        op->params[1].tmpref.buffer = out;
+        op->params[1].tmpref.size = chunk;
+    } else {
+        op->paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT,
+                                          TEEC_MEMREF_PARTIAL_OUTPUT,
+                                          TEEC_NONE, TEEC_NONE);
+        op->params[0].memref.parent = shm_in;
+        op->params[0].memref.size = chunk;
+        op->params[1].memref.parent = shm_out;
+        op->params[1].memref.size = chunk;
+    }
+}
+
+static double elapsed_s(const struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/* Cipher total bytes in chunk-sized invokes, return the seconds taken */
+static double bench_point(TEEC_Session *sess, struct shm_pool *pool,
+                          enum bench_mem mem, uint8_t *in, uint8_t *out,
+                          size_t chunk, size_t invokes)
+{
+    TEEC_SharedMemory *shm_in = NULL, *shm_out = NULL;
+    TEEC_Operation op;
+    struct timespec t0;
+    double t;
+
+    if (mem == MEM_SHM) {
+        shm_in = shm_pool_alloc(pool, chunk);
+        shm_out = shm_pool_alloc(pool, chunk);
+        memset(shm_in->buffer, 0x5a, chunk);
+    } else if (mem == MEM_REG) {
+        shm_in = shm_pool_register(pool, in, chunk);
+        shm_out = shm_pool_register(pool, out, chunk);
+    }
+
+    cipher_op(&op, mem, in, out, shm_in, shm_out, chunk);
+    invoke(sess, TA_AES_CMD_CIPHER, &op, "AES CIPHER");
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (size_t i = 0; i < invokes; i++) {
+        /* The TA writes the output size back into the operation */
+        cipher_op(&op, mem, in, out, shm_in, shm_out, chunk);
+        invoke(sess, TA_AES_CMD_CIPHER, &op, "AES CIPHER");
+    }
+    t = elapsed_s(&t0);
+
+    if (shm_in) {
+        shm_pool_free(pool, shm_in);
+        shm_pool_free(pool, shm_out);
+    }
+    return t;
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t algos[] = { TA_AES_ALGO_ECB, TA_AES_ALGO_CBC,
+                               TA_AES_ALGO_CTR };
+    const uint32_t key_sizes[] = { TA_AES_SIZE_128BIT, TA_AES_SIZE_256BIT };
+    const TEEC_UUID uuid = TA_OCRAM_LOAD_UUID;
+    size_t total = BENCH_DEFAULT_MIB << 20;
+    TEEC_Context ctx;
+    TEEC_Session sess;
+    struct shm_pool pool;
+    uint8_t *in, *out;
+    uint32_t origin;
+
+    if (argc > 2 || (argc == 2 && !strtoul(argv[1], NULL, 0))) {
+        fprintf(stderr, "Usage: %s [MiB per point, default %d]\n", argv[0],
+                BENCH_DEFAULT_MIB);
+        return 1;
+    }
+    if (argc == 2)
+        total = strtoul(argv[1], NULL, 0) << 20;
+
+    /* Page aligned, as TEEC_RegisterSharedMemory() maps whole pages */
+    if (posix_memalign((void **)&in, 4096, BENCH_CHUNK_MAX) ||
+        posix_memalign((void **)&out, 4096, BENCH_CHUNK_MAX))
+        errx(1, "Out of memory");
+    memset(in, 0x5a, BENCH_CHUNK_MAX);
+
+    if (TEEC_InitializeContext(NULL, &ctx) != TEEC_SUCCESS)
+        errx(1, "TEEC_InitializeContext failed");
+    if (TEEC_OpenSession(&ctx, &sess, &uuid, TEEC_LOGIN_PUBLIC, NULL, NULL,
+                         &origin) != TEEC_SUCCESS)
+        errx(1, "TEEC_OpenSession failed");
+    shm_pool_init(&pool, &ctx);
+
+    printf("%-4s %4s %-7s %8s %10s %12s\n",
+           "algo", "key", "mem", "chunk", "MB/s", "invokes/s");
+    for (size_t a = 0; a < sizeof(algos) / sizeof(*algos); a++) {
+        for (size_t k = 0; k < sizeof(key_sizes) / sizeof(*key_sizes); k++) {
+            aes_setup(&sess, algos[a], key_sizes[k]);
+            for (int m = MEM_TMPREF; m <= MEM_REG; m++) {
+                for (size_t chunk = BENCH_CHUNK_MIN; chunk <= BENCH_CHUNK_MAX;
+                     chunk *= 4) {
+                    size_t invokes = total / chunk;
+                    double t;
+
+                    if (invokes < BENCH_MIN_INVOKES)
+                        invokes = BENCH_MIN_INVOKES;
+                    t = bench_point(&sess, &pool, m, in, out, chunk, invokes);
+                    printf("%-4s %4u %-7s %8zu %10.2f %12.0f\n",
+                           algo_names[algos[a]], key_sizes[k] * 8,
+                           mem_names[m], chunk, invokes * chunk / t / 1e6,
+                           invokes / t);
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+
+    shm_pool_destroy(&pool);
+    TEEC_CloseSession(&sess);
+    TEEC_FinalizeContext(&ctx);
+    free(in);
+    free(out);
+    return 0;
+}
@@ -0,0 +1,317 @@
+/*
+ * daemon.c
+ *
+ * Inference daemon and its client, see daemon.h.
+ *
+ * Request: uint32_t length, then the client's working directory and the
+ * arguments, each NUL terminated. Reply: the command's stdout/stderr,
+ * then its exit status as a uint32_t, then EOF.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#define _GNU_SOURCE             /* struct ucred */
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "daemon.h"
+
+/* One warm session; pid is the request being served on it, 0 when idle */
+struct worker {
+    TEEC_Session sess;
+    pid_t pid;
+};
+
+/* What a request's child needs besides its worker */
+struct daemon_env {
+    TEEC_Context *ctx;
+    daemon_cmd_fn fn;
+    daemon_shared_fn shared;
+    int lock_fd;
+};
+
+static int read_full(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len) {
+        ssize_t r = read(fd, p, len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        p += r;
+        len -= r;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len) {
+        ssize_t r = write(fd, p, len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        p += r;
+        len -= r;
+    }
+    return 0;
+}
+
+static int unix_addr(const char *path, struct sockaddr_un *sa)
+{
+    memset(sa, 0, sizeof(*sa));
+    sa->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sa->sun_path))
+        return -1;
+    strcpy(sa->sun_path, path);
+    return 0;
+}
+
+/* Only the daemon's own user (and root) may drive the TA through it */
+static int peer_allowed(int conn)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+        return 0;
+    return cred.uid == 0 || cred.uid == geteuid();
+}
+
+/*
+ * Run one command in the grandchild. Its shared memory is allocated
+ * here: memory the daemon registered before fork() would be copied on
+ * the first write, and the TEE would keep seeing the daemon's pages.
+ * Commands that may touch OCRAM hold the daemon-wide lock, so that two
+ * sessions never load into it at the same time.
+ */
+static int run_request(struct worker *w, const struct daemon_env *env,
+                       int argc, char *argv[])
+{
+    struct shm_pool pool;
+    int ret;
+
+    if ((!env->shared || !env->shared(argc, argv)) &&
+        lockf(env->lock_fd, F_LOCK, 0))
+        err(1, "lock %s", DAEMON_LOCK);
+    shm_pool_init(&pool, env->ctx);
+    ret = env->fn(&w->sess, &pool, argc, argv);
+    shm_pool_destroy(&pool);
+    return ret;
+}
+
+/*
+ * Child side of a request: parse it, run the command in a grandchild
+ * with its output on conn (the command code exits on any error), then
+ * send the exit status. Never returns.
+ */
+static void serve_request(int conn, struct worker *w,
+                          const struct daemon_env *env)
+{
+    static char req[DAEMON_REQ_MAX + 1];
+    char *argv[DAEMON_MAX_ARGS + 2];
+    uint32_t len, status;
+    int argc = 0, st;
+    char *p, *end;
+    pid_t pid;
+
+    if (read_full(conn, &len, sizeof(len)) || !len ||
+        len > DAEMON_REQ_MAX || read_full(conn, req, len))
+        _exit(1);
+    req[len] = '\0';
+
+    /* cwd, then arguments; relative file names resolve like the client's */
+    end = req + len;
+    p = req + strlen(req) + 1;
+    argv[argc++] = "optee_example_ocram_load";
+    while (p < end && argc <= DAEMON_MAX_ARGS) {
+        argv[argc++] = p;
+        p += strlen(p) + 1;
+    }
+    argv[argc] = NULL;
+
+    pid = fork();
+    if (pid == 0) {
+        if (chdir(req))
+            err(1, "chdir %s", req);
+        dup2(conn, STDOUT_FILENO);
+        dup2(conn, STDERR_FILENO);
+        close(conn);
+        setvbuf(stdout, NULL, _IOLBF, 0);
+        exit(argc < 2 ? 1 : run_request(w, env, argc, argv));
+    }
+    if (pid < 0 || waitpid(pid, &st, 0) < 0)
+        status = 1;
+    else if (WIFEXITED(st))
+        status = WEXITSTATUS(st);
+    else
+        status = 128 + WTERMSIG(st);
+    write_full(conn, &status, sizeof(status));
+    _exit(0);
+}
+
+static struct worker *worker_idle(struct worker *w, unsigned n)
+{
+    for (unsigned i = 0; i < n; i++)
+        if (!w[i].pid)
+            return &w[i];
+    return NULL;
+}
+
+static void worker_done(struct worker *w, unsigned n, pid_t pid)
+{
+    for (unsigned i = 0; i < n; i++)
+        if (w[i].pid == pid)
+            w[i].pid = 0;
+}
+
+int daemon_serve(const char *path, unsigned nsess, TEEC_Context *ctx,
+                 const TEEC_UUID *uuid, daemon_cmd_fn fn,
+                 daemon_shared_fn shared)
+{
+    static struct worker workers[DAEMON_MAX_SESSIONS];
+    struct daemon_env env = { ctx, fn, shared, -1 };
+    struct sockaddr_un sa;
+    uint32_t eo;
+    int lfd;
+
+    if (nsess < 1 || nsess > DAEMON_MAX_SESSIONS)
+        errx(1, "sessions must be 1..%d", DAEMON_MAX_SESSIONS);
+    if (unix_addr(path, &sa))
+        errx(1, "socket path too long: %s", path);
+    /* lockf() locks belong to the process, so one shared fd will do */
+    env.lock_fd = open(DAEMON_LOCK, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (env.lock_fd < 0)
+        err(1, "open %s", DAEMON_LOCK);
+
+    for (unsigned i = 0; i < nsess; i++) {
+        struct worker *w = &workers[i];
+        if (TEEC_OpenSession(ctx, &w->sess, uuid, TEEC_LOGIN_PUBLIC,
+                             NULL, NULL, &eo) != TEEC_SUCCESS)
+            errx(1, "TEEC_OpenSession %u failed", i);
+    }
+
+    lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (lfd < 0)
+        err(1, "socket");
+    unlink(path);
+    mode_t old = umask(077);
+    if (bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) || listen(lfd, 16))
+        err(1, "bind %s", path);
+    umask(old);
+    signal(SIGPIPE, SIG_IGN);
+    /* stdout stays untouched so requests can still set its buffering */
+    fprintf(stderr, "Serving %u sessions on %s\n", nsess, path);
+
+    for (;;) {
+        struct worker *w = NULL;
+        int conn, st;
+        pid_t pid;
+
+        conn = accept(lfd, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR)
+                continue;
+            err(1, "accept");
+        }
+        if (!peer_allowed(conn)) {
+            warnx("rejected request from another user");
+            close(conn);
+            continue;
+        }
+
+        /* Requests on one session are serialized: wait for an idle one */
+        while ((pid = waitpid(-1, &st, WNOHANG)) > 0)
+            worker_done(workers, nsess, pid);
+        while (!(w = worker_idle(workers, nsess))) {
+            pid = waitpid(-1, &st, 0);
+            if (pid < 0)
+                err(1, "waitpid");
+            worker_done(workers, nsess, pid);
+        }
+
+        pid = fork();
+        if (pid == 0) {
+            close(lfd);
+            serve_request(conn, w, &env);
+        }
+        if (pid < 0)
+            warn("fork");
+        else
+            w->pid = pid;
+        close(conn);
+    }
+    return -1;
+}
+
+int daemon_client(const char *path, int argc, char *argv[])
+{
+    static char req[DAEMON_REQ_MAX];
+    struct sockaddr_un sa;
+    uint8_t buf[4096 + sizeof(uint32_t)];
+    size_t have = 0;
+    uint32_t len = 0, status;
+    int fd;
+
+    if (!getcwd(req, sizeof(req)))
+        err(1, "getcwd");
+    len = strlen(req) + 1;
+    if (argc > DAEMON_MAX_ARGS)
+        errx(1, "too many arguments");
+    for (int i = 0; i < argc; i++) {
+        size_t n = strlen(argv[i]) + 1;
+        if (n > sizeof(req) - len)
+            errx(1, "request too large");
+        memcpy(req + len, argv[i], n);
+        len += n;
+    }
+
+    if (unix_addr(path, &sa))
+        errx(1, "socket path too long: %s", path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        err(1, "socket");
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)))
+        err(1, "connect %s (is the daemon running?)", path);
+    if (write_full(fd, &len, sizeof(len)) || write_full(fd, req, len))
+        err(1, "send request");
+
+    /* Everything but the last four bytes is output */
+    for (;;) {
+        ssize_t r = read(fd, buf + have, sizeof(buf) - have);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            err(1, "read");
+        if (r == 0)
+            break;
+        have += r;
+        if (have > sizeof(uint32_t)) {
+            size_t out = have - sizeof(uint32_t);
+            fwrite(buf, 1, out, stdout);
+            memmove(buf, buf + out, sizeof(uint32_t));
+            have = sizeof(uint32_t);
+        }
+    }
+    fflush(stdout);
+    close(fd);
+    if (have != sizeof(uint32_t))
+        errx(1, "daemon closed the connection");
+    memcpy(&status, buf, sizeof(status));
+    return status;
+}
@@ -0,0 +1,53 @@
+/*
+ * daemon.h
+ *
+ * Inference daemon for the ocram_load client: one TEEC context and a set
+ * of open TA sessions kept across requests, served over a UNIX socket so
+ * that a request does not pay for TEEC_InitializeContext, TA load and
+ * TEEC_OpenSession (which opens the persistent signing key).
+ *
+ * Each request runs the ordinary command code in a forked child, which
+ * inherits the context and a free session and allocates its own shared
+ * memory; the child's output and exit status go back to the client.
+ * Requests that may touch OCRAM run one at a time.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <tee_client_api.h>
+#include "shm_pool.h"
+
+#define DAEMON_SOCKET           "/var/run/ocram_load.sock"
+/* Held by the request that is using OCRAM */
+#define DAEMON_LOCK             "/var/run/ocram_load.lock"
+#define DAEMON_MAX_SESSIONS     16
+/* Largest request: working directory and arguments, NUL separated */
+#define DAEMON_REQ_MAX          4096
+#define DAEMON_MAX_ARGS         64
+
+/* Runs one command, argv[1] being its name as on the command line */
+typedef int (*daemon_cmd_fn)(TEEC_Session *sess, struct shm_pool *pool,
+                             int argc, char *argv[]);
+
+/* Nonzero if the command leaves OCRAM alone and may run next to others */
+typedef int (*daemon_shared_fn)(int argc, char *argv[]);
+
+/*
+ * Open nsess sessions to uuid on ctx and serve requests on path with fn.
+ * Requests for which shared is NULL or returns 0 are serialized.
+ * Only returns on error.
+ */
+int daemon_serve(const char *path, unsigned nsess, TEEC_Context *ctx,
+                 const TEEC_UUID *uuid, daemon_cmd_fn fn,
+                 daemon_shared_fn shared);
+
+/*
+ * Forward argv (command and arguments) to the daemon on path, copy its
+ * output to stdout and return the command's exit status.
+ */
+int daemon_client(const char *path, int argc, char *argv[]);
+
+#endif /* DAEMON_H */
@@ -0,0 +1,139 @@
+/*
+ * lz.c
+ *
+ * Greedy single-pass LZ4 block compressor: 4-byte hash of the input,
+ * one candidate per hash bucket. Blocks are independent, as the TA
+ * decodes them one at a time.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <string.h>
+#include "ocram_load_ta.h"
+#include "lz.h"
+
+#define HASH_BITS       12
+#define MIN_MATCH       4
+/* LZ4 end of block rules: last match starts 12 bytes before the end ... */
+#define MF_LIMIT        12
+/* ... and the last 5 bytes are always literals */
+#define LAST_LITERALS   5
+
+static uint32_t hash4(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Length continuation bytes for a token nibble of 15 */
+static int put_len(uint8_t **op, const uint8_t *oend, size_t len)
+{
+    for (; len >= 255; len -= 255) {
+        if (*op >= oend)
+            return -1;
+        *(*op)++ = 255;
+    }
+    if (*op >= oend)
+        return -1;
+    *(*op)++ = (uint8_t)len;
+    return 0;
+}
+
+/* One sequence: literals, then a match unless mlen is 0 */
+static int put_seq(uint8_t **op, const uint8_t *oend, const uint8_t *lit,
+                   size_t lit_len, size_t off, size_t mlen)
+{
+    uint8_t *token = *op;
+
+    if (*op >= oend)
+        return -1;
+    (*op)++;
+    *token = (lit_len >= 15 ? 15 : lit_len) << 4;
+    if (lit_len >= 15 && put_len(op, oend, lit_len - 15))
+        return -1;
+    if ((size_t)(oend - *op) < lit_len)
+        return -1;
+    memcpy(*op, lit, lit_len);
+    *op += lit_len;
+    if (!mlen)
+        return 0;
+
+    if (oend - *op < 2)
+        return -1;
+    *(*op)++ = off & 0xff;
+    *(*op)++ = off >> 8;
+    mlen -= MIN_MATCH;
+    *token |= mlen >= 15 ? 15 : mlen;
+    if (mlen >= 15 && put_len(op, oend, mlen - 15))
+        return -1;
+    return 0;
+}
+
+size_t lz_compress_block(const uint8_t *src, size_t n, uint8_t *dst,
+                         size_t cap)
+{
+    int32_t table[1 << HASH_BITS];
+    const uint8_t *ip = src, *anchor = src, *end = src + n;
+    uint8_t *op = dst, *oend = dst + cap;
+
+    if (n > TA_OCRAM_LZ_BLOCK)
+        return 0;
+    memset(table, 0xff, sizeof(table));
+
+    while (n > MF_LIMIT && ip < end - MF_LIMIT) {
+        uint32_t h = hash4(ip);
+        int32_t ref = table[h];
+        const uint8_t *m;
+        size_t mlen = MIN_MATCH;
+
+        table[h] = (int32_t)(ip - src);
+        m = src + (ref < 0 ? 0 : ref);
+        if (ref < 0 || memcmp(m, ip, MIN_MATCH)) {
+            ip++;
+            continue;
+        }
+
+        while (ip + mlen < end - LAST_LITERALS && m[mlen] == ip[mlen])
+            mlen++;
+        if (put_seq(&op, oend, anchor, ip - anchor, ip - m, mlen))
+            return 0;
+        ip += mlen;
+        anchor = ip;
+    }
+
+    if (put_seq(&op, oend, anchor, end - anchor, 0, 0))
+        return 0;
+    return (size_t)(op - dst) < n ? (size_t)(op - dst) : 0;
+}
+
+size_t lz_pack_bound(size_t n)
+{
+    size_t blocks = (n + TA_OCRAM_LZ_BLOCK - 1) / TA_OCRAM_LZ_BLOCK;
+
+    return sizeof(struct ta_ocram_lz_hdr) +
+           blocks * (sizeof(struct ta_ocram_lz_block) + TA_OCRAM_LZ_BLOCK);
+}
+
+size_t lz_pack(const uint8_t *src, size_t n, uint8_t *dst)
+{
+    struct ta_ocram_lz_hdr hdr = { TA_OCRAM_LZ_MAGIC, (uint32_t)n };
+    uint8_t *op = dst;
+
+    memcpy(op, &hdr, sizeof(hdr));
+    op += sizeof(hdr);
+    for (size_t off = 0; off < n; off += TA_OCRAM_LZ_BLOCK) {
+        struct ta_ocram_lz_block blk;
+        size_t raw = n - off < TA_OCRAM_LZ_BLOCK ? n - off : TA_OCRAM_LZ_BLOCK;
+        uint8_t *payload = op + sizeof(blk);
+
+        blk.raw = (uint16_t)raw;
+        blk.comp = (uint16_t)lz_compress_block(src + off, raw, payload, raw - 1);
+        if (!blk.comp)
+            memcpy(payload, src + off, raw);
+        memcpy(op, &blk, sizeof(blk));
+        op += sizeof(blk) + (blk.comp ? blk.comp : raw);
+    }
+    return op - dst;
+}
@@ -0,0 +1,30 @@
+/*
+ * lz.h
+ *
+ * LZ4 block format compressor for model images, producing the stream
+ * the TA decodes for TA_OCRAM_LOAD_FLAG_COMPRESSED loads (see struct
+ * ta_ocram_lz_hdr).
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Largest stream lz_pack() can produce for n input bytes */
+size_t lz_pack_bound(size_t n);
+
+/* Pack src into dst (lz_pack_bound(n) bytes), returns the stream size */
+size_t lz_pack(const uint8_t *src, size_t n, uint8_t *dst);
+
+/*
+ * Compress one block of at most TA_OCRAM_LZ_BLOCK bytes into dst (cap
+ * bytes). Returns the compressed size, 0 if it would not be smaller.
+ */
+size_t lz_compress_block(const uint8_t *src, size_t n, uint8_t *dst,
+                         size_t cap);
+
+#endif /* LZ_H */
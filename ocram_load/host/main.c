@@ -15,8 +15,18 @@
  #include <fcntl.h>
  #include <unistd.h>
  #include <inttypes.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <time.h>
  #include <tee_client_api.h>
  #include "ocram_load_ta.h"
+ #include "shm_pool.h"
+ #include "merkle.h"
+ #include "lz.h"
+ #include "daemon.h"
+ #include "rproc.h"
+ #include "stats.h"
+ #include "sha256.h"
  
 
 #define FILENAME                   "model_data.bin"
@@ -24,13 +34,90 @@
 #define SIGNATURE_FILE             "signature.bin"
 #define OUTPUT_MAKE_FILE           "input_data_signed_encrypted.bin"
 #define ENCRYPTED_INPUT_FILE       "input_data_signed_encrypted.bin"
+#define DIGEST_FILE                "input_data_signed_encrypted.bin.sha256"
+#define AEAD_FILE                  "input_data.ocad"
+#define MERKLE_FILE                "input_data.ocmk"
  #define READ_SIZE                  1024
+ #define LOAD_CHUNK_SIZE            (64 * 1024)
+ #define AEAD_CHUNK_SIZE            (16 * 1024)
+ #define MERKLE_BLOCK_SIZE          4096
  #define AES_TEST_BUFFER_SIZE       4096
  #define AES_TEST_KEY_SIZE          16
  #define AES_BLOCK_SIZE             16
  #define DECODE                     0
  #define ENCODE                     1
  #define DIGEST_SIZE                32
+ #define BATCH_DESC_SIZE            512
+ #define DAEMON_SESSIONS            4
+ /*
+  * remoteproc has no job completion event: inference waits this long for
+  * the core to stop before reading OCRAM back. Firmware that keeps running
+  * never stops by itself, so it costs the full wait; pass --wait 0 there.
+  */
+ #define INFERENCE_WAIT_MS          10000
+ #define BATCH_JOB_WAIT_MS          1000
+ 
+ /* TEE_ERROR_MAC_INVALID, not defined by older tee_client_api.h */
+ #ifndef TEEC_ERROR_MAC_INVALID
+ #define TEEC_ERROR_MAC_INVALID     0xFFFF3071
+ #endif
+ 
+ /* Command names for the --stats report, indexed by command id */
+ static const char *const ta_cmd_names[] = {
+     [TA_AES_CMD_PREPARE]                  = "PREPARE",
+     [TA_OCRAM_LOAD_CMD_DEC_VALUE]         = "DEC_VALUE",
+     [TA_OCRAM_LOAD_CMD_MAP_MEMORY]        = "MAP_MEMORY",
+     [TA_OCRAM_LOAD_CMD_LOAD]              = "LOAD",
+     [TA_OCRAM_LOAD_CMD_STORE]             = "STORE",
+     [TA_OCRAM_LOAD_CMD_READ]              = "READ",
+     [TA_AES_CMD_SET_KEY]                  = "SET_KEY",
+     [TA_AES_CMD_SET_IV]                   = "SET_IV",
+     [TA_AES_CMD_CIPHER]                   = "CIPHER",
+     [TA_ACIPHER_CMD_GEN_KEY]              = "GEN_KEY",
+     [TA_ACIPHER_CMD_ENCRYPT]              = "ENCRYPT",
+     [TA_ACIPHER_CMD_SIGN]                 = "SIGN",
+     [TA_ACIPHER_CMD_VERIFY]               = "VERIFY",
+     [TA_ACIPHER_CMD_DIGEST]               = "DIGEST",
+     [TA_OCRAM_LOAD_CMD_LOAD_BEGIN]        = "LOAD_BEGIN",
+     [TA_OCRAM_LOAD_CMD_LOAD_CHUNK]        = "LOAD_CHUNK",
+     [TA_OCRAM_LOAD_CMD_LOAD_END]          = "LOAD_END",
+     [TA_OCRAM_LOAD_CMD_LOAD_FROM_STORAGE] = "LOAD_FROM_STORAGE",
+     [TA_OCRAM_LOAD_CMD_LOAD_VERIFIED]     = "LOAD_VERIFIED",
+     [TA_OCRAM_LOAD_CMD_RESIDENT]          = "RESIDENT",
+     [TA_OCRAM_LOAD_CMD_SLOT_LOAD]         = "SLOT_LOAD",
+     [TA_OCRAM_LOAD_CMD_SLOT_LIST]         = "SLOT_LIST",
+     [TA_OCRAM_LOAD_CMD_SLOT_PIN]          = "SLOT_PIN",
+     [TA_OCRAM_LOAD_CMD_SLOT_EVICT]        = "SLOT_EVICT",
+     [TA_OCRAM_LOAD_CMD_LOAD_DELTA]        = "LOAD_DELTA",
+     [TA_OCRAM_LOAD_CMD_READ_AT]           = "READ_AT",
+     [TA_OCRAM_LOAD_CMD_READ_HASH]         = "READ_HASH",
+     [TA_OCRAM_LOAD_CMD_AEAD_BEGIN]        = "AEAD_BEGIN",
+     [TA_OCRAM_LOAD_CMD_AEAD_CHUNK]        = "AEAD_CHUNK",
+     [TA_OCRAM_LOAD_CMD_AEAD_END]          = "AEAD_END",
+     [TA_OCRAM_LOAD_CMD_AEAD_SEAL]         = "AEAD_SEAL",
+     [TA_OCRAM_LOAD_CMD_MERKLE_BEGIN]      = "MERKLE_BEGIN",
+     [TA_OCRAM_LOAD_CMD_MERKLE_BLOCKS]     = "MERKLE_BLOCKS",
+     [TA_OCRAM_LOAD_CMD_MERKLE_END]        = "MERKLE_END",
+     [TA_OCRAM_LOAD_CMD_STAGE]             = "STAGE",
+     [TA_OCRAM_LOAD_CMD_COMMIT]            = "COMMIT",
+     [TA_OCRAM_LOAD_CMD_GET_STATS]         = "GET_STATS",
+     [TA_OCRAM_LOAD_CMD_RESET_STATS]       = "RESET_STATS",
+     [TA_OCRAM_LOAD_CMD_BATCH]             = "BATCH",
+     [TA_AES_CMD_CIPHER_SG]                = "CIPHER_SG",
+     [TA_AES_CMD_RELEASE]                  = "AES_RELEASE",
+     [TA_AES_CMD_CIPHER_AT]                = "CIPHER_AT",
+ };
+ 
+ /* TEEC_InvokeCommand, timed per command for --stats */
+ static TEEC_Result ta_invoke(TEEC_Session *sess, uint32_t cmd,
+                              TEEC_Operation *op, uint32_t *origin) {
+     const size_t n = sizeof(ta_cmd_names) / sizeof(*ta_cmd_names);
+     struct timespec t0;
+     stats_start(&t0);
+     TEEC_Result res = TEEC_InvokeCommand(sess, cmd, op, origin);
+     stats_stop(&t0, cmd < n && ta_cmd_names[cmd] ? ta_cmd_names[cmd] : "OTHER");
+     return res;
+ }
  
  /* Utility to read entire file into buffer */
  static void *read_file(const char *fname, size_t *sz_out) {
@@ -41,12 +128,36 @@
      rewind(f);
      void *buf = malloc(sz);
      if (!buf) errx(1, "malloc %zu failed", sz);
+     struct timespec t0;
+     stats_start(&t0);
      if (fread(buf, 1, sz, f) != sz) errx(1, "fread %s failed", fname);
+     stats_stop(&t0, "file_read");
      fclose(f);
      *sz_out = sz;
      return buf;
  }
  
+ /*
+  * Read a file straight into a pooled shared memory block, leaving
+  * 'reserve' spare bytes after the data. The file size is stored in *sz_out.
+  */
+ static TEEC_SharedMemory *read_file_shm(struct shm_pool *pool, const char *fname,
+                                         size_t reserve, size_t *sz_out) {
+     FILE *f = fopen(fname, "rb");
+     if (!f) errx(1, "Failed to open %s", fname);
+     fseek(f, 0, SEEK_END);
+     size_t sz = ftell(f);
+     rewind(f);
+     TEEC_SharedMemory *shm = shm_pool_alloc(pool, sz + reserve);
+     struct timespec t0;
+     stats_start(&t0);
+     if (fread(shm->buffer, 1, sz, f) != sz) errx(1, "fread %s failed", fname);
+     stats_stop(&t0, "file_read");
+     fclose(f);
+     *sz_out = sz;
+     return shm;
+ }
+ 
  /* Utility to write buffer to file */
  static void write_file(const char *fname, const void *buf, size_t sz) {
      FILE *f = fopen(fname, "wb");
@@ -55,29 +166,170 @@
      fclose(f);
  }
  
+ /*
+  * TA_OCRAM_LOAD_CMD_BATCH descriptor: the op table grows from the
+  * start, inline blobs (keys, IVs) from the end. Op param types use the
+  * TEEC_ values, which are the TEE_PARAM_TYPE_ ones.
+  */
+ struct batch {
+     union {
+         struct ta_batch_hdr hdr;
+         uint8_t raw[BATCH_DESC_SIZE];
+     } d;
+     size_t blob;                /* start of the blob area */
+ };
+ 
+ static void batch_init(struct batch *b) {
+     memset(b, 0, sizeof(*b));
+     b->blob = BATCH_DESC_SIZE;
+ }
+ 
+ static size_t batch_ops_end(const struct batch *b) {
+     return sizeof(b->d.hdr) + b->d.hdr.count * sizeof(struct ta_batch_op);
+ }
+ 
+ /* Append an op, its params are filled in by the caller */
+ static struct ta_batch_op *batch_op(struct batch *b, uint32_t cmd, uint32_t pt) {
+     struct ta_batch_op *op = (struct ta_batch_op *)(&b->d.hdr + 1) + b->d.hdr.count;
+     if (b->d.hdr.count == TA_BATCH_MAX_OPS ||
+         batch_ops_end(b) + sizeof(*op) > b->blob)
+         errx(1, "BATCH descriptor full");
+     b->d.hdr.count++;
+     op->cmd = cmd;
+     op->param_types = pt;
+     return op;
+ }
+ 
+ /* Copy n bytes into the descriptor and point memref param p at them */
+ static void batch_blob(struct batch *b, struct ta_batch_param *p,
+                        const void *data, size_t n) {
+     if (b->blob < batch_ops_end(b) + n + 3)
+         errx(1, "BATCH descriptor full");
+     b->blob = (b->blob - n) & ~(size_t)3;
+     memcpy(b->d.raw + b->blob, data, n);
+     p->a = b->blob;
+     p->b = n;
+     p->ref = TA_BATCH_REF_DESC;
+ }
+ 
+ /* Run the batch, data (if any) is batch param 1 */
+ static void batch_run(TEEC_Session *sess, struct batch *b,
+                       TEEC_SharedMemory *data, size_t data_sz) {
+     TEEC_Operation op = {0}; uint32_t origin;
+     op.paramTypes = TEEC_PARAM_TYPES(
+         TEEC_MEMREF_TEMP_INOUT,
+         data ? TEEC_MEMREF_PARTIAL_INOUT : TEEC_NONE,
+         TEEC_NONE, TEEC_NONE);
+     op.params[0].tmpref.buffer = &b->d;
+     op.params[0].tmpref.size   = BATCH_DESC_SIZE;
+     if (data) {
+         op.params[1].memref.parent = data;
+         op.params[1].memref.offset = 0;
+         op.params[1].memref.size   = data_sz;
+     }
+     TEEC_Result res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_BATCH, &op, &origin);
+     if (res != TEEC_SUCCESS) {
+         const size_t n = sizeof(ta_cmd_names) / sizeof(*ta_cmd_names);
+         uint32_t done = b->d.hdr.done;
+         uint32_t cmd = done ? ((struct ta_batch_op *)(&b->d.hdr + 1))[done - 1].cmd : 0;
+         errx(1, "BATCH failed at op %u (%s): 0x%x origin 0x%x", done,
+              done && cmd < n && ta_cmd_names[cmd] ? ta_cmd_names[cmd] : "-",
+              res, origin);
+     }
+     /* The descriptor holds key material */
+     memset(b, 0, sizeof(*b));
+ }
+ 
  /* AES helpers */
- static void prepare_aes(TEEC_Session *sess, int encode) {
+ 
+ /*
+  * TA AES-CTR contexts by handle, [encode][256-bit key], 0 until
+  * prepared. They live for the whole command (all --repeat runs), so
+  * encode and decode each keep their own TA operation.
+  */
+ static uint32_t aes_handles[2][2];
+ 
+ /* Handle of the context for encode and key_sz, 0 if the TA has none left */
+ static uint32_t aes_handle(TEEC_Session *sess, int encode, size_t key_sz) {
+     uint32_t *h = &aes_handles[!!encode][key_sz == TA_AES_SIZE_256BIT];
      TEEC_Operation op = {0}; uint32_t origin;
+     if (*h)
+         return *h;
      op.paramTypes = TEEC_PARAM_TYPES(
          TEEC_VALUE_INPUT, TEEC_VALUE_INPUT,
-         TEEC_VALUE_INPUT, TEEC_NONE);
+         TEEC_VALUE_INPUT, TEEC_VALUE_OUTPUT);
      op.params[0].value.a = TA_AES_ALGO_CTR;
-     op.params[1].value.a = AES_TEST_KEY_SIZE;
+     op.params[1].value.a = key_sz;
      op.params[2].value.a = encode ? TA_AES_MODE_ENCODE : TA_AES_MODE_DECODE;
-     TEEC_Result res = TEEC_InvokeCommand(sess, TA_AES_CMD_PREPARE, &op, &origin);
-     if (res != TEEC_SUCCESS)
-         errx(1, "AES PREPARE failed: 0x%x origin 0x%x", res, origin);
+     if (ta_invoke(sess, TA_AES_CMD_PREPARE, &op, &origin) == TEEC_SUCCESS)
+         *h = op.params[3].value.a;
+     return *h;
  }
- static void set_key(TEEC_Session *sess, char *key, size_t key_sz) {
-     TEEC_Operation op = {0}; uint32_t origin;
-     op.paramTypes = TEEC_PARAM_TYPES(
-         TEEC_MEMREF_TEMP_INPUT, TEEC_NONE,
-         TEEC_NONE, TEEC_NONE);
-     op.params[0].tmpref.buffer = key;
-     op.params[0].tmpref.size   = key_sz;
-     TEEC_Result res = TEEC_InvokeCommand(sess, TA_AES_CMD_SET_KEY, &op, &origin);
-     if (res != TEEC_SUCCESS)
-         errx(1, "AES SET_KEY failed: 0x%x origin 0x%x", res, origin);
+ 
+ static void aes_release_handles(TEEC_Session *sess) {
+     for (size_t i = 0; i < sizeof(aes_handles) / sizeof(**aes_handles); i++) {
+         uint32_t *h = &aes_handles[0][0] + i;
+         TEEC_Operation op = {0}; uint32_t origin;
+         if (!*h)
+             continue;
+         op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE,
+                                          TEEC_NONE, TEEC_NONE);
+         op.params[0].value.a = *h;
+         ta_invoke(sess, TA_AES_CMD_RELEASE, &op, &origin);
+         *h = 0;
+     }
+ }
+ 
+ /*
+  * Commands errx() out on any failure, past the release in run_cli(). A
+  * daemon session outlives that request process, so release at exit too.
+  */
+ static TEEC_Session *aes_handles_sess;
+ 
+ static void aes_release_at_exit(void) {
+     if (aes_handles_sess)
+         aes_release_handles(aes_handles_sess);
+ }
+ 
+ /*
+  * SET_KEY + SET_IV for AES-CTR in one invoke, and with buf also the
+  * first CIPHER, in place over its first sz bytes. The context comes
+  * from aes_handle() and is left selected for the commands that follow
+  * (SET_IV, CIPHER, streamed loads); without a handle PREPARE runs first.
+  */
+ static void aes_start(TEEC_Session *sess, int encode,
+                       const void *key, size_t key_sz, const void *iv,
+                       TEEC_SharedMemory *buf, size_t sz) {
+     uint32_t h = aes_handle(sess, encode, key_sz);
+     uint32_t hpt = h ? TEEC_VALUE_INPUT : TEEC_NONE;
+     struct ta_batch_op *op;
+     struct batch b;
+ 
+     batch_init(&b);
+     if (!h) {
+         op = batch_op(&b, TA_AES_CMD_PREPARE, TEEC_PARAM_TYPES(
+             TEEC_VALUE_INPUT, TEEC_VALUE_INPUT, TEEC_VALUE_INPUT, TEEC_NONE));
+         op->p[0].a = TA_AES_ALGO_CTR;
+         op->p[1].a = key_sz;
+         op->p[2].a = encode ? TA_AES_MODE_ENCODE : TA_AES_MODE_DECODE;
+     }
+     op = batch_op(&b, TA_AES_CMD_SET_KEY, TEEC_PARAM_TYPES(
+         TEEC_MEMREF_TEMP_INPUT, TEEC_NONE, TEEC_NONE, hpt));
+     batch_blob(&b, &op->p[0], key, key_sz);
+     op->p[3].a = h;
+     op = batch_op(&b, TA_AES_CMD_SET_IV, TEEC_PARAM_TYPES(
+         TEEC_MEMREF_TEMP_INPUT, TEEC_NONE, TEEC_NONE, hpt));
+     batch_blob(&b, &op->p[0], iv, AES_BLOCK_SIZE);
+     op->p[3].a = h;
+     if (buf && sz) {
+         op = batch_op(&b, TA_AES_CMD_CIPHER, TEEC_PARAM_TYPES(
+             TEEC_MEMREF_TEMP_INOUT, TEEC_NONE, TEEC_NONE, hpt));
+         op->p[0] = (struct ta_batch_param){ .a = 0, .b = sz, .ref = 1 };
+         op->p[3].a = h;
+     } else {
+         buf = NULL;
+     }
+     batch_run(sess, &b, buf, sz);
  }
  static void set_iv(TEEC_Session *sess, char *iv, size_t iv_sz) {
      TEEC_Operation op = {0}; uint32_t origin;
@@ -86,7 +338,7 @@
          TEEC_NONE, TEEC_NONE);
      op.params[0].tmpref.buffer = iv;
      op.params[0].tmpref.size   = iv_sz;
-     TEEC_Result res = TEEC_InvokeCommand(sess, TA_AES_CMD_SET_IV, &op, &origin);
+     TEEC_Result res = ta_invoke(sess, TA_AES_CMD_SET_IV, &op, &origin);
      if (res != TEEC_SUCCESS)
          errx(1, "AES SET_IV failed: 0x%x origin 0x%x", res, origin);
  }
@@ -100,134 +352,1317 @@
      op.params[0].tmpref.size   = sz;
      op.params[1].tmpref.buffer = out;
      op.params[1].tmpref.size   = sz;
-     TEEC_Result res = TEEC_InvokeCommand(sess, TA_AES_CMD_CIPHER, &op, &origin);
+     TEEC_Result res = ta_invoke(sess, TA_AES_CMD_CIPHER, &op, &origin);
+     if (res != TEEC_SUCCESS)
+         errx(1, "AES CIPHER failed: 0x%x origin 0x%x", res, origin);
+ }
+ 
+ /*
+  * Cipher the first sz bytes of shared memory block buf in place, as a
+  * single INOUT memref: no bounce copy and no second buffer.
+  */
+ static void cipher_inplace(TEEC_Session *sess, TEEC_SharedMemory *buf,
+                            size_t sz) {
+     TEEC_Operation op = {0}; uint32_t origin;
+     op.paramTypes = TEEC_PARAM_TYPES(
+         TEEC_MEMREF_PARTIAL_INOUT,
+         TEEC_NONE, TEEC_NONE, TEEC_NONE);
+     op.params[0].memref.parent = buf;
+     op.params[0].memref.offset = 0;
+     op.params[0].memref.size   = sz;
+     TEEC_Result res = ta_invoke(sess, TA_AES_CMD_CIPHER, &op, &origin);
      if (res != TEEC_SUCCESS)
          errx(1, "AES CIPHER failed: 0x%x origin 0x%x", res, origin);
  }
  
- /* Simple AES file processor */
+ /*
+  * Same as cipher_inplace() for the bytes at offset off of the CTR
+  * stream; a following cipher_inplace() carries on after them.
+  */
+ static void cipher_inplace_at(TEEC_Session *sess, TEEC_SharedMemory *buf,
+                               size_t sz, uint64_t off) {
+     TEEC_Operation op = {0}; uint32_t origin;
+     op.paramTypes = TEEC_PARAM_TYPES(
+         TEEC_VALUE_INPUT,
+         TEEC_MEMREF_PARTIAL_INOUT,
+         TEEC_NONE, TEEC_NONE);
+     op.params[0].value.a = (uint32_t)off;
+     op.params[0].value.b = (uint32_t)(off >> 32);
+     op.params[1].memref.parent = buf;
+     op.params[1].memref.offset = 0;
+     op.params[1].memref.size   = sz;
+     TEEC_Result res = ta_invoke(sess, TA_AES_CMD_CIPHER_AT, &op, &origin);
+     if (res != TEEC_SUCCESS)
+         errx(1, "AES CIPHER_AT failed: 0x%x origin 0x%x", res, origin);
+ }
+ 
+ /*
+  * Simple AES file processor, ciphers in place in one page aligned buffer
+  * registered with the TEE, so only that one buffer is held in shared
+  * memory. Only len bytes (0: up to the end) from byte offset are
+  * processed and written; CTR lets them be ciphered without the bytes
+  * before them, e.g. to resume an interrupted transfer or split a file.
+  */
  static void process_aes_file(const char *infile,
                               const char *outfile,
-                              int encode,
-                              TEEC_Context *ctx,
+                              int encode, off_t offset, size_t len,
+                              struct shm_pool *pool,
                               TEEC_Session *sess) {
      FILE *fin  = fopen(infile,  "rb");
      FILE *fout = fopen(outfile, "wb");
      if (!fin || !fout) errx(1, "Failed to open files");
+     if (fseeko(fin, offset, SEEK_SET)) errx(1, "Failed to seek %s", infile);
+     size_t left = len ? len : SIZE_MAX;
  
      char key[AES_TEST_KEY_SIZE];
      char iv[AES_BLOCK_SIZE];
-     char inbuf[AES_TEST_BUFFER_SIZE];
-     char outbuf[AES_TEST_BUFFER_SIZE];
+     void *mem;
      size_t r;
  
+     if (posix_memalign(&mem, 4096, AES_TEST_BUFFER_SIZE))
+         errx(1, "malloc failed");
+     TEEC_SharedMemory *buf = shm_pool_register(pool, mem, AES_TEST_BUFFER_SIZE);
+ 
      memset(key, 0xa5, sizeof(key));
      memset(iv,  0x00, sizeof(iv));
  
-     prepare_aes(sess, encode);
-     set_key(sess, key, sizeof(key));
-     set_iv(sess, iv, sizeof(iv));
- 
-     while ((r = fread(inbuf, 1, sizeof(inbuf), fin)) > 0) {
-         cipher_buffer(sess, inbuf, outbuf, r);
-         fwrite(outbuf, 1, r, fout);
+     /* From offset 0 the setup invoke also ciphers the first chunk */
+     r = fread(mem, 1, left < AES_TEST_BUFFER_SIZE ? left : AES_TEST_BUFFER_SIZE, fin);
+     if (offset) {
+         aes_start(sess, encode, key, sizeof(key), iv, NULL, 0);
+         if (r > 0)
+             cipher_inplace_at(sess, buf, r, offset);
+     } else {
+         aes_start(sess, encode, key, sizeof(key), iv, buf, r);
+     }
+     while (r > 0) {
+         fwrite(mem, 1, r, fout);
+         left -= r;
+         r = fread(mem, 1, left < AES_TEST_BUFFER_SIZE ? left : AES_TEST_BUFFER_SIZE, fin);
+         if (r > 0)
+             cipher_inplace(sess, buf, r);
      }
+     shm_pool_free(pool, buf);
+     free(mem);
      fclose(fin);
      fclose(fout);
  }
  
- /* Sign-then-encrypt for 'make' */
- static void make_signed_encrypted(const char *infile,
-                                   const char *outfile,
-                                   TEEC_Session *sess) {
-     size_t data_sz;
-     uint8_t *data = read_file(infile, &data_sz);
+ static double elapsed_s(const struct timespec *t0) {
+     struct timespec t1;
+     clock_gettime(CLOCK_MONOTONIC, &t1);
+     return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+ }
+ 
+ /*
+  * 'bench': cipher mib MiB in LOAD_CHUNK_SIZE pieces, first with tmpref
+  * bounce buffers, then with pooled shared memory, and report MB/s.
+  */
+ static void bench_shm(TEEC_Session *sess, struct shm_pool *pool, size_t mib) {
+     size_t total = mib << 20;
+     char key[AES_TEST_KEY_SIZE], iv[AES_BLOCK_SIZE];
+     struct timespec t0;
+     double t_tmp, t_shm;
+ 
+     memset(key, 0xa5, sizeof(key));
+     memset(iv,  0x00, sizeof(iv));
+     aes_start(sess, ENCODE, key, sizeof(key), iv, NULL, 0);
+ 
+     uint8_t *inbuf = calloc(1, LOAD_CHUNK_SIZE);
+     uint8_t *outbuf = malloc(LOAD_CHUNK_SIZE);
+     if (!inbuf || !outbuf) errx(1, "malloc failed");
+     clock_gettime(CLOCK_MONOTONIC, &t0);
+     for (size_t done = 0; done < total; done += LOAD_CHUNK_SIZE)
+         cipher_buffer(sess, inbuf, outbuf, LOAD_CHUNK_SIZE);
+     t_tmp = elapsed_s(&t0);
+     free(inbuf);
+     free(outbuf);
+ 
+     TEEC_SharedMemory *buf = shm_pool_alloc(pool, LOAD_CHUNK_SIZE);
+     memset(buf->buffer, 0, LOAD_CHUNK_SIZE);
+     clock_gettime(CLOCK_MONOTONIC, &t0);
+     for (size_t done = 0; done < total; done += LOAD_CHUNK_SIZE)
+         cipher_inplace(sess, buf, LOAD_CHUNK_SIZE);
+     t_shm = elapsed_s(&t0);
+     shm_pool_free(pool, buf);
+ 
+     printf("AES-CTR %zu MiB in %u-byte chunks\n", mib, LOAD_CHUNK_SIZE);
+     printf("  tmpref:     %8.2f MB/s\n", total / t_tmp / 1e6);
+     printf("  shared mem: %8.2f MB/s\n", total / t_shm / 1e6);
+ }
+ 
+ /*
+  * Stream an encrypted 'data || trailer' file into OCRAM through
+  * LOAD_BEGIN/LOAD_CHUNK/LOAD_END, LOAD_CHUNK_SIZE bytes per invoke.
+  * Returns the number of bytes loaded; the TA hands back the digest of
+  * the loaded data and the decrypted trailer (trailer_sz bytes).
+  * flags are TA_OCRAM_LOAD_FLAG_xxx passed to LOAD_BEGIN.
+  */
+ static size_t stream_load_file(TEEC_Session *sess, struct shm_pool *pool,
+                                const char *fname, size_t trailer_sz,
+                                uint32_t flags, uint8_t *digest,
+                                uint8_t *trailer) {
+     FILE *f = fopen(fname, "rb");
+     if (!f) errx(1, "Failed to open %s", fname);
+     fseek(f, 0, SEEK_END);
+     size_t file_sz = ftell(f);
+     rewind(f);
+     if (file_sz < trailer_sz || trailer_sz > TA_OCRAM_LOAD_TRAILER_MAX)
+         errx(1, "File %s too small", fname);
+ 
+     TEEC_Operation op = {0}; uint32_t origin; TEEC_Result res;
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+     op.params[0].value.a = (uint32_t)(file_sz - trailer_sz);
+     op.params[0].value.b = flags;
+     res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_LOAD_BEGIN, &op, &origin);
+     if (res != TEEC_SUCCESS)
+         errx(1, "LOAD_BEGIN failed: 0x%x origin 0x%x", res, origin);
+ 
+     TEEC_SharedMemory *chunk = shm_pool_alloc(pool, LOAD_CHUNK_SIZE);
+     struct timespec t0;
+     size_t r;
+     for (;;) {
+         stats_start(&t0);
+         r = fread(chunk->buffer, 1, LOAD_CHUNK_SIZE, f);
+         stats_stop(&t0, "file_read");
+         if (!r)
+             break;
+         memset(&op, 0, sizeof(op));
+         op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+         op.params[0].memref.parent = chunk;
+         op.params[0].memref.offset = 0;
+         op.params[0].memref.size   = r;
+         res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_LOAD_CHUNK, &op, &origin);
+         if (res != TEEC_SUCCESS)
+             errx(1, "LOAD_CHUNK failed: 0x%x origin 0x%x", res, origin);
+     }
+     shm_pool_free(pool, chunk);
+     fclose(f);
+ 
+     memset(&op, 0, sizeof(op));
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_MEMREF_TEMP_OUTPUT,
+                                      TEEC_VALUE_OUTPUT, TEEC_NONE);
+     op.params[0].tmpref.buffer = digest;
+     op.params[0].tmpref.size   = DIGEST_SIZE;
+     op.params[1].tmpref.buffer = trailer;
+     op.params[1].tmpref.size   = trailer_sz;
+     res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_LOAD_END, &op, &origin);
+     if (res == TEEC_ERROR_SIGNATURE_INVALID)
+         errx(1, "Invalid signature, OCRAM cleared");
+     if (res != TEEC_SUCCESS)
+         errx(1, "LOAD_END failed: 0x%x origin 0x%x", res, origin);
+     if (op.params[1].tmpref.size != trailer_sz)
+         errx(1, "Unexpected trailer size %zu", op.params[1].tmpref.size);
+     return op.params[2].value.a;
+ }
+ 
+ /*
+  * Load the model kept in secure storage (TA_OCRAM_LOAD_CMD_STORE) into
+  * OCRAM without any file I/O or shared-memory transfer of the model.
+  * Same outputs as stream_load_file().
+  */
+ static size_t storage_load(TEEC_Session *sess, size_t trailer_sz,
+                            uint32_t flags, uint8_t *digest,
+                            uint8_t *trailer) {
+     TEEC_Operation op = {0}; uint32_t origin;
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_MEMREF_TEMP_OUTPUT,
+                                      TEEC_MEMREF_TEMP_OUTPUT, TEEC_VALUE_OUTPUT);
+     op.params[0].value.a = (uint32_t)trailer_sz;
+     op.params[0].value.b = flags;
+     op.params[1].tmpref.buffer = digest;
+     op.params[1].tmpref.size   = DIGEST_SIZE;
+     op.params[2].tmpref.buffer = trailer;
+     op.params[2].tmpref.size   = trailer_sz;
+     TEEC_Result res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_LOAD_FROM_STORAGE,
+                                          &op, &origin);
+     if (res == TEEC_ERROR_SIGNATURE_INVALID)
+         errx(1, "Invalid signature, OCRAM cleared");
+     if (res != TEEC_SUCCESS)
+         errx(1, "LOAD_FROM_STORAGE failed: 0x%x origin 0x%x", res, origin);
+     if (op.params[2].tmpref.size != trailer_sz)
+         errx(1, "Unexpected trailer size %zu", op.params[2].tmpref.size);
+     return op.params[3].value.a;
+ }
+ 
+ /*
+  * Fused inference load: the encrypted file is mapped and handed to the TA
+  * in one LOAD_VERIFIED, SLOT_LOAD or STAGE invoke, which decrypts, hashes,
+  * checks the signature and loads OCRAM without returning any plaintext.
+  * With a non-NULL expect digest the TA skips the load if that image is
+  * already resident. arg is passed as param[2].value.b. Outputs are left
+  * in op. Returns TEEC_ERROR_OUT_OF_MEMORY when the image does not fit in
+  * OCRAM as asked, exits on any other error.
+  */
+ static TEEC_Result invoke_verified_load(TEEC_Session *sess, struct shm_pool *pool,
+                                         uint32_t cmd, const char *fname,
+                                         const char *key, size_t key_sz,
+                                         const char *iv, uint32_t flags,
+                                         uint32_t arg, const uint8_t *expect,
+                                         TEEC_Operation *op) {
+     int fd = open(fname, O_RDONLY);
+     if (fd < 0) errx(1, "Failed to open %s", fname);
+     struct stat st;
+     if (fstat(fd, &st) < 0 || st.st_size == 0) errx(1, "Bad file %s", fname);
+     /* Private writable mapping so the pages can be registered with the TEE */
+     struct timespec t0;
+     stats_start(&t0);
+     void *enc = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+     if (enc == MAP_FAILED) errx(1, "mmap %s failed", fname);
+     close(fd);
+     TEEC_SharedMemory *shm = shm_pool_register(pool, enc, st.st_size);
+     stats_stop(&t0, "file_map");
+ 
+     uint8_t key_iv[32 + AES_BLOCK_SIZE + DIGEST_SIZE];
+     size_t key_iv_sz = key_sz + AES_BLOCK_SIZE;
+     if (key_sz > 32) errx(1, "Bad key size");
+     memcpy(key_iv, key, key_sz);
+     memcpy(key_iv + key_sz, iv, AES_BLOCK_SIZE);
+     if (expect) {
+         memcpy(key_iv + key_iv_sz, expect, DIGEST_SIZE);
+         key_iv_sz += DIGEST_SIZE;
+         flags |= TA_OCRAM_LOAD_FLAG_IF_CHANGED;
+     }
+ 
+     uint32_t origin;
+     memset(op, 0, sizeof(*op));
+     op->paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_WHOLE, TEEC_MEMREF_TEMP_INPUT,
+                                       cmd == TA_OCRAM_LOAD_CMD_SLOT_LOAD ?
+                                       TEEC_VALUE_INOUT : TEEC_VALUE_INPUT,
+                                       TEEC_VALUE_OUTPUT);
+     op->params[0].memref.parent = shm;
+     op->params[1].tmpref.buffer = key_iv;
+     op->params[1].tmpref.size   = key_iv_sz;
+     op->params[2].value.a = flags;
+     op->params[2].value.b = arg;
+     TEEC_Result res = ta_invoke(sess, cmd, op, &origin);
+     shm_pool_free(pool, shm);
+     munmap(enc, st.st_size);
+     if (res == TEEC_ERROR_SIGNATURE_INVALID)
+         errx(1, "Invalid signature, OCRAM content not started");
+     if (res != TEEC_SUCCESS && res != TEEC_ERROR_OUT_OF_MEMORY)
+         errx(1, "Verified load (cmd %u) failed: 0x%x origin 0x%x", cmd, res, origin);
+     return res;
+ }
+ 
+ /* LOAD_VERIFIED; *resident tells whether the image was already loaded */
+ static size_t verified_load_file(TEEC_Session *sess, struct shm_pool *pool,
+                                  const char *fname,
+                                  const char *key, size_t key_sz,
+                                  const char *iv, uint32_t flags,
+                                  const uint8_t *expect, int *resident) {
+     TEEC_Operation op;
+     if (invoke_verified_load(sess, pool, TA_OCRAM_LOAD_CMD_LOAD_VERIFIED, fname,
+                              key, key_sz, iv, flags, 0, expect, &op))
+         errx(1, "%s does not fit in OCRAM", fname);
+     *resident = op.params[3].value.b == TA_OCRAM_LOAD_RESIDENT;
+     return op.params[3].value.a;
+ }
+ 
+ /* SLOT_LOAD; returns the slot id, *resident as for verified_load_file() */
+ static uint32_t slot_load_file(TEEC_Session *sess, struct shm_pool *pool,
+                                const char *fname,
+                                const char *key, size_t key_sz,
+                                const char *iv, const uint8_t *expect,
+                                uint32_t *offset, uint32_t *size,
+                                int *resident) {
+     TEEC_Operation op;
+     if (invoke_verified_load(sess, pool, TA_OCRAM_LOAD_CMD_SLOT_LOAD, fname,
+                              key, key_sz, iv, 0, 0, expect, &op))
+         errx(1, "No OCRAM slot for %s, unpin or evict one", fname);
+     *resident = op.params[2].value.b == TA_OCRAM_LOAD_RESIDENT;
+     *offset = op.params[3].value.a;
+     *size = op.params[3].value.b;
+     return op.params[2].value.a;
+ }
+ 
+ static void slot_list(TEEC_Session *sess) {
+     struct ta_ocram_slot_info info[TA_OCRAM_LOAD_SLOTS];
+     TEEC_Operation op = {0}; uint32_t origin;
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_VALUE_OUTPUT,
+                                      TEEC_NONE, TEEC_NONE);
+     op.params[0].tmpref.buffer = info;
+     op.params[0].tmpref.size   = sizeof(info);
+     TEEC_Result res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_SLOT_LIST, &op, &origin);
+     if (res != TEEC_SUCCESS)
+         errx(1, "SLOT_LIST failed: 0x%x origin 0x%x", res, origin);
+     printf("slot  offset      size  gen  lru  sha256\n");
+     for (uint32_t i = 0; i < op.params[1].value.a; i++) {
+         printf("%4u  0x%06x  %6u  %3u  %3u  ", info[i].id, info[i].offset,
+                info[i].size, info[i].generation, info[i].last_use);
+         for (int j = 0; j < 8; j++)
+             printf("%02x", info[i].digest[j]);
+         printf("...%s\n", info[i].flags & TA_OCRAM_SLOT_PINNED ? " pinned" : "");
+     }
+ }
+ 
+ /* SLOT_PIN / SLOT_EVICT on one slot id */
+ static void slot_cmd(TEEC_Session *sess, uint32_t cmd, uint32_t id, uint32_t arg) {
+     TEEC_Operation op = {0}; uint32_t origin;
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+     op.params[0].value.a = id;
+     op.params[0].value.b = arg;
+     TEEC_Result res = ta_invoke(sess, cmd, &op, &origin);
+     if (res != TEEC_SUCCESS)
+         errx(1, "Slot command %u on slot %u failed: 0x%x origin 0x%x",
+              cmd, id, res, origin);
+ }
+ 
+ /*
+  * Digest sidecar written by 'make', 0 when there is none. Only a hint:
+  * the TA keeps a resident image for it only if the signature inside
+  * the encrypted image covers it.
+  */
+ static int read_digest_file(const char *fname, uint8_t *digest) {
+     FILE *f = fopen(fname, "rb");
+     if (!f) return 0;
+     int ok = fread(digest, 1, DIGEST_SIZE, f) == DIGEST_SIZE;
+     fclose(f);
+     return ok;
+ }
+ 
+ /* The M-core's remoteproc, under RPROC_SYSFS */
+ static const struct rproc *m_core(void) {
+     static struct rproc rp;
+     static int opened;
+     if (!opened && rproc_open(&rp, RPROC_SYSFS, RPROC_NAME))
+         err(1, "remoteproc %s", RPROC_NAME);
+     opened = 1;
+     return &rp;
+ }
+ 
+ /* Stop the remote core if it runs */
+ static void m_core_stop(void) {
+     if (rproc_stop(m_core()))
+         err(1, "stopping %s failed", RPROC_NAME);
+ }
+ 
+ /* Stop the remote core if it runs, then start it on the loaded image */
+ static void m_core_restart(void) {
+     struct timespec t0;
+     stats_start(&t0);
+     if (rproc_restart(m_core()))
+         err(1, "starting %s failed", RPROC_NAME);
+     stats_stop(&t0, "rproc_start");
+ }
  
+ /* Wait up to timeout_ms (< 0: forever) for the job on the core to end */
+ static int m_core_wait_done(int timeout_ms) {
+     struct timespec t0;
+     stats_start(&t0);
+     int done = rproc_wait(m_core(), ~RPROC_ACTIVE, timeout_ms) >= 0;
+     stats_stop(&t0, "rproc_job");
+     return done;
+ }
+ 
+ /*
+  * SIGN digest into data right behind its data_sz bytes, as 'make' lays
+  * out 'data || signature'. Returns the signature size.
+  */
+ static size_t sign_behind(TEEC_Session *sess, const uint8_t *digest,
+                           TEEC_SharedMemory *data, size_t data_sz,
+                           size_t sig_sz) {
+     TEEC_Operation op = {0}; uint32_t eo;
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_MEMREF_PARTIAL_OUTPUT, TEEC_NONE, TEEC_NONE);
+     op.params[0].tmpref.buffer = (void *)digest;
+     op.params[0].tmpref.size   = DIGEST_SIZE;
+     op.params[1].memref.parent = data;
+     op.params[1].memref.offset = data_sz;
+     op.params[1].memref.size   = sig_sz;
+     if (ta_invoke(sess, TA_ACIPHER_CMD_SIGN, &op, &eo) != TEEC_SUCCESS)
+         errx(1, "SIGN failed");
+     return op.params[1].memref.size;
+ }
+ 
+ /*
+  * 'delta': package the blocks of new_plain that differ from old_plain
+  * into a TA_OCRAM_LOAD_CMD_LOAD_DELTA container. The plaintexts are
+  * compared; the new revision is then signed and encrypted from a fresh
+  * random IV, carried in the header, so no CTR keystream ever covers two
+  * revisions. base_digest is the SHA-256 of old_plain, the digest the TA
+  * recorded when that image was loaded.
+  */
+ static void make_delta(TEEC_Session *sess, struct shm_pool *pool,
+                        const char *old_plain, const char *new_plain,
+                        const char *outfile, const char *key, size_t key_sz,
+                        size_t sig_max) {
+     size_t old_sz, new_sz;
+     uint8_t *old = read_file(old_plain, &old_sz);
+     TEEC_SharedMemory *shm = read_file_shm(pool, new_plain, sig_max, &new_sz);
+     uint8_t *new = shm->buffer;
+     struct ta_ocram_delta_hdr hdr = { .magic = TA_OCRAM_DELTA_MAGIC,
+                                       .block_size = TA_OCRAM_DELTA_BLOCK };
+     const size_t blk = TA_OCRAM_DELTA_BLOCK;
+     uint8_t digest[DIGEST_SIZE];
+     struct sha256_ctx c;
+ 
+     if (!new_sz)
+         errx(1, "%s is empty", new_plain);
+     sha256_init(&c);
+     sha256_update(&c, old, old_sz);
+     sha256_final(&c, hdr.base_digest);
+     hdr.data_size = new_sz;
+ 
+     /* Changed blocks; the one holding the data end carries the signature */
+     size_t nblk = (new_sz + blk - 1) / blk;
+     uint8_t *diff = malloc(nblk);
+     if (!diff) errx(1, "malloc %zu failed", nblk);
+     for (size_t i = 0; i < nblk; i++) {
+         size_t off = i * blk, n = new_sz - off < blk ? new_sz - off : blk;
+         diff[i] = off + n > old_sz || memcmp(old + off, new + off, n);
+     }
+     diff[nblk - 1] = 1;
+ 
+     sha256_init(&c);
+     sha256_update(&c, new, new_sz);
+     sha256_final(&c, digest);
+     size_t total = new_sz + sign_behind(sess, digest, shm, new_sz, sig_max);
+     int fd = open("/dev/urandom", O_RDONLY);
+     if (fd < 0 || read(fd, hdr.iv, sizeof(hdr.iv)) != sizeof(hdr.iv))
+         errx(1, "No random IV");
+     close(fd);
+     aes_start(sess, ENCODE, key, key_sz, hdr.iv, shm, total);
+ 
+     FILE *f = fopen(outfile, "wb");
+     if (!f) errx(1, "Failed to open %s", outfile);
+     fwrite(&hdr, 1, sizeof(hdr), f);
+     size_t changed = 0;
+     for (size_t i = 0; i < nblk; ) {
+         size_t j = i;
+         while (j < nblk && diff[j])
+             j++;
+         if (j == i) {
+             i++;
+             continue;
+         }
+         size_t off = i * blk, end = j == nblk ? total : j * blk;
+         struct ta_ocram_delta_entry e = { (uint32_t)off, (uint32_t)(end - off) };
+         fwrite(&e, 1, sizeof(e), f);
+         fwrite(new + off, 1, end - off, f);
+         hdr.count++;
+         changed += end - off;
+         i = j;
+     }
+     /* Patch the entry count now it is known */
+     fseek(f, 0, SEEK_SET);
+     fwrite(&hdr, 1, sizeof(hdr), f);
+     fclose(f);
+     free(diff);
+     free(old);
+     shm_pool_free(pool, shm);
+     printf("Delta '%s': %u entries, %zu of %zu bytes\n", outfile,
+            hdr.count, changed, total);
+ }
+ 
+ /* 'update': apply a delta container to the resident image */
+ static void apply_delta(TEEC_Session *sess, struct shm_pool *pool,
+                         const char *fname, const char *key, size_t key_sz) {
+     size_t sz;
+     TEEC_SharedMemory *shm = read_file_shm(pool, fname, 0, &sz);
+ 
+     TEEC_Operation op = {0}; uint32_t origin;
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT, TEEC_MEMREF_TEMP_INPUT,
+                                      TEEC_NONE, TEEC_VALUE_OUTPUT);
+     op.params[0].memref.parent = shm;
+     op.params[0].memref.offset = 0;
+     op.params[0].memref.size   = sz;
+     op.params[1].tmpref.buffer = (void *)key;
+     op.params[1].tmpref.size   = key_sz;
+     TEEC_Result res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_LOAD_DELTA, &op, &origin);
+     shm_pool_free(pool, shm);
+     if (res == TEEC_ERROR_BAD_STATE)
+         errx(1, "Resident image is not the delta base, do a full load");
+     if (res == TEEC_ERROR_SIGNATURE_INVALID)
+         errx(1, "Invalid signature, OCRAM cleared");
+     if (res != TEEC_SUCCESS)
+         errx(1, "LOAD_DELTA failed: 0x%x origin 0x%x", res, origin);
+     printf("Delta applied: %u bytes in %u blocks rewritten\n",
+            op.params[3].value.a, op.params[3].value.b);
+ }
+ 
+ /* Digest and size of the resident image, returns 0 if none is recorded */
+ static int resident_info(TEEC_Session *sess, uint8_t *digest,
+                          uint32_t *size, uint32_t *generation) {
+     TEEC_Operation op = {0}; uint32_t origin;
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_VALUE_OUTPUT,
+                                      TEEC_NONE, TEEC_NONE);
+     op.params[0].tmpref.buffer = digest;
+     op.params[0].tmpref.size   = DIGEST_SIZE;
+     TEEC_Result res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_RESIDENT, &op, &origin);
+     if (res == TEEC_ERROR_ITEM_NOT_FOUND)
+         return 0;
+     if (res != TEEC_SUCCESS)
+         errx(1, "RESIDENT failed: 0x%x origin 0x%x", res, origin);
+     *size = op.params[1].value.a;
+     if (generation)
+         *generation = op.params[1].value.b;
+     return 1;
+ }
+ 
+ static void print_digest(const uint8_t *digest) {
+     for (size_t i = 0; i < DIGEST_SIZE; i++)
+         printf("%02x", digest[i]);
+ }
+ 
+ /* 'resident': show which verified image the TA knows to be in OCRAM */
+ static void show_resident(TEEC_Session *sess) {
+     uint8_t digest[DIGEST_SIZE];
+     uint32_t size, gen;
+     if (!resident_info(sess, digest, &size, &gen)) {
+         printf("No verified image resident in OCRAM\n");
+         return;
+     }
+     printf("Resident: %u bytes, generation %u, sha256 ", size, gen);
+     print_digest(digest);
+     printf("\n");
+ }
+ 
+ /*
+  * 'readback': stream OCRAM [offset, offset + len) to a file with
+  * READ_AT, LOAD_CHUNK_SIZE bytes per invoke into one registered buffer.
+  */
+ static void readback_file(TEEC_Session *sess, struct shm_pool *pool,
+                           const char *fname, uint32_t offset, uint32_t len) {
+     FILE *f = fopen(fname, "wb");
+     if (!f) errx(1, "Failed to open %s", fname);
+     TEEC_SharedMemory *chunk = shm_pool_alloc(pool, LOAD_CHUNK_SIZE);
+     TEEC_Operation op = {0}; uint32_t origin;
+     uint32_t done = 0;
+ 
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_OUTPUT, TEEC_VALUE_INPUT,
+                                      TEEC_NONE, TEEC_NONE);
+     op.params[0].memref.parent = chunk;
+     op.params[0].memref.offset = 0;
+     while (done < len) {
+         uint32_t n = len - done < LOAD_CHUNK_SIZE ? len - done : LOAD_CHUNK_SIZE;
+         op.params[0].memref.size = n;
+         op.params[1].value.a = offset + done;
+         op.params[1].value.b = n;
+         TEEC_Result res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_READ_AT, &op, &origin);
+         if (res != TEEC_SUCCESS)
+             errx(1, "READ_AT 0x%x failed: 0x%x origin 0x%x", offset + done, res, origin);
+         if (fwrite(chunk->buffer, 1, n, f) != n)
+             errx(1, "fwrite %s failed", fname);
+         done += n;
+     }
+     shm_pool_free(pool, chunk);
+     fclose(f);
+     printf("Read %u bytes of OCRAM at 0x%x into '%s'\n", len, offset, fname);
+ }
+ 
+ /* SHA-256 of an OCRAM range, computed in the TA with one invoke */
+ static void ocram_digest(TEEC_Session *sess, uint32_t offset, uint32_t len,
+                          uint8_t *digest) {
+     TEEC_Operation op = {0}; uint32_t origin;
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_MEMREF_TEMP_OUTPUT,
+                                      TEEC_NONE, TEEC_NONE);
+     op.params[0].value.a = offset;
+     op.params[0].value.b = len;
+     op.params[1].tmpref.buffer = digest;
+     op.params[1].tmpref.size   = DIGEST_SIZE;
+     TEEC_Result res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_READ_HASH, &op, &origin);
+     if (res != TEEC_SUCCESS)
+         errx(1, "READ_HASH failed: 0x%x origin 0x%x", res, origin);
+ }
+ 
+ /*
+  * Time one encrypted image held in shm through LOAD_BEGIN/LOAD_CHUNK/
+  * LOAD_END, LOAD_CHUNK_SIZE bytes per invoke, no trailer.
+  */
+ static double timed_shm_load(TEEC_Session *sess, TEEC_SharedMemory *shm,
+                              size_t sz, uint32_t flags) {
+     TEEC_Operation op = {0}; uint32_t origin; TEEC_Result res;
+     uint8_t digest[DIGEST_SIZE], trailer[1];
+     struct timespec t0;
+ 
+     clock_gettime(CLOCK_MONOTONIC, &t0);
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+     op.params[0].value.a = (uint32_t)sz;
+     op.params[0].value.b = flags;
+     res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_LOAD_BEGIN, &op, &origin);
+     if (res != TEEC_SUCCESS)
+         errx(1, "LOAD_BEGIN failed: 0x%x origin 0x%x", res, origin);
+     for (size_t off = 0; off < sz; off += LOAD_CHUNK_SIZE) {
+         memset(&op, 0, sizeof(op));
+         op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+         op.params[0].memref.parent = shm;
+         op.params[0].memref.offset = off;
+         op.params[0].memref.size   = sz - off < LOAD_CHUNK_SIZE ? sz - off : LOAD_CHUNK_SIZE;
+         res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_LOAD_CHUNK, &op, &origin);
+         if (res != TEEC_SUCCESS)
+             errx(1, "LOAD_CHUNK failed: 0x%x origin 0x%x", res, origin);
+     }
+     memset(&op, 0, sizeof(op));
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_MEMREF_TEMP_OUTPUT,
+                                      TEEC_VALUE_OUTPUT, TEEC_NONE);
+     op.params[0].tmpref.buffer = digest;
+     op.params[0].tmpref.size   = DIGEST_SIZE;
+     op.params[1].tmpref.buffer = trailer;
+     op.params[1].tmpref.size   = 0;
+     res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_LOAD_END, &op, &origin);
+     if (res != TEEC_SUCCESS)
+         errx(1, "LOAD_END failed: 0x%x origin 0x%x", res, origin);
+     return elapsed_s(&t0);
+ }
+ 
+ /*
+  * 'lzbench': pack fname with lz_pack(), then load it into OCRAM both
+  * as is and packed (TA_OCRAM_LOAD_FLAG_COMPRESSED) and report the
+  * ratio and load rates. Overwrites whatever is in OCRAM.
+  */
+ static void lz_bench(TEEC_Session *sess, struct shm_pool *pool,
+                      const char *fname) {
+     char key[AES_TEST_KEY_SIZE], iv[AES_BLOCK_SIZE];
+     size_t raw_sz, packed_sz;
+     struct timespec t0;
+     double t_pack, t_raw, t_lz;
+ 
+     TEEC_SharedMemory *raw = read_file_shm(pool, fname, 0, &raw_sz);
+     TEEC_SharedMemory *packed = shm_pool_alloc(pool, lz_pack_bound(raw_sz));
+     clock_gettime(CLOCK_MONOTONIC, &t0);
+     packed_sz = lz_pack(raw->buffer, raw_sz, packed->buffer);
+     t_pack = elapsed_s(&t0);
+ 
+     memset(key, 0xa5, sizeof(key));
+     memset(iv,  0x00, sizeof(iv));
+     aes_start(sess, ENCODE, key, sizeof(key), iv, raw, raw_sz);
+     set_iv(sess, iv, sizeof(iv));
+     cipher_inplace(sess, packed, packed_sz);
+ 
+     aes_start(sess, DECODE, key, sizeof(key), iv, NULL, 0);
+     t_raw = timed_shm_load(sess, raw, raw_sz, 0);
+     set_iv(sess, iv, sizeof(iv));
+     t_lz = timed_shm_load(sess, packed, packed_sz,
+                           TA_OCRAM_LOAD_FLAG_COMPRESSED);
+     shm_pool_free(pool, packed);
+     shm_pool_free(pool, raw);
+ 
+     printf("%s: %zu -> %zu bytes (%.1f%%), packed in %.3f s\n", fname,
+            raw_sz, packed_sz, raw_sz ? 100.0 * packed_sz / raw_sz : 0.0, t_pack);
+     printf("  load raw:        %8.2f MB/s\n", raw_sz / t_raw / 1e6);
+     printf("  load compressed: %8.2f MB/s (of OCRAM data)\n", raw_sz / t_lz / 1e6);
+ }
+ 
+ /*
+  * STAGE fname behind the keep bytes the M-core is running. Returns the
+  * image size, 0 if both images do not fit in OCRAM side by side.
+  */
+ static size_t stage_file(TEEC_Session *sess, struct shm_pool *pool,
+                          const char *fname, const char *key, size_t key_sz,
+                          const char *iv, size_t keep) {
+     TEEC_Operation op;
+     if (invoke_verified_load(sess, pool, TA_OCRAM_LOAD_CMD_STAGE, fname,
+                              key, key_sz, iv, 0, (uint32_t)keep, NULL, &op))
+         return 0;
+     return op.params[3].value.a;
+ }
+ 
+ static size_t commit_staged(TEEC_Session *sess) {
+     TEEC_Operation op = {0}; uint32_t origin;
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_OUTPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+     TEEC_Result res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_COMMIT, &op, &origin);
+     if (res != TEEC_SUCCESS)
+         errx(1, "COMMIT failed: 0x%x origin 0x%x", res, origin);
+     return op.params[0].value.a;
+ }
+ 
+ /*
+  * 'batch': run each image on the M-core in turn. While job i runs, image
+  * i + 1 is decrypted and verified into the staging area; when job i has
+  * ended it is moved into place and the core restarted at once, so the
+  * decrypt and signature check are off the critical path. Images that do
+  * not fit next to the running one are loaded after it ends instead.
+  * remoteproc gives no job completion event and a firmware that does not
+  * stop by itself stays running, so each job gets at most wait_ms before
+  * the core is stopped for the next one.
+  */
+ static void run_batch(TEEC_Session *sess, struct shm_pool *pool,
+                       char *files[], int n, int wait_ms,
+                       const char *key, size_t key_sz, const char *iv) {
+     struct timespec t0, t1;
+     size_t size;
+     int resident;
+ 
+     clock_gettime(CLOCK_MONOTONIC, &t0);
+ 
+     m_core_stop();
+     size = verified_load_file(sess, pool, files[0], key, key_sz, iv,
+                               0, NULL, &resident);
+     m_core_restart();
+     printf("job 0: %s, %zu bytes\n", files[0], size);
+ 
+     for (int i = 1; i < n; i++) {
+         double t_stage, t_wait;
+         int done;
+ 
+         clock_gettime(CLOCK_MONOTONIC, &t1);
+         size_t staged = stage_file(sess, pool, files[i], key, key_sz, iv, size);
+         t_stage = elapsed_s(&t1);
+ 
+         clock_gettime(CLOCK_MONOTONIC, &t1);
+         done = m_core_wait_done(wait_ms);
+         t_wait = elapsed_s(&t1);
+ 
+         m_core_stop();
+         if (staged)
+             size = commit_staged(sess);
+         else
+             size = verified_load_file(sess, pool, files[i], key, key_sz, iv,
+                                       0, NULL, &resident);
+         m_core_restart();
+         printf("job %d: %s, %zu bytes, %s in %.1f ms, waited %.1f ms for job %d%s\n",
+                i, files[i], size, staged ? "staged" : "does not fit, loaded after",
+                t_stage * 1e3, t_wait * 1e3, i - 1, done ? "" : " (timed out)");
+     }
+     if (!m_core_wait_done(wait_ms))
+         printf("job %d still running after %d ms\n", n - 1, wait_ms);
+ 
+     double total = elapsed_s(&t0);
+     printf("%d jobs in %.3f s, %.2f jobs/s\n", n, total, n / total);
+ }
+ 
+ static void gen_sign_key(TEEC_Session *sess, size_t key_size) {
      TEEC_Operation op = {0}; uint32_t eo;
-     size_t key_size = 2048;
      op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
      op.params[0].value.a = (uint32_t)key_size;
-     if (TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_GEN_KEY, &op, &eo) != TEEC_SUCCESS)
+     if (ta_invoke(sess, TA_ACIPHER_CMD_GEN_KEY, &op, &eo) != TEEC_SUCCESS)
          errx(1, "GEN_KEY failed");
+ }
+ 
+ /*
+  * Sign-then-encrypt for 'make'. With lz the data is LZ4-packed (see
+  * struct ta_ocram_lz_hdr) after hashing, so the signature and the
+  * DIGEST_FILE still cover the image as it ends up in OCRAM.
+  */
+ static void make_signed_encrypted(const char *infile,
+                                   const char *outfile, int lz,
+                                   struct shm_pool *pool,
+                                   TEEC_Session *sess) {
+     size_t key_size = 2048;
+     size_t data_sz;
+     /* Leave room after the data so the signature can be appended in place */
+     TEEC_SharedMemory *data = read_file_shm(pool, infile, key_size/8, &data_sz);
+ 
+     TEEC_Operation op = {0}; uint32_t eo;
+     gen_sign_key(sess, key_size);
  
      uint8_t digest[DIGEST_SIZE];
-     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE);
-     op.params[0].tmpref.buffer = data;
-     op.params[0].tmpref.size   = data_sz;
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT, TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE);
+     op.params[0].memref.parent = data;
+     op.params[0].memref.offset = 0;
+     op.params[0].memref.size   = data_sz;
      op.params[1].tmpref.buffer = digest;
      op.params[1].tmpref.size   = DIGEST_SIZE;
-     if (TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_DIGEST, &op, &eo) != TEEC_SUCCESS)
+     if (ta_invoke(sess, TA_ACIPHER_CMD_DIGEST, &op, &eo) != TEEC_SUCCESS)
          errx(1, "DIGEST failed");
  
-     size_t sig_sz = key_size/8;
-     uint8_t *sig = malloc(sig_sz);
-     op.params[0].tmpref.buffer = digest;
-     op.params[0].tmpref.size   = DIGEST_SIZE;
-     op.params[1].tmpref.buffer = sig;
-     op.params[1].tmpref.size   = sig_sz;
-     if (TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_SIGN, &op, &eo) != TEEC_SUCCESS)
-         errx(1, "SIGN failed");
-     sig_sz = op.params[1].tmpref.size;
+     if (lz) {
+         TEEC_SharedMemory *packed = shm_pool_alloc(pool, lz_pack_bound(data_sz) + key_size/8);
+         size_t raw_sz = data_sz;
+         data_sz = lz_pack(data->buffer, raw_sz, packed->buffer);
+         shm_pool_free(pool, data);
+         data = packed;
+         printf("Packed %zu -> %zu bytes (%.1f%%)\n", raw_sz, data_sz,
+                raw_sz ? 100.0 * data_sz / raw_sz : 0.0);
+     }
+ 
+     /* Signature is written straight behind the data */
+     size_t sig_sz = sign_behind(sess, digest, data, data_sz, key_size/8);
  
      size_t combined_sz = data_sz + sig_sz;
-     uint8_t *combined = malloc(combined_sz);
-     memcpy(combined, data, data_sz);
-     memcpy(combined + data_sz, sig, sig_sz);
-     free(data);
-     free(sig);
  
      char key[AES_TEST_KEY_SIZE], iv[AES_BLOCK_SIZE];
      memset(key, 0xa5, sizeof(key));
      memset(iv,  0x00, sizeof(iv));
-     prepare_aes(sess, ENCODE);
-     set_key(sess, key, sizeof(key));
-     set_iv(sess, iv, sizeof(iv));
- 
-     uint8_t *outbuf = malloc(combined_sz);
-     cipher_buffer(sess, combined, outbuf, combined_sz);
-     write_file(outfile, outbuf, combined_sz);
-     free(combined);
-     free(outbuf);
+     aes_start(sess, ENCODE, key, sizeof(key), iv, data, combined_sz);
+     write_file(outfile, data->buffer, combined_sz);
+     shm_pool_free(pool, data);
+     /* Lets 'inference' ask the TA to skip reloading an identical image */
+     write_file(DIGEST_FILE, digest, DIGEST_SIZE);
      printf("Generated '%s' (%zu bytes)\n", outfile, combined_sz);
  }
  
- int main(int argc, char *argv[]) {
-     if (argc < 2) {
-         fprintf(stderr, "Usage: %s <store|load|read|encrypt|decrypt|sign|verify|make|inference> [args]\n", argv[0]);
+ /*
+  * 'make --aead': package infile as an AES-GCM chunked image (see struct
+  * ta_ocram_aead_hdr). Records are sealed by the TA one chunk at a time;
+  * the header is written last, once the tag root is known, and signed.
+  */
+ static void make_aead(const char *infile, const char *outfile,
+                       uint32_t chunk_size, const char *key, size_t key_sz,
+                       struct shm_pool *pool, TEEC_Session *sess) {
+     size_t key_size = 2048;
+     size_t data_sz;
+     TEEC_SharedMemory *data = read_file_shm(pool, infile, 0, &data_sz);
+     if (!data_sz || chunk_size % AES_BLOCK_SIZE ||
+         chunk_size > TA_OCRAM_AEAD_CHUNK_MAX)
+         errx(1, "Bad input or chunk size");
+ 
+     struct ta_ocram_aead_hdr hdr = {0};
+     hdr.magic = TA_OCRAM_AEAD_MAGIC;
+     hdr.chunk_size = chunk_size;
+     hdr.data_size = (uint32_t)data_sz;
+     hdr.count = (uint32_t)((data_sz + chunk_size - 1) / chunk_size);
+     /* Fresh nonce per image: the key is reused across images */
+     int rfd = open("/dev/urandom", O_RDONLY);
+     if (rfd < 0 || read(rfd, hdr.nonce, sizeof(hdr.nonce)) != sizeof(hdr.nonce))
+         errx(1, "Cannot read /dev/urandom");
+     close(rfd);
+ 
+     gen_sign_key(sess, key_size);
+ 
+     TEEC_Operation op = {0}; uint32_t eo;
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT, TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE);
+     op.params[0].memref.parent = data;
+     op.params[0].memref.offset = 0;
+     op.params[0].memref.size   = data_sz;
+     op.params[1].tmpref.buffer = hdr.digest;
+     op.params[1].tmpref.size   = DIGEST_SIZE;
+     if (ta_invoke(sess, TA_ACIPHER_CMD_DIGEST, &op, &eo) != TEEC_SUCCESS)
+         errx(1, "DIGEST failed");
+ 
+     FILE *f = fopen(outfile, "wb");
+     if (!f) errx(1, "Failed to open %s", outfile);
+     /* Header and signature placeholder, rewritten at the end */
+     uint8_t sig[TA_OCRAM_LOAD_TRAILER_MAX] = {0};
+     size_t sig_sz = key_size / 8;
+     if (fwrite(&hdr, 1, sizeof(hdr), f) != sizeof(hdr) ||
+         fwrite(sig, 1, sig_sz, f) != sig_sz)
+         errx(1, "fwrite %s failed", outfile);
+ 
+     uint8_t key_nonce[32 + TA_OCRAM_AEAD_NONCE_SIZE];
+     if (key_sz > 32) errx(1, "Bad key size");
+     memcpy(key_nonce, key, key_sz);
+     memcpy(key_nonce + key_sz, hdr.nonce, sizeof(hdr.nonce));
+     uint8_t *tags = malloc((size_t)hdr.count * TA_OCRAM_AEAD_TAG_SIZE);
+     TEEC_SharedMemory *rec = shm_pool_alloc(pool, chunk_size + TA_OCRAM_AEAD_TAG_SIZE);
+     if (!tags) errx(1, "malloc failed");
+ 
+     for (uint32_t i = 0; i < hdr.count; i++) {
+         size_t off = (size_t)i * chunk_size;
+         size_t n = data_sz - off < chunk_size ? data_sz - off : chunk_size;
+         memset(&op, 0, sizeof(op));
+         op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_VALUE_INPUT,
+                                          TEEC_MEMREF_PARTIAL_INPUT, TEEC_MEMREF_PARTIAL_OUTPUT);
+         op.params[0].tmpref.buffer = key_nonce;
+         op.params[0].tmpref.size   = key_sz + TA_OCRAM_AEAD_NONCE_SIZE;
+         op.params[1].value.a = i;
+         op.params[2].memref.parent = data;
+         op.params[2].memref.offset = off;
+         op.params[2].memref.size   = n;
+         op.params[3].memref.parent = rec;
+         op.params[3].memref.offset = 0;
+         op.params[3].memref.size   = n + TA_OCRAM_AEAD_TAG_SIZE;
+         TEEC_Result res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_AEAD_SEAL, &op, &eo);
+         if (res != TEEC_SUCCESS)
+             errx(1, "AEAD_SEAL failed: 0x%x", res);
+         memcpy(tags + (size_t)i * TA_OCRAM_AEAD_TAG_SIZE,
+                (uint8_t *)rec->buffer + n, TA_OCRAM_AEAD_TAG_SIZE);
+         if (fwrite(rec->buffer, 1, n + TA_OCRAM_AEAD_TAG_SIZE, f) != n + TA_OCRAM_AEAD_TAG_SIZE)
+             errx(1, "fwrite %s failed", outfile);
+     }
+     shm_pool_free(pool, rec);
+     shm_pool_free(pool, data);
+ 
+     memset(&op, 0, sizeof(op));
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE);
+     op.params[0].tmpref.buffer = tags;
+     op.params[0].tmpref.size   = (size_t)hdr.count * TA_OCRAM_AEAD_TAG_SIZE;
+     op.params[1].tmpref.buffer = hdr.root;
+     op.params[1].tmpref.size   = DIGEST_SIZE;
+     if (ta_invoke(sess, TA_ACIPHER_CMD_DIGEST, &op, &eo) != TEEC_SUCCESS)
+         errx(1, "DIGEST failed");
+     free(tags);
+ 
+     /* SIGN hashes the header itself, as AEAD_BEGIN expects */
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE);
+     op.params[0].tmpref.buffer = &hdr;
+     op.params[0].tmpref.size   = sizeof(hdr);
+     op.params[1].tmpref.buffer = sig;
+     op.params[1].tmpref.size   = sig_sz;
+     if (ta_invoke(sess, TA_ACIPHER_CMD_SIGN, &op, &eo) != TEEC_SUCCESS ||
+         op.params[1].tmpref.size != sig_sz)
+         errx(1, "SIGN failed");
+ 
+     rewind(f);
+     if (fwrite(&hdr, 1, sizeof(hdr), f) != sizeof(hdr) ||
+         fwrite(sig, 1, sig_sz, f) != sig_sz)
+         errx(1, "fwrite %s failed", outfile);
+     fclose(f);
+     printf("Generated '%s' (%u bytes in %u records of %u)\n", outfile,
+            hdr.data_size, hdr.count, chunk_size);
+ }
+ 
+ /*
+  * Load an AES-GCM chunked image: AEAD_BEGIN with the signed header, then
+  * as many whole records per AEAD_CHUNK as fit in LOAD_CHUNK_SIZE, then
+  * AEAD_END. The image digest is in the signed header, so the TA is always
+  * asked to keep an identical resident image (*resident).
+  */
+ static size_t aead_load_file(TEEC_Session *sess, struct shm_pool *pool,
+                              const char *fname, const char *key,
+                              size_t key_sz, uint32_t flags, int *resident) {
+     FILE *f = fopen(fname, "rb");
+     if (!f) errx(1, "Failed to open %s", fname);
+     size_t sig_sz = 2048 / 8;
+     uint8_t head[sizeof(struct ta_ocram_aead_hdr) + TA_OCRAM_LOAD_TRAILER_MAX];
+     struct ta_ocram_aead_hdr hdr;
+     if (fread(head, 1, sizeof(hdr) + sig_sz, f) != sizeof(hdr) + sig_sz)
+         errx(1, "File %s too small", fname);
+     memcpy(&hdr, head, sizeof(hdr));
+     if (hdr.magic != TA_OCRAM_AEAD_MAGIC || !hdr.chunk_size)
+         errx(1, "%s is not an AEAD image", fname);
+ 
+     TEEC_Operation op = {0}; uint32_t origin; TEEC_Result res;
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_MEMREF_TEMP_INPUT,
+                                      TEEC_VALUE_INPUT, TEEC_VALUE_OUTPUT);
+     op.params[0].tmpref.buffer = head;
+     op.params[0].tmpref.size   = sizeof(hdr) + sig_sz;
+     op.params[1].tmpref.buffer = (void *)key;
+     op.params[1].tmpref.size   = key_sz;
+     op.params[2].value.a = flags | TA_OCRAM_LOAD_FLAG_IF_CHANGED;
+     res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_AEAD_BEGIN, &op, &origin);
+     if (res == TEEC_ERROR_SIGNATURE_INVALID)
+         errx(1, "Invalid header signature, OCRAM content not started");
+     if (res != TEEC_SUCCESS)
+         errx(1, "AEAD_BEGIN failed: 0x%x origin 0x%x", res, origin);
+     *resident = op.params[3].value.b == TA_OCRAM_LOAD_RESIDENT;
+     if (*resident) {
+         fclose(f);
+         return op.params[3].value.a;
+     }
+ 
+     /* Whole records only: the TA authenticates one record at a time */
+     size_t rec_sz = (size_t)hdr.chunk_size + TA_OCRAM_AEAD_TAG_SIZE;
+     size_t buf_sz = rec_sz > LOAD_CHUNK_SIZE ? rec_sz : LOAD_CHUNK_SIZE / rec_sz * rec_sz;
+     TEEC_SharedMemory *chunk = shm_pool_alloc(pool, buf_sz);
+     size_t r;
+     while ((r = fread(chunk->buffer, 1, buf_sz, f)) > 0) {
+         memset(&op, 0, sizeof(op));
+         op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT, TEEC_VALUE_OUTPUT,
+                                          TEEC_NONE, TEEC_NONE);
+         op.params[0].memref.parent = chunk;
+         op.params[0].memref.offset = 0;
+         op.params[0].memref.size   = r;
+         res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_AEAD_CHUNK, &op, &origin);
+         if (res == TEEC_ERROR_MAC_INVALID)
+             errx(1, "Record %u failed authentication, OCRAM cleared",
+                  op.params[1].value.a);
+         if (res != TEEC_SUCCESS)
+             errx(1, "AEAD_CHUNK failed: 0x%x origin 0x%x", res, origin);
+     }
+     shm_pool_free(pool, chunk);
+     fclose(f);
+ 
+     memset(&op, 0, sizeof(op));
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_OUTPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+     res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_AEAD_END, &op, &origin);
+     if (res == TEEC_ERROR_SIGNATURE_INVALID)
+         errx(1, "Records do not match the signed header, OCRAM cleared");
+     if (res != TEEC_SUCCESS)
+         errx(1, "AEAD_END failed: 0x%x origin 0x%x", res, origin);
+     return op.params[0].value.a;
+ }
+ 
+ /*
+  * 'make --merkle': hash infile in block_size blocks on all CPUs, sign
+  * only the Merkle root (in the header), AES-CTR encrypt the data and
+  * write one record per block with its authentication path.
+  */
+ static void make_merkle(const char *infile, const char *outfile,
+                         uint32_t block_size, char *key, size_t key_sz,
+                         char *iv, struct shm_pool *pool,
+                         TEEC_Session *sess) {
+     size_t key_size = 2048;
+     size_t data_sz;
+     TEEC_SharedMemory *data = read_file_shm(pool, infile, 0, &data_sz);
+     if (!data_sz || !block_size || block_size % AES_BLOCK_SIZE)
+         errx(1, "Bad input or block size");
+ 
+     struct merkle_tree tree;
+     long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+     struct timespec t0;
+     clock_gettime(CLOCK_MONOTONIC, &t0);
+     if (merkle_build(&tree, data->buffer, data_sz, block_size,
+                      cpus > 0 ? (unsigned)cpus : 1))
+         errx(1, "Merkle tree allocation failed");
+     double t_hash = elapsed_s(&t0);
+ 
+     struct ta_ocram_merkle_hdr hdr = {0};
+     hdr.magic = TA_OCRAM_MERKLE_MAGIC;
+     hdr.block_size = block_size;
+     hdr.data_size = (uint32_t)data_sz;
+     hdr.count = tree.count;
+     memcpy(hdr.root, merkle_root(&tree), sizeof(hdr.root));
+ 
+     /* SIGN hashes the header itself, as MERKLE_BEGIN expects */
+     uint8_t sig[TA_OCRAM_LOAD_TRAILER_MAX];
+     size_t sig_sz = key_size / 8;
+     gen_sign_key(sess, key_size);
+     TEEC_Operation op = {0}; uint32_t eo;
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE);
+     op.params[0].tmpref.buffer = &hdr;
+     op.params[0].tmpref.size   = sizeof(hdr);
+     op.params[1].tmpref.buffer = sig;
+     op.params[1].tmpref.size   = sig_sz;
+     if (ta_invoke(sess, TA_ACIPHER_CMD_SIGN, &op, &eo) != TEEC_SUCCESS ||
+         op.params[1].tmpref.size != sig_sz)
+         errx(1, "SIGN failed");
+ 
+     aes_start(sess, ENCODE, key, key_sz, iv, data, data_sz);
+ 
+     FILE *f = fopen(outfile, "wb");
+     if (!f) errx(1, "Failed to open %s", outfile);
+     if (fwrite(&hdr, 1, sizeof(hdr), f) != sizeof(hdr) ||
+         fwrite(sig, 1, sig_sz, f) != sig_sz)
+         errx(1, "fwrite %s failed", outfile);
+     uint8_t *path = malloc((size_t)tree.levels * SHA256_SIZE);
+     if (!path) errx(1, "malloc failed");
+     for (uint32_t i = 0; i < tree.count; i++) {
+         size_t off = (size_t)i * block_size;
+         size_t n = data_sz - off < block_size ? data_sz - off : block_size;
+         struct ta_ocram_merkle_rec rec = { i, merkle_path(&tree, i, path) };
+         size_t path_sz = (size_t)rec.nodes * SHA256_SIZE;
+         if (fwrite(&rec, 1, sizeof(rec), f) != sizeof(rec) ||
+             fwrite((uint8_t *)data->buffer + off, 1, n, f) != n ||
+             fwrite(path, 1, path_sz, f) != path_sz)
+             errx(1, "fwrite %s failed", outfile);
+     }
+     fclose(f);
+     free(path);
+     shm_pool_free(pool, data);
+     printf("Generated '%s' (%u bytes, %u blocks of %u, depth %u)\n", outfile,
+            hdr.data_size, hdr.count, block_size, tree.levels - 1);
+     printf("  tree hashed on %ld CPUs in %.3f s\n", cpus > 0 ? cpus : 1, t_hash);
+     merkle_free(&tree);
+ }
+ 
+ /* Is block index one of the n blocks listed in only (all when !only)? */
+ static int merkle_wanted(const uint32_t *only, size_t n, uint32_t index) {
+     if (!only)
          return 1;
+     for (size_t i = 0; i < n; i++)
+         if (only[i] == index)
+             return 1;
+     return 0;
+ }
+ 
+ /*
+  * Load a Merkle image: MERKLE_BEGIN with the signed header, then whole
+  * records batched into LOAD_CHUNK_SIZE per MERKLE_BLOCKS, then
+  * MERKLE_END. With only, just those blocks of the already resident image
+  * are rewritten (TA_OCRAM_LOAD_FLAG_PARTIAL). Returns the bytes written;
+  * *resident is set when a full load found the image already loaded.
+  */
+ static size_t merkle_load_file(TEEC_Session *sess, struct shm_pool *pool,
+                                const char *fname, const char *key,
+                                size_t key_sz, const char *iv, uint32_t flags,
+                                const uint32_t *only, size_t n_only,
+                                int *resident) {
+     FILE *f = fopen(fname, "rb");
+     if (!f) errx(1, "Failed to open %s", fname);
+     size_t sig_sz = 2048 / 8;
+     uint8_t head[sizeof(struct ta_ocram_merkle_hdr) + TA_OCRAM_LOAD_TRAILER_MAX];
+     struct ta_ocram_merkle_hdr hdr;
+     if (fread(head, 1, sizeof(hdr) + sig_sz, f) != sizeof(hdr) + sig_sz)
+         errx(1, "File %s too small", fname);
+     memcpy(&hdr, head, sizeof(hdr));
+     if (hdr.magic != TA_OCRAM_MERKLE_MAGIC || !hdr.block_size)
+         errx(1, "%s is not a Merkle image", fname);
+ 
+     uint8_t key_iv[32 + AES_BLOCK_SIZE];
+     if (key_sz > 32) errx(1, "Bad key size");
+     memcpy(key_iv, key, key_sz);
+     memcpy(key_iv + key_sz, iv, AES_BLOCK_SIZE);
+ 
+     TEEC_Operation op = {0}; uint32_t origin; TEEC_Result res;
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_MEMREF_TEMP_INPUT,
+                                      TEEC_VALUE_INPUT, TEEC_VALUE_OUTPUT);
+     op.params[0].tmpref.buffer = head;
+     op.params[0].tmpref.size   = sizeof(hdr) + sig_sz;
+     op.params[1].tmpref.buffer = key_iv;
+     op.params[1].tmpref.size   = key_sz + AES_BLOCK_SIZE;
+     op.params[2].value.a = flags | (only ? TA_OCRAM_LOAD_FLAG_PARTIAL
+                                          : TA_OCRAM_LOAD_FLAG_IF_CHANGED);
+     res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_MERKLE_BEGIN, &op, &origin);
+     if (res == TEEC_ERROR_SIGNATURE_INVALID)
+         errx(1, "Invalid header signature, OCRAM content not started");
+     if (res == TEEC_ERROR_BAD_STATE && only)
+         errx(1, "%s is not the resident image, do a full load", fname);
+     if (res != TEEC_SUCCESS)
+         errx(1, "MERKLE_BEGIN failed: 0x%x origin 0x%x", res, origin);
+     *resident = op.params[3].value.b == TA_OCRAM_LOAD_RESIDENT;
+     if (*resident) {
+         fclose(f);
+         return op.params[3].value.a;
      }
-     TEEC_Result res; uint32_t eo;
-     TEEC_Context ctx; TEEC_Session sess;
-     const TEEC_UUID uuid = TA_OCRAM_LOAD_UUID;
  
-     if (TEEC_InitializeContext(NULL, &ctx) != TEEC_SUCCESS)
-         errx(1, "TEEC_InitializeContext failed");
-     if (TEEC_OpenSession(&ctx, &sess, &uuid, TEEC_LOGIN_PUBLIC, NULL, NULL, &eo) != TEEC_SUCCESS)
-         errx(1, "TEEC_OpenSession failed");
+     TEEC_SharedMemory *chunk = shm_pool_alloc(pool, LOAD_CHUNK_SIZE);
+     size_t fill = 0;
+     struct ta_ocram_merkle_rec rec;
+     for (;;) {
+         int eof = fread(&rec, 1, sizeof(rec), f) != sizeof(rec);
+         size_t n = 0, rec_sz = 0;
+         if (!eof) {
+             if (rec.index >= hdr.count || rec.nodes > 32)
+                 errx(1, "Bad record in %s", fname);
+             n = hdr.data_size - (size_t)rec.index * hdr.block_size;
+             if (n > hdr.block_size)
+                 n = hdr.block_size;
+             rec_sz = sizeof(rec) + n + (size_t)rec.nodes * SHA256_SIZE;
+             if (rec_sz > LOAD_CHUNK_SIZE)
+                 errx(1, "Record too large in %s", fname);
+             if (!merkle_wanted(only, n_only, rec.index)) {
+                 fseek(f, rec_sz - sizeof(rec), SEEK_CUR);
+                 continue;
+             }
+         }
+         /* Send the batch when the next record does not fit, or at EOF */
+         if (fill && (eof || fill + rec_sz > LOAD_CHUNK_SIZE)) {
+             memset(&op, 0, sizeof(op));
+             op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT, TEEC_VALUE_OUTPUT,
+                                              TEEC_NONE, TEEC_NONE);
+             op.params[0].memref.parent = chunk;
+             op.params[0].memref.offset = 0;
+             op.params[0].memref.size   = fill;
+             res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_MERKLE_BLOCKS, &op, &origin);
+             if (res == TEEC_ERROR_SIGNATURE_INVALID)
+                 errx(1, "Block %u failed verification%s", op.params[1].value.b,
+                      only ? "" : ", OCRAM cleared");
+             if (res != TEEC_SUCCESS)
+                 errx(1, "MERKLE_BLOCKS failed: 0x%x origin 0x%x", res, origin);
+             fill = 0;
+         }
+         if (eof)
+             break;
+         uint8_t *p = (uint8_t *)chunk->buffer + fill;
+         memcpy(p, &rec, sizeof(rec));
+         if (fread(p + sizeof(rec), 1, rec_sz - sizeof(rec), f) != rec_sz - sizeof(rec))
+             errx(1, "Truncated record in %s", fname);
+         fill += rec_sz;
+     }
+     shm_pool_free(pool, chunk);
+     fclose(f);
+ 
+     memset(&op, 0, sizeof(op));
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_OUTPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+     res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_MERKLE_END, &op, &origin);
+     if (res != TEEC_SUCCESS)
+         errx(1, "MERKLE_END failed: 0x%x origin 0x%x", res, origin);
+     if (only)
+         printf("Rewrote %u verified blocks\n", op.params[0].value.b);
+     return op.params[0].value.a;
+ }
+ 
+ /*
+  * Print the counters of this session's TA instance: a table, or with json
+  * one line {"ta":{"pta_calls",...,"commands":[...]}}. reset clears them
+  * afterwards.
+  */
+ static void ta_stats(TEEC_Session *sess, int json, int reset) {
+     const size_t n = sizeof(ta_cmd_names) / sizeof(*ta_cmd_names);
+     struct ta_ocram_stats st;
+     TEEC_Operation op = {0};
+     TEEC_Result res;
+     uint32_t origin;
+     int first = 1;
+ 
+     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE,
+                                      TEEC_NONE, TEEC_NONE);
+     op.params[0].tmpref.buffer = &st;
+     op.params[0].tmpref.size   = sizeof(st);
+     res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_GET_STATS, &op, &origin);
+     if (res != TEEC_SUCCESS)
+         errx(1, "GET_STATS failed: 0x%x origin 0x%x", res, origin);
+ 
+     if (json)
+         printf("{\"ta\":{\"pta_calls\":%u,\"pta_total_ms\":%llu,"
+                "\"pta_max_ms\":%u,\"heap_now\":%u,\"heap_peak\":%u,"
+                "\"commands\":[", st.pta_calls,
+                (unsigned long long)st.pta_total_ms, st.pta_max_ms,
+                st.heap_now, st.heap_peak);
+     else
+         printf("%-18s %8s %10s %8s %14s\n",
+                "command", "count", "total_ms", "max_ms", "bytes");
+     for (uint32_t i = 0; i < TA_OCRAM_STATS_CMDS; i++) {
+         const struct ta_ocram_cmd_stats *cs = &st.cmd[i];
+         char other[16];
+         const char *name = i < n ? ta_cmd_names[i] : NULL;
+ 
+         if (!cs->count)
+             continue;
+         if (!name) {
+             snprintf(other, sizeof(other), "CMD_%u", i);
+             name = other;
+         }
+         if (json)
+             printf("%s{\"name\":\"%s\",\"count\":%u,\"total_ms\":%llu,"
+                    "\"max_ms\":%u,\"bytes\":%llu}", first ? "" : ",",
+                    name, cs->count, (unsigned long long)cs->total_ms,
+                    cs->max_ms, (unsigned long long)cs->bytes);
+         else
+             printf("%-18s %8u %10llu %8u %14llu\n", name, cs->count,
+                    (unsigned long long)cs->total_ms, cs->max_ms,
+                    (unsigned long long)cs->bytes);
+         first = 0;
+     }
+     if (json)
+         printf("]}}\n");
+     else
+         printf("PTA: %u calls, %llu ms total, %u ms max\n"
+                "Heap: %u bytes in use, %u bytes peak\n", st.pta_calls,
+                (unsigned long long)st.pta_total_ms, st.pta_max_ms,
+                st.heap_now, st.heap_peak);
+     fflush(stdout);
+ 
+     if (reset) {
+         memset(&op, 0, sizeof(op));
+         op.paramTypes = TEEC_PARAM_TYPES(TEEC_NONE, TEEC_NONE,
+                                          TEEC_NONE, TEEC_NONE);
+         res = ta_invoke(sess, TA_OCRAM_LOAD_CMD_RESET_STATS, &op, &origin);
+         if (res != TEEC_SUCCESS)
+             errx(1, "RESET_STATS failed: 0x%x origin 0x%x", res, origin);
+     }
+ }
+ 
+ /* One command as given on the command line, also run by the daemon */
+ static int run_command(TEEC_Session *sess, struct shm_pool *pool,
+                        int argc, char *argv[]) {
+     TEEC_Result res; uint32_t eo;
  
      if (strcmp(argv[1], "store") == 0) {
-         size_t sz; void *buf = read_file(FILENAME, &sz);
+         size_t sz;
+         TEEC_SharedMemory *shm = read_file_shm(pool, argc > 2 ? argv[2] : FILENAME, 0, &sz);
          TEEC_Operation op = {0};
-         op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
-         op.params[0].tmpref.buffer = buf; op.params[0].tmpref.size = sz;
-         if (TEEC_InvokeCommand(&sess, TA_OCRAM_LOAD_CMD_STORE, &op, &eo) != TEEC_SUCCESS)
+         op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+         op.params[0].memref.parent = shm;
+         op.params[0].memref.offset = 0;
+         op.params[0].memref.size   = sz;
+         if (ta_invoke(sess, TA_OCRAM_LOAD_CMD_STORE, &op, &eo) != TEEC_SUCCESS)
              errx(1, "STORE failed");
          printf("Stored %zu bytes.\n", sz);
-         free(buf);
+         shm_pool_free(pool, shm);
  
      } else if (strcmp(argv[1], "load") == 0) {
-         TEEC_Operation op = {0};
-         op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
-         if (TEEC_InvokeCommand(&sess, TA_OCRAM_LOAD_CMD_LOAD, &op, &eo) != TEEC_SUCCESS)
-             errx(1, "LOAD failed");
-         printf("Loaded into OCRAM.\n");
+         /* Decrypt + verify the model previously saved with 'store' */
+         char key[AES_TEST_KEY_SIZE], iv[AES_BLOCK_SIZE];
+         memset(key, 0xa5, sizeof(key));
+         memset(iv,  0x00, sizeof(iv));
+         aes_start(sess, DECODE, key, sizeof(key), iv, NULL, 0);
+ 
+         size_t sig_sz = 2048 / 8;
+         uint8_t digest[DIGEST_SIZE];
+         uint8_t sig[TA_OCRAM_LOAD_TRAILER_MAX];
+         /* The TA checks the signature before the load completes */
+         size_t data_sz = storage_load(sess, sig_sz,
+                                       TA_OCRAM_LOAD_FLAG_VERIFY,
+                                       digest, sig);
+         printf("Loaded %zu bytes from secure storage into OCRAM.\n", data_sz);
  
      } else if (strcmp(argv[1], "read") == 0) {
          uint8_t buf[READ_SIZE];
          TEEC_Operation op = {0};
          op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
          op.params[0].tmpref.buffer = buf; op.params[0].tmpref.size = READ_SIZE;
-         if (TEEC_InvokeCommand(&sess, TA_OCRAM_LOAD_CMD_READ, &op, &eo) != TEEC_SUCCESS)
+         if (ta_invoke(sess, TA_OCRAM_LOAD_CMD_READ, &op, &eo) != TEEC_SUCCESS)
              errx(1, "READ failed");
          for (uint32_t i=0; i<op.params[0].tmpref.size; i++) {
              if (i%16==0) printf("\n%04x: ", i);
@@ -236,28 +1671,33 @@
          printf("\n");
  
      } else if (strcmp(argv[1], "encrypt")==0 || strcmp(argv[1], "decrypt")==0) {
-         if (argc!=4) errx(1, "Usage: %s encrypt|decrypt <infile> <outfile>", argv[0]);
-         process_aes_file(argv[2], argv[3], strcmp(argv[1],"encrypt")==0, &ctx, &sess);
+         if (argc < 4 || argc > 6)
+             errx(1, "Usage: %s encrypt|decrypt <infile> <outfile> [offset [len]]", argv[0]);
+         /* 可选 offset/len: 只处理文件的一段 (CTR 随机访问) */
+         process_aes_file(argv[2], argv[3], strcmp(argv[1],"encrypt")==0,
+                          argc > 4 ? (off_t)strtoull(argv[4], NULL, 0) : 0,
+                          argc > 5 ? strtoul(argv[5], NULL, 0) : 0,
+                          pool, sess);
  
      } else if (strcmp(argv[1], "sign")==0 || strcmp(argv[1], "verify")==0) {
          size_t key_size=2048;
          TEEC_Operation op={0};
          op.paramTypes=TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,TEEC_NONE,TEEC_NONE,TEEC_NONE);
          op.params[0].value.a=(uint32_t)key_size;
-         if (TEEC_InvokeCommand(&sess, TA_ACIPHER_CMD_GEN_KEY, &op, &eo)!=TEEC_SUCCESS)
+         if (ta_invoke(sess, TA_ACIPHER_CMD_GEN_KEY, &op, &eo)!=TEEC_SUCCESS)
              errx(1, "GEN_KEY failed");
          size_t in_sz; void *inbuf=read_file(INPUT_FILE,&in_sz);
          uint8_t digest[DIGEST_SIZE];
          op.paramTypes=TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,TEEC_MEMREF_TEMP_OUTPUT,TEEC_NONE,TEEC_NONE);
          op.params[0].tmpref.buffer=inbuf; op.params[0].tmpref.size=in_sz;
          op.params[1].tmpref.buffer=digest; op.params[1].tmpref.size=DIGEST_SIZE;
-         if (TEEC_InvokeCommand(&sess, TA_ACIPHER_CMD_DIGEST, &op, &eo)!=TEEC_SUCCESS)
+         if (ta_invoke(sess, TA_ACIPHER_CMD_DIGEST, &op, &eo)!=TEEC_SUCCESS)
              errx(1,"DIGEST failed");
          if (strcmp(argv[1],"sign")==0) {
              size_t sig_sz=key_size/8; void *sig=malloc(sig_sz);
              op.params[0].tmpref.buffer=digest; op.params[0].tmpref.size=DIGEST_SIZE;
              op.params[1].tmpref.buffer=sig; op.params[1].tmpref.size=sig_sz;
-             if (TEEC_InvokeCommand(&sess, TA_ACIPHER_CMD_SIGN, &op, &eo)!=TEEC_SUCCESS)
+             if (ta_invoke(sess, TA_ACIPHER_CMD_SIGN, &op, &eo)!=TEEC_SUCCESS)
                  errx(1,"SIGN failed");
              write_file(SIGNATURE_FILE,sig,op.params[1].tmpref.size);
              printf("Signature saved to %s (%u bytes)\n",SIGNATURE_FILE,(unsigned)op.params[1].tmpref.size);
@@ -267,7 +1707,7 @@
              op.paramTypes=TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,TEEC_MEMREF_TEMP_INPUT,TEEC_VALUE_OUTPUT,TEEC_NONE);
              op.params[0].tmpref.buffer=digest; op.params[0].tmpref.size=DIGEST_SIZE;
              op.params[1].tmpref.buffer=sig; op.params[1].tmpref.size=sig_sz;
-             if (TEEC_InvokeCommand(&sess, TA_ACIPHER_CMD_VERIFY, &op, &eo)!=TEEC_SUCCESS)
+             if (ta_invoke(sess, TA_ACIPHER_CMD_VERIFY, &op, &eo)!=TEEC_SUCCESS)
                  errx(1,"VERIFY failed");
              printf("Signature is %s\n",op.params[2].value.a?"valid":"invalid");
              free(sig);
@@ -275,86 +1715,229 @@
          free(inbuf);
  
      } else if (strcmp(argv[1], "make")==0) {
-         make_signed_encrypted(INPUT_FILE, OUTPUT_MAKE_FILE, &sess);
+         if (argc > 2 && strcmp(argv[2], "--aead") == 0) {
+             char key[AES_TEST_KEY_SIZE];
+             memset(key, 0xa5, sizeof(key));
+             make_aead(INPUT_FILE, AEAD_FILE,
+                       argc > 3 ? strtoul(argv[3], NULL, 0) : AEAD_CHUNK_SIZE,
+                       key, sizeof(key), pool, sess);
+         } else if (argc > 2 && strcmp(argv[2], "--merkle") == 0) {
+             char key[AES_TEST_KEY_SIZE], iv[AES_BLOCK_SIZE];
+             memset(key, 0xa5, sizeof(key));
+             memset(iv,  0x00, sizeof(iv));
+             make_merkle(INPUT_FILE, MERKLE_FILE,
+                         argc > 3 ? strtoul(argv[3], NULL, 0) : MERKLE_BLOCK_SIZE,
+                         key, sizeof(key), iv, pool, sess);
+         } else {
+             int lz = argc > 2 && strcmp(argv[2], "--lz") == 0;
+             make_signed_encrypted(INPUT_FILE, OUTPUT_MAKE_FILE, lz, pool, sess);
+         }
+ 
+     } else if (strcmp(argv[1], "resident")==0) {
+         show_resident(sess);
+ 
+     } else if (strcmp(argv[1], "slot")==0) {
+         const char *sub = argc > 2 ? argv[2] : "list";
+         if (strcmp(sub, "load") == 0 || strcmp(sub, "run") == 0) {
+             /* 校验后加载到 OCRAM 槽位; run 随后重启 M 核 */
+             const char *fname = argc > 3 ? argv[3] : ENCRYPTED_INPUT_FILE;
+             char key[AES_TEST_KEY_SIZE], iv[AES_BLOCK_SIZE];
+             uint8_t expect[DIGEST_SIZE];
+             char digest_name[256];
+             uint32_t off, sz;
+             int resident;
+             memset(key, 0xa5, sizeof(key));
+             memset(iv,  0x00, sizeof(iv));
+             snprintf(digest_name, sizeof(digest_name), "%s.sha256", fname);
+             uint32_t id = slot_load_file(sess, pool, fname, key, sizeof(key), iv,
+                                          read_digest_file(digest_name, expect) ? expect : NULL,
+                                          &off, &sz, &resident);
+             printf("%s: slot %u at OCRAM offset 0x%x, %u bytes%s\n", fname, id,
+                    off, sz, resident ? " (already resident)" : "");
+             if (strcmp(sub, "run") == 0) {
+                 /* remoteproc 不设置 M 核启动地址, 非 0 偏移的槽位需调用方先设置 */
+                 if (off)
+                     warnx("the M-core boot address is not changed; set it to "
+                           "OCRAM offset 0x%x before running slot %u", off, id);
+                 m_core_restart();
+                 printf("remoteproc0 restarted\n");
+             }
+         } else if (strcmp(sub, "list") == 0) {
+             slot_list(sess);
+         } else if (argc > 3 && strcmp(sub, "pin") == 0) {
+             slot_cmd(sess, TA_OCRAM_LOAD_CMD_SLOT_PIN, strtoul(argv[3], NULL, 0), 1);
+         } else if (argc > 3 && strcmp(sub, "unpin") == 0) {
+             slot_cmd(sess, TA_OCRAM_LOAD_CMD_SLOT_PIN, strtoul(argv[3], NULL, 0), 0);
+         } else if (argc > 3 && strcmp(sub, "evict") == 0) {
+             slot_cmd(sess, TA_OCRAM_LOAD_CMD_SLOT_EVICT, strtoul(argv[3], NULL, 0), 0);
+         } else {
+             errx(1, "Usage: %s slot <load [file]|run [file]|list|pin <id>|unpin <id>|evict <id>>", argv[0]);
+         }
+ 
+     } else if (strcmp(argv[1], "delta")==0) {
+         /* 比较明文; 新版本用随机 IV 加密, IV 写入 delta 头 */
+         char key[AES_TEST_KEY_SIZE];
+         if (argc != 5) errx(1, "Usage: %s delta <old.bin> <new.bin> <out.delta>", argv[0]);
+         memset(key, 0xa5, sizeof(key));
+         make_delta(sess, pool, argv[2], argv[3], argv[4], key, sizeof(key), 2048 / 8);
+ 
+     } else if (strcmp(argv[1], "update")==0) {
+         /* 只解密并写入变化的块, 期间停止 M 核 */
+         char key[AES_TEST_KEY_SIZE];
+         if (argc != 3) errx(1, "Usage: %s update <file.delta>", argv[0]);
+         memset(key, 0xa5, sizeof(key));
+         m_core_stop();
+         apply_delta(sess, pool, argv[2], key, sizeof(key));
+         m_core_restart();
+         printf("remoteproc0 restarted\n");
+ 
+     } else if (strcmp(argv[1], "readback")==0) {
+         /* 默认读回整个常驻镜像 */
+         uint8_t digest[DIGEST_SIZE];
+         uint32_t off = argc > 3 ? strtoul(argv[3], NULL, 0) : 0;
+         uint32_t len;
+         if (argc < 3) errx(1, "Usage: %s readback <out> [offset] [len]", argv[0]);
+         if (argc > 4)
+             len = strtoul(argv[4], NULL, 0);
+         else if (!resident_info(sess, digest, &len, NULL))
+             errx(1, "No resident image, give an explicit length");
+         readback_file(sess, pool, argv[2], off, len);
+ 
+     } else if (strcmp(argv[1], "check")==0) {
+         /* 在 TA 内计算 OCRAM 摘要, 与常驻记录比较 */
+         uint8_t expect[DIGEST_SIZE], digest[DIGEST_SIZE];
+         uint32_t len;
+         if (argc > 3) {
+             uint32_t off = strtoul(argv[2], NULL, 0);
+             len = strtoul(argv[3], NULL, 0);
+             ocram_digest(sess, off, len, digest);
+             printf("OCRAM 0x%x+%u sha256 ", off, len);
+             print_digest(digest);
+             printf("\n");
+         } else {
+             if (!resident_info(sess, expect, &len, NULL))
+                 errx(1, "No resident image to check against");
+             ocram_digest(sess, 0, len, digest);
+             if (memcmp(digest, expect, DIGEST_SIZE))
+                 errx(1, "OCRAM does not match the resident image");
+             printf("OCRAM matches the resident image (%u bytes)\n", len);
+         }
+ 
+     } else if (strcmp(argv[1], "reload")==0) {
+         /* 只重写并校验指定的块, 要求该 Merkle 镜像已常驻 */
+         char key[AES_TEST_KEY_SIZE], iv[AES_BLOCK_SIZE];
+         uint32_t blocks[64];
+         size_t n = 0;
+         int resident;
+         if (argc < 3 || argc - 2 > 64)
+             errx(1, "Usage: %s reload <block>... (at most 64)", argv[0]);
+         for (int i = 2; i < argc; i++)
+             blocks[n++] = strtoul(argv[i], NULL, 0);
+         memset(key, 0xa5, sizeof(key));
+         memset(iv,  0x00, sizeof(iv));
+         merkle_load_file(sess, pool, MERKLE_FILE, key, sizeof(key), iv, 0,
+                          blocks, n, &resident);
+ 
+     } else if (strcmp(argv[1], "bench")==0) {
+         bench_shm(sess, pool, argc > 2 ? strtoul(argv[2], NULL, 0) : 16);
+ 
+     } else if (strcmp(argv[1], "batch")==0) {
+         /* 流水线: M 核运行当前任务时, 下一个镜像已在暂存区解密验签 */
+         char key[AES_TEST_KEY_SIZE], iv[AES_BLOCK_SIZE];
+         int wait_ms = BATCH_JOB_WAIT_MS, first = 2;
+         if (argc > 3 && strcmp(argv[2], "--wait") == 0) {
+             wait_ms = atoi(argv[3]);
+             first = 4;
+         }
+         if (argc <= first)
+             errx(1, "Usage: %s batch [--wait <ms>] <file>...", argv[0]);
+         memset(key, 0xa5, sizeof(key));
+         memset(iv,  0x00, sizeof(iv));
+         run_batch(sess, pool, argv + first, argc - first, wait_ms,
+                   key, sizeof(key), iv);
+ 
+     } else if (strcmp(argv[1], "lzbench")==0) {
+         lz_bench(sess, pool, argc > 2 ? argv[2] : INPUT_FILE);
+ 
+     } else if (strcmp(argv[1], "tastats")==0) {
+         /* TA 侧计数: 每个会话一个 TA 实例, 经 daemon 查询可看到累计值 */
+         ta_stats(sess, 0, argc > 2 && strcmp(argv[2], "reset") == 0);
  
      } else if (strcmp(argv[1], "inference")==0) 
      {
-        /* 1) AES 解密 + 拆分数据与签名 */
-        prepare_aes(&sess, DECODE);
+        /*
+         * 1) 解密 + 摘要 + 验签 + 加载:
+         *    默认一次调用完成 (LOAD_VERIFIED), 明文不离开 TA;
+         *    --stored 从安全存储加载, --chunked 分块流式加载,
+         *    --aead 加载 make --aead 生成的分块 GCM 镜像 (逐块认证),
+         *    --merkle 加载 make --merkle 生成的 Merkle 镜像 (逐块校验).
+         *    有 make 生成的摘要文件时, 同一模型已在 OCRAM 中则跳过加载.
+         *    --lz 表示镜像由 make --lz 压缩, 在 TA 内解压后写入 OCRAM.
+         *    --wait <ms> 读回前等待 M 核任务结束的时间 (默认 10000, 超时后仍读回;
+         *    固件持续运行、不会自行停止时用 --wait 0 跳过等待).
+         */
         char key[AES_TEST_KEY_SIZE];
         char iv [AES_BLOCK_SIZE];
         memset(key, 0xa5, sizeof(key));
         memset(iv,  0x00, sizeof(iv));
-        set_key(&sess, key, sizeof(key));
-        set_iv(&sess, iv, sizeof(iv));
-
-        size_t enc_sz;
-        uint8_t *enc_buf = read_file(ENCRYPTED_INPUT_FILE, &enc_sz);
-        uint8_t *plain_buf = malloc(enc_sz);
-        if (!plain_buf) errx(1, "malloc failed");
 
-        cipher_buffer(&sess, enc_buf, plain_buf, enc_sz);
-        free(enc_buf);
-
-        size_t key_size = 2048;
-        size_t sig_sz   = key_size / 8;
-        if (enc_sz < sig_sz) errx(1, "File too small");
-
-        size_t data_sz = enc_sz - sig_sz;
-        uint8_t *sig   = plain_buf + data_sz;
-
-        /* 2) 摘要 + 验签 */
-        TEEC_Operation op = {0};
-        uint32_t eo;
-        uint8_t digest[DIGEST_SIZE];
-
-        op.paramTypes = TEEC_PARAM_TYPES(
-            TEEC_MEMREF_TEMP_INPUT, TEEC_MEMREF_TEMP_OUTPUT,
-            TEEC_NONE, TEEC_NONE);
-        op.params[0].tmpref.buffer = plain_buf;
-        op.params[0].tmpref.size   = data_sz;
-        op.params[1].tmpref.buffer = digest;
-        op.params[1].tmpref.size   = DIGEST_SIZE;
-        if (TEEC_InvokeCommand(&sess, TA_ACIPHER_CMD_DIGEST, &op, &eo) != TEEC_SUCCESS)
-            errx(1, "DIGEST failed");
-
-        op.paramTypes = TEEC_PARAM_TYPES(
-            TEEC_MEMREF_TEMP_INPUT, TEEC_MEMREF_TEMP_INPUT,
-            TEEC_VALUE_OUTPUT, TEEC_NONE);
-        op.params[0].tmpref.buffer = digest;
-        op.params[0].tmpref.size   = DIGEST_SIZE;
-        op.params[1].tmpref.buffer = sig;
-        op.params[1].tmpref.size   = sig_sz;
-        if (TEEC_InvokeCommand(&sess, TA_ACIPHER_CMD_VERIFY, &op, &eo) != TEEC_SUCCESS)
-            errx(1, "VERIFY failed");
-        if (!op.params[2].value.a)
-            errx(1, "Invalid signature");
+        const char *mode = "";
+        int wait_ms = INFERENCE_WAIT_MS;
+        uint32_t flags = 0;
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--lz") == 0)
+                flags |= TA_OCRAM_LOAD_FLAG_COMPRESSED;
+            else if (strcmp(argv[i], "--wait") == 0 && i + 1 < argc)
+                wait_ms = atoi(argv[++i]);
+            else
+                mode = argv[i];
+        }
+        size_t data_sz;
+        int resident = 0;
+        if (strcmp(mode, "--stored") == 0 || strcmp(mode, "--chunked") == 0) {
+            size_t sig_sz = 2048 / 8;
+            uint8_t digest[DIGEST_SIZE];
+            uint8_t sig[TA_OCRAM_LOAD_TRAILER_MAX];
 
-        /* 3) Load plaintext 到 OCRAM */
-        TEEC_Operation load_op = {0};
-        load_op.paramTypes = TEEC_PARAM_TYPES(
-            TEEC_MEMREF_TEMP_INPUT, TEEC_NONE,
-            TEEC_NONE, TEEC_NONE);
-        load_op.params[0].tmpref.buffer = plain_buf;
-        load_op.params[0].tmpref.size   = data_sz;
-        if (TEEC_InvokeCommand(&sess, TA_OCRAM_LOAD_CMD_LOAD, &load_op, &eo) != TEEC_SUCCESS)
-            errx(1, "OCRAM LOAD failed");
+            /* 验签在 TA 内 LOAD_END 时完成: 签名无效时清除 OCRAM, 不启动 M 核 */
+            aes_start(sess, DECODE, key, sizeof(key), iv, NULL, 0);
+            if (strcmp(mode, "--stored") == 0)
+                data_sz = storage_load(sess, sig_sz, flags | TA_OCRAM_LOAD_FLAG_VERIFY,
+                                       digest, sig);
+            else
+                data_sz = stream_load_file(sess, pool, ENCRYPTED_INPUT_FILE, sig_sz,
+                                           flags | TA_OCRAM_LOAD_FLAG_VERIFY,
+                                           digest, sig);
+        } else if (strcmp(mode, "--aead") == 0) {
+            data_sz = aead_load_file(sess, pool, AEAD_FILE, key, sizeof(key),
+                                     flags, &resident);
+        } else if (strcmp(mode, "--merkle") == 0) {
+            data_sz = merkle_load_file(sess, pool, MERKLE_FILE, key, sizeof(key),
+                                       iv, flags, NULL, 0, &resident);
+        } else {
+            uint8_t expect[DIGEST_SIZE];
+            int have = read_digest_file(DIGEST_FILE, expect);
+            data_sz = verified_load_file(sess, pool, ENCRYPTED_INPUT_FILE,
+                                         key, sizeof(key), iv, flags,
+                                         have ? expect : NULL, &resident);
+        }
 
-        printf("Loaded %zu bytes of verified data into OCRAM\n", data_sz);
+        if (resident)
+            printf("Verified data (%zu bytes) already resident in OCRAM, load skipped\n", data_sz);
+        else
+            printf("Loaded %zu bytes of verified data into OCRAM\n", data_sz);
 
-        /* 4) 通知 remoteproc 启动 */
-        {
-            const char *rp_path = "/sys/class/remoteproc/remoteproc0/state";
-            int fd = open(rp_path, O_WRONLY);
-            if (fd < 0)
-                errx(1, "open %s failed", rp_path);
-            if (write(fd, "start", 5) != 5)
-                errx(1, "write to %s failed", rp_path);
-            close(fd);
-            printf("remoteproc0 state set to 'start'\n");
+        /* 4) 通知 remoteproc 启动 (模型未变且 M 核已在运行时不再启动) */
+        if (resident && (RPROC_MASK(rproc_state(m_core())) & RPROC_ACTIVE))
+            printf("remoteproc0 already running\n");
+        else {
+            m_core_restart();
+            printf("remoteproc0 running\n");
         }
 
-        /* 5) 通过 PTA 再次读回 OCRAM 内容并打印前 READ_SIZE 字节 */
+        /* 5) 等待 M 核任务结束后, 通过 PTA 读回 OCRAM 内容 */
+        if (wait_ms && !m_core_wait_done(wait_ms))
+            warnx("remoteproc0 still running after %d ms, reading OCRAM anyway", wait_ms);
         {
             uint8_t buf[READ_SIZE] = {0};
             TEEC_Operation read_op = {0};
@@ -363,7 +1946,7 @@
                 TEEC_NONE, TEEC_NONE);
             read_op.params[0].tmpref.buffer = buf;
             read_op.params[0].tmpref.size   = READ_SIZE;
-            if (TEEC_InvokeCommand(&sess, TA_OCRAM_LOAD_CMD_READ, &read_op, &eo) != TEEC_SUCCESS)
+            if (ta_invoke(sess, TA_OCRAM_LOAD_CMD_READ, &read_op, &eo) != TEEC_SUCCESS)
                 errx(1, "OCRAM READ failed");
 
            //printf("First %d bytes read from OCRAM:", READ_SIZE);
@@ -375,14 +1958,108 @@
             */
         }
 
-        free(plain_buf);
-
     }
       else {
          errx(1,"Unknown command '%s'",argv[1]);
      }
+     return 0;
+ }
+ 
+ /*
+  * Commands that do not use OCRAM; the daemon runs the others one at a
+  * time. Options before the command are skipped like run_cli does.
+  */
+ static int leaves_ocram(int argc, char *argv[]) {
+     static const char *const cmds[] = {
+         "encrypt", "decrypt", "sign", "verify", "make", "delta",
+         "store", "bench", "tastats",
+     };
+     int i = 1;
+     while (i < argc && strncmp(argv[i], "--", 2) == 0)
+         i += strcmp(argv[i], "--repeat") == 0 ? 2 : 1;
+     if (i >= argc)
+         return 0;
+     for (size_t c = 0; c < sizeof(cmds) / sizeof(cmds[0]); c++)
+         if (strcmp(argv[i], cmds[c]) == 0)
+             return 1;
+     return 0;
+ }
+ 
+ /*
+  * Options before the command: --stats prints the time spent in each
+  * phase as one line of JSON once done, followed by the TA's own counters
+  * for this session, --repeat n runs the command n times. Also the
+  * daemon's request handler.
+  */
+ static int run_cli(TEEC_Session *sess, struct shm_pool *pool,
+                    int argc, char *argv[]) {
+     unsigned int runs = 1;
+     int i, ret = 0, with_stats = 0;
+ 
+     if (!aes_handles_sess)
+         atexit(aes_release_at_exit);
+     aes_handles_sess = sess;
+     for (i = 1; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+         if (strcmp(argv[i], "--stats") == 0)
+             with_stats = 1;
+         else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+             runs = strtoul(argv[++i], NULL, 0);
+         else
+             errx(1, "Unknown option '%s'", argv[i]);
+     }
+     if (i == argc)
+         errx(1, "No command given");
+     argv[i - 1] = argv[0];
+     argc -= i - 1;
+     argv += i - 1;
+     if (with_stats)
+         stats_enable();
+ 
+     for (unsigned int r = 0; r < runs && !ret; r++) {
+         struct timespec t0;
+         stats_start(&t0);
+         ret = run_command(sess, pool, argc, argv);
+         stats_stop(&t0, "total");
+     }
+     /* The daemon keeps the session, hand the contexts back to the TA */
+     aes_release_handles(sess);
+     stats_report(stdout, runs);
+     if (with_stats)
+         ta_stats(sess, 1, 0);
+     return ret;
+ }
+ 
+ int main(int argc, char *argv[]) {
+     if (argc < 2) {
+         fprintf(stderr, "Usage: %s [--stats] [--repeat n] <store [file]|load|read|encrypt|decrypt <in> <out> [offset [len]]|sign|verify|make [--lz|--aead [chunk]|--merkle [block]]|inference [--stored|--chunked|--aead|--merkle] [--lz] [--wait ms]|reload <block>...|batch [--wait ms] <file>...|resident|slot <load [file]|run [file]|list|pin|unpin|evict> [id]|delta <old> <new> <out>|update <delta>|readback <out> [offset] [len]|check [offset len]|bench [MiB]|lzbench [file]|tastats [reset]|daemon [sessions]|client <command> [args]> [args]\n", argv[0]);
+         return 1;
+     }
+     TEEC_Context ctx; TEEC_Session sess;
+     struct shm_pool pool;
+     const TEEC_UUID uuid = TA_OCRAM_LOAD_UUID;
+     uint32_t eo;
+ 
+     /* Forward the command to a running daemon, no TEE setup here */
+     if (strcmp(argv[1], "client") == 0) {
+         if (argc < 3)
+             errx(1, "Usage: %s client <command> [args]", argv[0]);
+         return daemon_client(DAEMON_SOCKET, argc - 2, argv + 2);
+     }
+ 
+     if (TEEC_InitializeContext(NULL, &ctx) != TEEC_SUCCESS)
+         errx(1, "TEEC_InitializeContext failed");
+     if (strcmp(argv[1], "daemon") == 0)
+         return daemon_serve(DAEMON_SOCKET,
+                             argc > 2 ? strtoul(argv[2], NULL, 0) : DAEMON_SESSIONS,
+                             &ctx, &uuid, run_cli, leaves_ocram);
+ 
+     shm_pool_init(&pool, &ctx);
+     if (TEEC_OpenSession(&ctx, &sess, &uuid, TEEC_LOGIN_PUBLIC, NULL, NULL, &eo) != TEEC_SUCCESS)
+         errx(1, "TEEC_OpenSession failed");
+     int ret = run_cli(&sess, &pool, argc, argv);
      TEEC_CloseSession(&sess);
+     shm_pool_destroy(&pool);
      TEEC_FinalizeContext(&ctx);
-     return 0;
+     return ret;
  }
  
\ No newline at end of file
@@ -0,0 +1,150 @@
+/*
+ * merkle.c
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "merkle.h"
+
+#define MERKLE_MAX_THREADS  16
+
+struct leaf_job {
+    const uint8_t *data;
+    size_t size;
+    uint32_t block_size;
+    uint8_t *leaves;
+    uint32_t first;         /* this thread hashes first, first + step, ... */
+    uint32_t step;
+    uint32_t count;
+};
+
+static void *hash_leaves(void *arg)
+{
+    struct leaf_job *j = arg;
+    const uint8_t tag = 0x00;
+
+    for (uint32_t i = j->first; i < j->count; i += j->step) {
+        size_t off = (size_t)i * j->block_size;
+        size_t n = j->size - off < j->block_size ? j->size - off : j->block_size;
+        struct sha256_ctx c;
+
+        sha256_init(&c);
+        sha256_update(&c, &tag, 1);
+        sha256_update(&c, j->data + off, n);
+        sha256_final(&c, j->leaves + (size_t)i * SHA256_SIZE);
+    }
+    return NULL;
+}
+
+static void hash_node(const uint8_t *l, const uint8_t *r, uint8_t *out)
+{
+    const uint8_t tag = 0x01;
+    struct sha256_ctx c;
+
+    sha256_init(&c);
+    sha256_update(&c, &tag, 1);
+    sha256_update(&c, l, SHA256_SIZE);
+    sha256_update(&c, r, SHA256_SIZE);
+    sha256_final(&c, out);
+}
+
+int merkle_build(struct merkle_tree *t, const uint8_t *data, size_t size,
+                 uint32_t block_size, unsigned nthreads)
+{
+    struct leaf_job job[MERKLE_MAX_THREADS];
+    pthread_t tid[MERKLE_MAX_THREADS];
+    uint32_t w;
+    unsigned n;
+
+    memset(t, 0, sizeof(*t));
+    if (!size || !block_size)
+        return -1;
+    t->count = (uint32_t)((size + block_size - 1) / block_size);
+
+    for (w = t->count, t->levels = 1; w > 1; w = (w + 1) / 2)
+        t->levels++;
+    t->level = calloc(t->levels, sizeof(*t->level));
+    t->width = calloc(t->levels, sizeof(*t->width));
+    if (!t->level || !t->width)
+        goto err;
+    w = t->count;
+    for (uint32_t l = 0; l < t->levels; l++, w = (w + 1) / 2) {
+        t->width[l] = w;
+        t->level[l] = malloc((size_t)w * SHA256_SIZE);
+        if (!t->level[l])
+            goto err;
+    }
+
+    /* Leaves are independent: spread them over the threads */
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > MERKLE_MAX_THREADS)
+        nthreads = MERKLE_MAX_THREADS;
+    if (nthreads > t->count)
+        nthreads = t->count;
+    for (n = 0; n < nthreads; n++)
+        job[n] = (struct leaf_job){ data, size, block_size, t->level[0],
+                                    n, nthreads, t->count };
+    for (n = 1; n < nthreads; n++)
+        if (pthread_create(&tid[n], NULL, hash_leaves, &job[n]))
+            break;
+    hash_leaves(&job[0]);
+    for (unsigned i = 1; i < n; i++)
+        pthread_join(tid[i], NULL);
+    /* Threads that failed to start: hash their share here */
+    for (; n < nthreads; n++)
+        hash_leaves(&job[n]);
+
+    for (uint32_t l = 1; l < t->levels; l++) {
+        const uint8_t *below = t->level[l - 1];
+
+        for (uint32_t i = 0; i < t->width[l]; i++) {
+            if (2 * i + 1 < t->width[l - 1])
+                hash_node(below + 2 * i * SHA256_SIZE,
+                          below + (2 * i + 1) * SHA256_SIZE,
+                          t->level[l] + i * SHA256_SIZE);
+            else
+                memcpy(t->level[l] + i * SHA256_SIZE,
+                       below + 2 * i * SHA256_SIZE, SHA256_SIZE);
+        }
+    }
+    return 0;
+err:
+    merkle_free(t);
+    return -1;
+}
+
+const uint8_t *merkle_root(const struct merkle_tree *t)
+{
+    return t->level[t->levels - 1];
+}
+
+uint32_t merkle_path(const struct merkle_tree *t, uint32_t index,
+                     uint8_t *path)
+{
+    uint32_t nodes = 0;
+
+    for (uint32_t l = 0; l + 1 < t->levels; l++, index /= 2) {
+        uint32_t sib = index ^ 1;
+
+        /* The unpaired last node has no sibling at this level */
+        if (sib >= t->width[l])
+            continue;
+        memcpy(path + nodes * SHA256_SIZE,
+               t->level[l] + (size_t)sib * SHA256_SIZE, SHA256_SIZE);
+        nodes++;
+    }
+    return nodes;
+}
+
+void merkle_free(struct merkle_tree *t)
+{
+    for (uint32_t l = 0; t->level && l < t->levels; l++)
+        free(t->level[l]);
+    free(t->level);
+    free(t->width);
+    memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,41 @@
+/*
+ * merkle.h
+ *
+ * Merkle tree over the fixed-size blocks of a model image, as checked by
+ * TA_OCRAM_LOAD_CMD_MERKLE_BLOCKS: leaf = SHA-256(0x00 || block), node =
+ * SHA-256(0x01 || left || right), an unpaired last node moves up a level
+ * unchanged.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sha256.h"
+
+struct merkle_tree {
+    uint32_t count;         /* leaves */
+    uint32_t levels;        /* level[0] leaves ... level[levels - 1] root */
+    uint8_t **level;
+    uint32_t *width;
+};
+
+/* Hash data in block_size blocks on up to nthreads threads; 0 on success */
+int merkle_build(struct merkle_tree *t, const uint8_t *data, size_t size,
+                 uint32_t block_size, unsigned nthreads);
+
+const uint8_t *merkle_root(const struct merkle_tree *t);
+
+/*
+ * Write the authentication path of leaf index, bottom-up, to path (room
+ * for levels - 1 digests). Returns the number of digests written.
+ */
+uint32_t merkle_path(const struct merkle_tree *t, uint32_t index,
+                     uint8_t *path);
+
+void merkle_free(struct merkle_tree *t);
+
+#endif /* MERKLE_H */
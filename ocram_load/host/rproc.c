@@ -0,0 +1,148 @@
+/*
+ * rproc.c
+ *
+ * remoteproc controller, see rproc.h.
+ *
+ * The remoteproc core does not sysfs_notify() its state attribute, so
+ * neither poll() on it nor inotify (which sysfs does not support) report
+ * transitions. The attribute is re-read instead, at an interval that
+ * starts short and backs off, so fast transitions are seen within
+ * RPROC_POLL_MIN_US while long jobs cost few reads.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rproc.h"
+
+#define RPROC_POLL_MIN_US       100
+#define RPROC_POLL_MAX_US       1000
+
+static const char *const state_names[] = {
+    [RPROC_UNKNOWN]   = "unknown",
+    [RPROC_OFFLINE]   = "offline",
+    [RPROC_SUSPENDED] = "suspended",
+    [RPROC_RUNNING]   = "running",
+    [RPROC_CRASHED]   = "crashed",
+    [RPROC_DELETED]   = "deleted",
+    [RPROC_ATTACHED]  = "attached",
+    [RPROC_DETACHED]  = "detached",
+};
+
+int rproc_open(struct rproc *rp, const char *sysfs, const char *name)
+{
+    int n = snprintf(rp->state_path, sizeof(rp->state_path),
+                     "%s/class/remoteproc/%s/state", sysfs, name);
+
+    if (n < 0 || (size_t)n >= sizeof(rp->state_path))
+        return -1;
+    return access(rp->state_path, R_OK | W_OK);
+}
+
+enum rproc_state rproc_state(const struct rproc *rp)
+{
+    char buf[16] = {0};
+    int fd = open(rp->state_path, O_RDONLY);
+    ssize_t n;
+
+    if (fd < 0)
+        return RPROC_UNKNOWN;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return RPROC_UNKNOWN;
+    buf[strcspn(buf, "\n")] = '\0';
+    for (unsigned int i = 1; i < sizeof(state_names) / sizeof(*state_names); i++)
+        if (strcmp(buf, state_names[i]) == 0)
+            return i;
+    return RPROC_UNKNOWN;
+}
+
+const char *rproc_state_name(enum rproc_state s)
+{
+    if ((unsigned int)s >= sizeof(state_names) / sizeof(*state_names))
+        s = RPROC_UNKNOWN;
+    return state_names[s];
+}
+
+static long elapsed_ms(const struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) * 1000 +
+           (t1.tv_nsec - t0->tv_nsec) / 1000000;
+}
+
+int rproc_wait(const struct rproc *rp, unsigned int mask, int timeout_ms)
+{
+    useconds_t delay = RPROC_POLL_MIN_US;
+    struct timespec t0;
+    enum rproc_state s;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (!(RPROC_MASK(s = rproc_state(rp)) & mask)) {
+        if (timeout_ms >= 0 && elapsed_ms(&t0) >= timeout_ms) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        usleep(delay);
+        if (delay < RPROC_POLL_MAX_US)
+            delay *= 2;
+    }
+    return s;
+}
+
+static int write_state(const struct rproc *rp, const char *cmd)
+{
+    size_t len = strlen(cmd);
+    /* As 'echo cmd > state' does; sysfs ignores the truncation */
+    int fd = open(rp->state_path, O_WRONLY | O_TRUNC);
+    int ret = 0;
+
+    if (fd < 0)
+        return -1;
+    if (write(fd, cmd, len) != (ssize_t)len)
+        ret = -1;
+    close(fd);
+    return ret;
+}
+
+int rproc_start(const struct rproc *rp)
+{
+    enum rproc_state s = rproc_state(rp);
+
+    /* The kernel refuses 'start' with EBUSY here */
+    if (RPROC_MASK(s) & RPROC_ACTIVE)
+        return 0;
+    if (s == RPROC_UNKNOWN || s == RPROC_DELETED) {
+        errno = ENODEV;
+        return -1;
+    }
+    if (write_state(rp, "start"))
+        return -1;
+    return rproc_wait(rp, RPROC_ACTIVE, RPROC_TRANSITION_MS) < 0 ? -1 : 0;
+}
+
+int rproc_stop(const struct rproc *rp)
+{
+    /* 'stop' is only valid for a core that runs */
+    if (!(RPROC_MASK(rproc_state(rp)) & RPROC_ACTIVE))
+        return 0;
+    if (write_state(rp, "stop"))
+        return -1;
+    return rproc_wait(rp, ~RPROC_ACTIVE & ~RPROC_MASK(RPROC_UNKNOWN),
+                      RPROC_TRANSITION_MS) < 0 ? -1 : 0;
+}
+
+int rproc_restart(const struct rproc *rp)
+{
+    if (rproc_stop(rp))
+        return -1;
+    return rproc_start(rp);
+}
@@ -0,0 +1,69 @@
+/*
+ * rproc.h
+ *
+ * Lifecycle control of the M-core through the remoteproc sysfs 'state'
+ * attribute: the state is read before every transition, so start and
+ * stop are only written when the kernel would accept them, and each
+ * transition is confirmed by polling the attribute.
+ *
+ * The sysfs root is a parameter so the controller can run against a
+ * fake directory tree.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef RPROC_H
+#define RPROC_H
+
+#include <limits.h>
+
+#define RPROC_SYSFS             "/sys"
+#define RPROC_NAME              "remoteproc0"
+/* How long start and stop may take to show in the state attribute */
+#define RPROC_TRANSITION_MS     5000
+
+/* Values of /sys/class/remoteproc/<name>/state */
+enum rproc_state {
+    RPROC_UNKNOWN,
+    RPROC_OFFLINE,
+    RPROC_SUSPENDED,
+    RPROC_RUNNING,
+    RPROC_CRASHED,
+    RPROC_DELETED,
+    RPROC_ATTACHED,
+    RPROC_DETACHED,
+};
+
+#define RPROC_MASK(s)           (1u << (s))
+/* The core executes firmware, whether booted or attached to */
+#define RPROC_ACTIVE            (RPROC_MASK(RPROC_RUNNING) | \
+                                 RPROC_MASK(RPROC_ATTACHED))
+
+struct rproc {
+    char state_path[PATH_MAX];
+};
+
+/* Bind to <sysfs>/class/remoteproc/<name>; -1 if it has no state file */
+int rproc_open(struct rproc *rp, const char *sysfs, const char *name);
+
+/* Current state, RPROC_UNKNOWN if it cannot be read */
+enum rproc_state rproc_state(const struct rproc *rp);
+
+const char *rproc_state_name(enum rproc_state s);
+
+/*
+ * Wait until the state is one of mask (RPROC_MASK() bits). timeout_ms < 0
+ * waits forever. Returns the state reached, -1 on timeout.
+ */
+int rproc_wait(const struct rproc *rp, unsigned int mask, int timeout_ms);
+
+/* Boot the core unless it already runs; 0 once it is running, else -1 */
+int rproc_start(const struct rproc *rp);
+
+/* Stop the core if it runs; 0 once it is offline, else -1 */
+int rproc_stop(const struct rproc *rp);
+
+/* Stop, then start the core on the image now in OCRAM */
+int rproc_restart(const struct rproc *rp);
+
+#endif /* RPROC_H */
@@ -0,0 +1,206 @@
+/*
+ * rproc_test.c
+ *
+ * Tests of the remoteproc controller (rproc.c) against a fake sysfs tree
+ * in a temporary directory. A thread stands in for the kernel: it turns
+ * the 'start' and 'stop' written to the state file into the state the
+ * remoteproc core would report, after a short delay.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "rproc.h"
+
+/* How long the fake kernel takes for a transition */
+#define FAKE_DELAY_US   20000
+
+static int failures;
+
+#define CHECK(cond) do {                                            \
+        if (!(cond)) {                                              \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                             \
+        }                                                           \
+    } while (0)
+
+struct fake_kernel {
+    const char *state_path;
+    volatile int stop;
+    volatile int enabled;       /* 0: commands are left in the file */
+    pthread_t thread;
+};
+
+static void put_state(const char *path, const char *s)
+{
+    FILE *f = fopen(path, "w");
+
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    fputs(s, f);
+    fclose(f);
+}
+
+static void get_state(const char *path, char *buf, size_t len)
+{
+    FILE *f = fopen(path, "r");
+    size_t n = 0;
+
+    if (f) {
+        n = fread(buf, 1, len - 1, f);
+        fclose(f);
+    }
+    buf[n] = '\0';
+}
+
+static void *fake_kernel_run(void *arg)
+{
+    struct fake_kernel *k = arg;
+    char buf[32];
+
+    while (!k->stop) {
+        usleep(1000);
+        if (!k->enabled)
+            continue;
+        get_state(k->state_path, buf, sizeof(buf));
+        if (strcmp(buf, "start") == 0) {
+            usleep(FAKE_DELAY_US);
+            put_state(k->state_path, "running\n");
+        } else if (strcmp(buf, "stop") == 0) {
+            usleep(FAKE_DELAY_US);
+            put_state(k->state_path, "offline\n");
+        }
+    }
+    return NULL;
+}
+
+/* Build <root>/class/remoteproc/<name>/state holding state */
+static void make_tree(const char *root, const char *name, const char *state,
+                      char *state_path, size_t len)
+{
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/class", root);
+    mkdir(path, 0700);
+    snprintf(path, sizeof(path), "%s/class/remoteproc", root);
+    mkdir(path, 0700);
+    snprintf(path, sizeof(path), "%s/class/remoteproc/%s", root, name);
+    mkdir(path, 0700);
+    snprintf(state_path, len, "%s/state", path);
+    put_state(state_path, state);
+}
+
+static void test_open(const char *root)
+{
+    struct rproc rp;
+
+    CHECK(rproc_open(&rp, root, "remoteproc0") == 0);
+    CHECK(rproc_open(&rp, root, "remoteproc9") == -1);
+}
+
+static void test_state(const char *path, const struct rproc *rp)
+{
+    put_state(path, "running\n");
+    CHECK(rproc_state(rp) == RPROC_RUNNING);
+    put_state(path, "attached");
+    CHECK(rproc_state(rp) == RPROC_ATTACHED);
+    put_state(path, "offline\n");
+    CHECK(rproc_state(rp) == RPROC_OFFLINE);
+    put_state(path, "bogus\n");
+    CHECK(rproc_state(rp) == RPROC_UNKNOWN);
+    put_state(path, "");
+    CHECK(rproc_state(rp) == RPROC_UNKNOWN);
+    CHECK(strcmp(rproc_state_name(RPROC_CRASHED), "crashed") == 0);
+    CHECK(strcmp(rproc_state_name((enum rproc_state)99), "unknown") == 0);
+}
+
+static void test_wait(const char *path, const struct rproc *rp)
+{
+    put_state(path, "running\n");
+    CHECK(rproc_wait(rp, RPROC_ACTIVE, 0) == RPROC_RUNNING);
+    errno = 0;
+    CHECK(rproc_wait(rp, RPROC_MASK(RPROC_OFFLINE), 30) == -1);
+    CHECK(errno == ETIMEDOUT);
+}
+
+static void test_lifecycle(const char *path, const struct rproc *rp,
+                           struct fake_kernel *k)
+{
+    char buf[32];
+
+    /* Start and stop are written once and confirmed */
+    put_state(path, "offline\n");
+    k->enabled = 1;
+    CHECK(rproc_start(rp) == 0);
+    CHECK(rproc_state(rp) == RPROC_RUNNING);
+    CHECK(rproc_stop(rp) == 0);
+    CHECK(rproc_state(rp) == RPROC_OFFLINE);
+    CHECK(rproc_restart(rp) == 0);
+    CHECK(rproc_state(rp) == RPROC_RUNNING);
+    CHECK(rproc_restart(rp) == 0);
+    CHECK(rproc_state(rp) == RPROC_RUNNING);
+
+    /* Nothing is written when the core already is where it should be */
+    k->enabled = 0;
+    put_state(path, "attached\n");
+    CHECK(rproc_start(rp) == 0);
+    get_state(path, buf, sizeof(buf));
+    CHECK(strcmp(buf, "attached\n") == 0);
+    put_state(path, "crashed\n");
+    CHECK(rproc_stop(rp) == 0);
+    get_state(path, buf, sizeof(buf));
+    CHECK(strcmp(buf, "crashed\n") == 0);
+
+    /* A deleted core is not started */
+    put_state(path, "deleted\n");
+    errno = 0;
+    CHECK(rproc_start(rp) == -1);
+    CHECK(errno == ENODEV);
+}
+
+int main(void)
+{
+    char root[] = "/tmp/rproc_test.XXXXXX";
+    char path[PATH_MAX];
+    struct fake_kernel k = { .state_path = path };
+    struct rproc rp;
+
+    if (!mkdtemp(root)) {
+        perror("mkdtemp");
+        return 2;
+    }
+    make_tree(root, "remoteproc0", "offline\n", path, sizeof(path));
+    if (rproc_open(&rp, root, "remoteproc0")) {
+        perror(path);
+        return 2;
+    }
+    pthread_create(&k.thread, NULL, fake_kernel_run, &k);
+
+    test_open(root);
+    test_state(path, &rp);
+    test_wait(path, &rp);
+    test_lifecycle(path, &rp, &k);
+
+    k.stop = 1;
+    pthread_join(k.thread, NULL);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/class/remoteproc/remoteproc0", root);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/class/remoteproc", root);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/class", root);
+    rmdir(path);
+    rmdir(root);
+
+    printf("rproc_test: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * sha256.h
+ *
+ * Plain C SHA-256 for the ocram_load client, so the packager can hash
+ * image blocks on several cores instead of one TA invoke per block.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_SIZE     32
+
+struct sha256_ctx {
+    uint32_t h[8];
+    uint64_t len;           /* bytes hashed so far */
+    uint8_t buf[64];
+    size_t fill;            /* bytes pending in buf */
+};
+
+void sha256_init(struct sha256_ctx *c);
+void sha256_update(struct sha256_ctx *c, const void *data, size_t len);
+void sha256_final(struct sha256_ctx *c, uint8_t out[SHA256_SIZE]);
+
+#endif /* SHA256_H */
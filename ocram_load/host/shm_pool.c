@@ -0,0 +1,104 @@
+/*
+ * shm_pool.c
+ *
+ * Shared memory pool for the ocram_load client, see shm_pool.h.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <err.h>
+#include <string.h>
+#include "shm_pool.h"
+
+void shm_pool_init(struct shm_pool *pool, TEEC_Context *ctx)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->ctx = ctx;
+}
+
+void shm_pool_destroy(struct shm_pool *pool)
+{
+    for (int i = 0; i < SHM_POOL_MAX; i++) {
+        if (pool->e[i].shm.buffer)
+            TEEC_ReleaseSharedMemory(&pool->e[i].shm);
+    }
+    memset(pool->e, 0, sizeof(pool->e));
+}
+
+static struct shm_pool_entry *pool_slot(struct shm_pool *pool)
+{
+    struct shm_pool_entry *spare = NULL;
+
+    /* Prefer a never used slot, else drop the smallest idle block */
+    for (int i = 0; i < SHM_POOL_MAX; i++) {
+        struct shm_pool_entry *e = &pool->e[i];
+        if (!e->shm.buffer)
+            return e;
+        if (!e->in_use && (!spare || e->shm.size < spare->shm.size))
+            spare = e;
+    }
+    if (!spare)
+        errx(1, "shared memory pool exhausted");
+    TEEC_ReleaseSharedMemory(&spare->shm);
+    memset(spare, 0, sizeof(*spare));
+    return spare;
+}
+
+TEEC_SharedMemory *shm_pool_alloc(struct shm_pool *pool, size_t size)
+{
+    struct shm_pool_entry *best = NULL;
+    TEEC_Result res;
+
+    /* Best fit among idle allocated blocks */
+    for (int i = 0; i < SHM_POOL_MAX; i++) {
+        struct shm_pool_entry *e = &pool->e[i];
+        if (!e->shm.buffer || e->in_use || e->registered || e->shm.size < size)
+            continue;
+        if (!best || e->shm.size < best->shm.size)
+            best = e;
+    }
+
+    if (!best) {
+        best = pool_slot(pool);
+        best->shm.size  = size;
+        best->shm.flags = TEEC_MEM_INPUT | TEEC_MEM_OUTPUT;
+        res = TEEC_AllocateSharedMemory(pool->ctx, &best->shm);
+        if (res != TEEC_SUCCESS)
+            errx(1, "TEEC_AllocateSharedMemory(%zu) failed: 0x%x", size, res);
+    }
+    best->in_use = 1;
+    return &best->shm;
+}
+
+TEEC_SharedMemory *shm_pool_register(struct shm_pool *pool,
+                                     void *buf, size_t size)
+{
+    struct shm_pool_entry *e = pool_slot(pool);
+    TEEC_Result res;
+
+    e->shm.buffer = buf;
+    e->shm.size   = size;
+    e->shm.flags  = TEEC_MEM_INPUT | TEEC_MEM_OUTPUT;
+    res = TEEC_RegisterSharedMemory(pool->ctx, &e->shm);
+    if (res != TEEC_SUCCESS)
+        errx(1, "TEEC_RegisterSharedMemory(%zu) failed: 0x%x", size, res);
+    e->in_use = 1;
+    e->registered = 1;
+    return &e->shm;
+}
+
+void shm_pool_free(struct shm_pool *pool, TEEC_SharedMemory *shm)
+{
+    for (int i = 0; i < SHM_POOL_MAX; i++) {
+        struct shm_pool_entry *e = &pool->e[i];
+        if (&e->shm != shm)
+            continue;
+        if (e->registered) {
+            TEEC_ReleaseSharedMemory(&e->shm);
+            memset(e, 0, sizeof(*e));
+        } else {
+            e->in_use = 0;
+        }
+        return;
+    }
+}
@@ -0,0 +1,44 @@
+/*
+ * shm_pool.h
+ *
+ * Small pool of TEEC shared memory blocks for the ocram_load client.
+ * Buffers are allocated once with TEEC_AllocateSharedMemory and reused,
+ * so invokes pass TEEC_MEMREF_PARTIAL_* instead of tmprefs that libteec
+ * would bounce through freshly allocated shared memory on every call.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef SHM_POOL_H
+#define SHM_POOL_H
+
+#include <stddef.h>
+#include <tee_client_api.h>
+
+#define SHM_POOL_MAX    8
+
+struct shm_pool_entry {
+    TEEC_SharedMemory shm;
+    int in_use;             /* handed out by shm_pool_alloc/_register */
+    int registered;         /* wraps caller memory, released on free */
+};
+
+struct shm_pool {
+    TEEC_Context *ctx;
+    struct shm_pool_entry e[SHM_POOL_MAX];
+};
+
+void shm_pool_init(struct shm_pool *pool, TEEC_Context *ctx);
+void shm_pool_destroy(struct shm_pool *pool);
+
+/* Get an idle block of at least size bytes, allocating one if needed */
+TEEC_SharedMemory *shm_pool_alloc(struct shm_pool *pool, size_t size);
+
+/* Register caller memory (e.g. an mmap()ed file) for zero-copy invokes */
+TEEC_SharedMemory *shm_pool_register(struct shm_pool *pool,
+                                     void *buf, size_t size);
+
+/* Return a block to the pool; registered blocks are unregistered */
+void shm_pool_free(struct shm_pool *pool, TEEC_SharedMemory *shm);
+
+#endif /* SHM_POOL_H */
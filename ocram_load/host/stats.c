@@ -0,0 +1,105 @@
+/*
+ * stats.c
+ *
+ * Latency samples and JSON report, see stats.h.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+
+struct phase {
+    const char *name;
+    double *us;                 /* samples, microseconds */
+    size_t count;
+    size_t cap;
+};
+
+static struct phase phases[STATS_MAX_PHASES];
+static unsigned int nphases;
+static int enabled;
+
+void stats_enable(void)
+{
+    enabled = 1;
+}
+
+void stats_start(struct timespec *t0)
+{
+    if (enabled)
+        clock_gettime(CLOCK_MONOTONIC, t0);
+}
+
+static struct phase *phase_get(const char *name)
+{
+    for (unsigned int i = 0; i < nphases; i++)
+        if (strcmp(phases[i].name, name) == 0)
+            return &phases[i];
+    if (nphases == STATS_MAX_PHASES)
+        return NULL;
+    phases[nphases].name = name;
+    return &phases[nphases++];
+}
+
+void stats_stop(const struct timespec *t0, const char *phase)
+{
+    struct timespec t1;
+    struct phase *p;
+
+    if (!enabled)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    p = phase_get(phase);
+    if (!p)
+        return;
+    if (p->count == p->cap) {
+        size_t cap = p->cap ? 2 * p->cap : 64;
+        double *us = realloc(p->us, cap * sizeof(*us));
+        if (!us)
+            errx(1, "malloc failed");
+        p->us = us;
+        p->cap = cap;
+    }
+    p->us[p->count++] = (t1.tv_sec - t0->tv_sec) * 1e6 +
+                        (t1.tv_nsec - t0->tv_nsec) / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of n sorted samples */
+static double percentile(const double *v, size_t n, unsigned int pct)
+{
+    size_t rank = (n * pct + 99) / 100;
+
+    return v[rank ? rank - 1 : 0];
+}
+
+void stats_report(FILE *f, unsigned int runs)
+{
+    if (!enabled)
+        return;
+    fprintf(f, "{\"runs\":%u,\"phases\":[", runs);
+    for (unsigned int i = 0; i < nphases; i++) {
+        struct phase *p = &phases[i];
+        double total = 0;
+
+        qsort(p->us, p->count, sizeof(*p->us), cmp_double);
+        for (size_t j = 0; j < p->count; j++)
+            total += p->us[j];
+        fprintf(f, "%s{\"name\":\"%s\",\"count\":%zu,\"min_us\":%.1f,"
+                "\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,"
+                "\"total_us\":%.1f}", i ? "," : "", p->name, p->count,
+                p->us[0], percentile(p->us, p->count, 50),
+                percentile(p->us, p->count, 99), p->us[p->count - 1], total);
+    }
+    fprintf(f, "]}\n");
+    fflush(f);
+}
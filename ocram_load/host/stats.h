@@ -0,0 +1,33 @@
+/*
+ * stats.h
+ *
+ * Per-phase latency samples for the ocram_load client ('--stats'). Each
+ * phase keeps every sample so the report can give exact percentiles
+ * over a '--repeat' loop. Recording is a no-op until stats_enable().
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <time.h>
+
+#define STATS_MAX_PHASES    64
+
+void stats_enable(void);
+
+/* Start timing a phase */
+void stats_start(struct timespec *t0);
+
+/* Record the time since stats_start() under phase (a static string) */
+void stats_stop(const struct timespec *t0, const char *phase);
+
+/*
+ * Write {"runs":n,"phases":[{"name","count","min_us","p50_us","p99_us",
+ * "max_us","total_us"}...]} on one line, phases in first-seen order.
+ */
+void stats_report(FILE *f, unsigned int runs);
+
+#endif /* STATS_H */
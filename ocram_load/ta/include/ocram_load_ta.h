@@ -14,20 +14,564 @@
 /* The function IDs implemented in this TA */
 #define TA_OCRAM_LOAD_CMD_INC_VALUE        0
 #define TA_OCRAM_LOAD_CMD_DEC_VALUE        1
-#define TA_OCRAM_LOAD_CMD_MAP_MEMORY       2
 #define TA_OCRAM_LOAD_CMD_LOAD             3
 #define TA_OCRAM_LOAD_CMD_STORE            4
 #define TA_OCRAM_LOAD_CMD_READ             5
 
+/*
+ * TA_OCRAM_LOAD_CMD_MAP_MEMORY - Map the OCRAM window into the TA
+ * param[0] (value) output a: window size in bytes, b: unused
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ *
+ * OP-TEE gives a user TA no way to map OCRAM, so this always returns
+ * TEE_ERROR_NOT_SUPPORTED; the ID is kept for existing clients. All
+ * OCRAM access goes through the load and read PTAs.
+ */
+#define TA_OCRAM_LOAD_CMD_MAP_MEMORY       2
+
+/*
+ * TA_OCRAM_LOAD_CMD_LOAD_BEGIN - Start a streamed load into OCRAM
+ * param[0] (value) a: plaintext size to load, b: TA_OCRAM_LOAD_FLAG_xxx
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ *
+ * The session AES operation (TA_AES_CMD_PREPARE/SET_KEY/SET_IV) must be
+ * set up beforehand; it is used to decrypt the streamed chunks.
+ *
+ * Chunks land in OCRAM at increasing offsets, which needs the offset
+ * command of the OCRAM load PTA. Without it this and the other chunked
+ * loads return TEE_ERROR_NOT_SUPPORTED before anything is written; only
+ * TA_OCRAM_LOAD_CMD_LOAD still works, in a single PTA call.
+ *
+ * What an unfinished TA_OCRAM_LOAD_FLAG_VERIFY, AEAD or full Merkle load
+ * of the session wrote is wiped first, as it is when the session closes.
+ */
+#define TA_OCRAM_LOAD_CMD_LOAD_BEGIN       14
+
+/* Decrypt straight into mapped OCRAM; unsupported, see MAP_MEMORY */
+#define TA_OCRAM_LOAD_FLAG_DIRECT          (1 << 0)
+/* LOAD_VERIFIED: do nothing if OCRAM already holds the expected image */
+#define TA_OCRAM_LOAD_FLAG_IF_CHANGED      (1 << 1)
+/* MERKLE_BEGIN: rewrite some blocks of the resident image, no full load */
+#define TA_OCRAM_LOAD_FLAG_PARTIAL         (1 << 2)
+/*
+ * The decrypted data is an LZ stream (struct ta_ocram_lz_hdr) followed by
+ * the trailer; the TA decompresses it on its way to OCRAM. The load size
+ * given to LOAD_BEGIN is then ignored, the stream header has it. Not for
+ * slot or delta loads.
+ */
+#define TA_OCRAM_LOAD_FLAG_COMPRESSED      (1 << 3)
+/*
+ * LOAD_BEGIN, LOAD_FROM_STORAGE: the trailer is the RSA signature of the
+ * data digest, as 'make' signs it. The load only completes once the TA
+ * has checked it, see TA_OCRAM_LOAD_CMD_LOAD_END.
+ */
+#define TA_OCRAM_LOAD_FLAG_VERIFY          (1 << 4)
+
+/*
+ * LZ stream: a header, then blocks of at most TA_OCRAM_LZ_BLOCK plaintext
+ * bytes, each a struct ta_ocram_lz_block and 'comp' bytes in the LZ4
+ * block format, or 'raw' stored bytes when comp is 0. Blocks do not
+ * reference each other, so each one is decoded on its own.
+ */
+#define TA_OCRAM_LZ_MAGIC                  0x5a4c434f  /* "OCLZ" */
+#define TA_OCRAM_LZ_BLOCK                  4096
+
+struct ta_ocram_lz_hdr {
+    uint32_t magic;
+    uint32_t raw_size;          /* bytes written to OCRAM */
+};
+
+struct ta_ocram_lz_block {
+    uint16_t raw;               /* plaintext bytes in the block */
+    uint16_t comp;              /* compressed bytes, 0 if stored */
+};
+
+/*
+ * TA_OCRAM_LOAD_CMD_LOAD_CHUNK - Decrypt a ciphertext chunk into OCRAM
+ * param[0] (memref) ciphertext chunk, any size
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ *
+ * Plaintext is written at the running OCRAM offset. Bytes decrypted past
+ * the size given to LOAD_BEGIN are kept as trailer (e.g. the signature),
+ * up to TA_OCRAM_LOAD_TRAILER_MAX bytes.
+ */
+#define TA_OCRAM_LOAD_CMD_LOAD_CHUNK       15
+
+/*
+ * TA_OCRAM_LOAD_CMD_LOAD_END - Finish a streamed load
+ * param[0] (memref) output: SHA-256 digest of the loaded plaintext
+ * param[1] (memref) output: trailer bytes decrypted past the load size
+ * param[2] (value) output a: bytes written to OCRAM, b: unused
+ * param[3] unused
+ *
+ * With TA_OCRAM_LOAD_FLAG_VERIFY a load that is short, or whose trailer
+ * does not sign the digest, is cleared from OCRAM; the latter returns
+ * TEE_ERROR_SIGNATURE_INVALID. A verified load becomes the resident
+ * image, as with LOAD_VERIFIED.
+ */
+#define TA_OCRAM_LOAD_CMD_LOAD_END         16
+
+#define TA_OCRAM_LOAD_TRAILER_MAX          512
+
+/*
+ * TA_OCRAM_LOAD_CMD_LOAD_FROM_STORAGE - Load the stored model into OCRAM
+ * param[0] (value) a: trailer size at the end of the object, b: flags
+ * param[1] (memref) output: SHA-256 digest of the loaded plaintext
+ * param[2] (memref) output: decrypted trailer
+ * param[3] (value) output a: bytes written to OCRAM, b: unused
+ *
+ * Reads the object written by TA_OCRAM_LOAD_CMD_STORE and decrypts it
+ * with the session AES operation, as LOAD_BEGIN/CHUNK/END would, flags
+ * (TA_OCRAM_LOAD_FLAG_VERIFY included) acting as they do there.
+ */
+#define TA_OCRAM_LOAD_CMD_LOAD_FROM_STORAGE 17
+
+/*
+ * TA_OCRAM_LOAD_CMD_LOAD_VERIFIED - Decrypt, hash, verify and load at once
+ * param[0] (memref) AES-CTR ciphertext of 'data || RSA signature'
+ * param[1] (memref) AES key followed by the 16-byte initial vector and,
+ *                   with TA_OCRAM_LOAD_FLAG_IF_CHANGED, the expected
+ *                   SHA-256 digest of the data
+ * param[2] (value) a: TA_OCRAM_LOAD_FLAG_xxx, b: unused
+ * param[3] (value) output a: bytes in OCRAM, b: TA_OCRAM_LOAD_RESIDENT
+ *                  when the image was already loaded and nothing was done
+ *
+ * The plaintext never leaves the TA. The signature size follows the
+ * persistent RSA key (TA_ACIPHER_CMD_GEN_KEY). Returns
+ * TEE_ERROR_SIGNATURE_INVALID, with the written OCRAM range cleared,
+ * when the signature does not match.
+ *
+ * A successful load is recorded as the resident image (see
+ * TA_OCRAM_LOAD_CMD_RESIDENT); once other writes change OCRAM, the record
+ * is dropped the next time it is checked. The expected digest only keeps
+ * that image when the signature at the end of param[0], decrypted alone,
+ * covers it.
+ */
+#define TA_OCRAM_LOAD_CMD_LOAD_VERIFIED    18
+
+#define TA_OCRAM_LOAD_RESIDENT             1
+
+/*
+ * TA_OCRAM_LOAD_CMD_RESIDENT - Describe the image currently in OCRAM
+ * param[0] (memref) output: SHA-256 digest of the resident image
+ * param[1] (value) output a: image size, b: load generation
+ * param[2] unused
+ * param[3] unused
+ *
+ * Returns TEE_ERROR_ITEM_NOT_FOUND when no verified image is known to be
+ * resident. The record is kept in secure storage so it outlives the TA
+ * instance; it is dropped when the whole image range no longer hashes to
+ * what it did after the load or the system was restarted since.
+ */
+#define TA_OCRAM_LOAD_CMD_RESIDENT         19
+
+/*
+ * OCRAM slots: OCRAM is shared by up to TA_OCRAM_LOAD_SLOTS verified
+ * images so switching between models does not need a decrypt and
+ * reload. Slots are placed first fit on TA_OCRAM_LOAD_SLOT_ALIGN
+ * boundaries; when nothing fits, the least recently used unpinned slot
+ * is evicted. Each image must be linked for the OCRAM offset of its
+ * slot. Loading a slot needs the TA built with CFG_OCRAM_SIZE and the
+ * offset commands of both OCRAM PTAs, else TEE_ERROR_NOT_SUPPORTED.
+ *
+ * Loading or selecting a slot does not change where the M-core starts:
+ * neither the TA nor remoteproc sets its boot address. To run a slot
+ * that is not at offset 0, the caller must point the core's boot
+ * address (a SoC specific register) at the slot before restarting it.
+ */
+#define TA_OCRAM_LOAD_SLOTS                8
+#define TA_OCRAM_LOAD_SLOT_ALIGN           1024
+
+/* Slot is never chosen for LRU eviction */
+#define TA_OCRAM_SLOT_PINNED               (1 << 0)
+
+/* Entry returned by TA_OCRAM_LOAD_CMD_SLOT_LIST */
+struct ta_ocram_slot_info {
+    uint32_t id;
+    uint32_t offset;            /* from the start of OCRAM */
+    uint32_t size;
+    uint32_t flags;             /* TA_OCRAM_SLOT_xxx */
+    uint32_t generation;        /* load generation of this image */
+    uint32_t last_use;          /* LRU clock, higher is more recent */
+    uint8_t digest[32];         /* SHA-256 of the image */
+};
+
+/*
+ * TA_OCRAM_LOAD_CMD_SLOT_LOAD - Verified load into an OCRAM slot
+ * param[0] (memref) AES-CTR ciphertext of 'data || RSA signature'
+ * param[1] (memref) as for TA_OCRAM_LOAD_CMD_LOAD_VERIFIED
+ * param[2] (value) input a: TA_OCRAM_LOAD_FLAG_xxx
+ *                  output a: slot id, b: TA_OCRAM_LOAD_RESIDENT when a
+ *                  slot already held the expected image
+ * param[3] (value) output a: slot OCRAM offset, b: image size
+ *
+ * With TA_OCRAM_LOAD_FLAG_IF_CHANGED a slot holding the expected digest
+ * is reused as is, once the image signature is found to cover it.
+ * Otherwise the image is decrypted, hashed and checked as by
+ * LOAD_VERIFIED, into a newly allocated slot.
+ */
+#define TA_OCRAM_LOAD_CMD_SLOT_LOAD        20
+
+/*
+ * TA_OCRAM_LOAD_CMD_SLOT_LIST - List the loaded slots
+ * param[0] (memref) output: array of struct ta_ocram_slot_info
+ * param[1] (value) output a: number of entries, b: unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_OCRAM_LOAD_CMD_SLOT_LIST        21
+
+/*
+ * TA_OCRAM_LOAD_CMD_SLOT_PIN - Pin or unpin a slot
+ * param[0] (value) a: slot id, b: 1 to pin, 0 to unpin
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_OCRAM_LOAD_CMD_SLOT_PIN         22
+
+/*
+ * TA_OCRAM_LOAD_CMD_SLOT_EVICT - Free a slot and clear its OCRAM range
+ * param[0] (value) a: slot id, b: unused
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ *
+ * Pinned slots must be unpinned first (TEE_ERROR_ACCESS_CONFLICT).
+ */
+#define TA_OCRAM_LOAD_CMD_SLOT_EVICT       23
+
+/*
+ * Delta container for TA_OCRAM_LOAD_CMD_LOAD_DELTA: a header followed by
+ * 'count' entries, each a struct ta_ocram_delta_entry and 'size' bytes
+ * of the new 'data || signature' at 'offset', AES-CTR encrypted from
+ * the header's iv. Offsets are TA_OCRAM_DELTA_BLOCK aligned; the entry
+ * covering the end of the data also carries the signature. Each
+ * revision must have its own iv, so that no keystream is reused.
+ */
+#define TA_OCRAM_DELTA_MAGIC               0x544c4444  /* "DDLT" */
+#define TA_OCRAM_DELTA_BLOCK               4096
+
+struct ta_ocram_delta_hdr {
+    uint32_t magic;
+    uint32_t block_size;        /* TA_OCRAM_DELTA_BLOCK */
+    uint32_t data_size;         /* plaintext size of the new image */
+    uint32_t count;             /* entries that follow */
+    uint8_t base_digest[32];    /* SHA-256 of the image it applies to */
+    uint8_t iv[16];             /* CTR initial vector of this revision */
+};
+
+struct ta_ocram_delta_entry {
+    uint32_t offset;
+    uint32_t size;
+};
+
+/*
+ * TA_OCRAM_LOAD_CMD_LOAD_DELTA - Update the resident image in place
+ * param[0] (memref) delta container
+ * param[1] (memref) AES key, the initial vector is in the container
+ * param[2] unused
+ * param[3] (value) output a: bytes written to OCRAM, b: blocks written
+ *
+ * The image loaded by LOAD_VERIFIED must be resident and match
+ * base_digest, else TEE_ERROR_BAD_STATE is returned and a full load is
+ * needed. Blocks whose plaintext hash equals the resident block are not
+ * rewritten. The whole new image is then hashed and its signature
+ * checked; on failure OCRAM is cleared. Needs CFG_OCRAM_SIZE and the
+ * PTA offset commands, as slots do. TEE_ERROR_BAD_STATE while a streamed
+ * load (LOAD_BEGIN) of the session is still open.
+ */
+#define TA_OCRAM_LOAD_CMD_LOAD_DELTA       24
+
+/*
+ * TA_OCRAM_LOAD_CMD_READ_AT - Read back part of OCRAM
+ * param[0] (memref) output buffer, at least b bytes
+ * param[1] (value) a: OCRAM offset, b: length
+ * param[2] unused
+ * param[3] unused
+ *
+ * Not limited to the read PTA's fixed size; the host walks a whole
+ * region by repeating it with a registered buffer.
+ */
+#define TA_OCRAM_LOAD_CMD_READ_AT          25
+
+/*
+ * TA_OCRAM_LOAD_CMD_READ_HASH - SHA-256 of an OCRAM range
+ * param[0] (value) a: OCRAM offset, b: length
+ * param[1] (memref) output: 32-byte digest
+ * param[2] unused
+ * param[3] unused
+ *
+ * The data is hashed inside the TA, only the digest is returned.
+ */
+#define TA_OCRAM_LOAD_CMD_READ_HASH        26
+
+/*
+ * AES-GCM chunked image: a header, its RSA signature (TA_ACIPHER_CMD_SIGN
+ * over the header), then 'count' records. Record i is the GCM ciphertext
+ * of plaintext bytes [i * chunk_size, (i + 1) * chunk_size), the last one
+ * shorter, followed by its 16-byte tag. The GCM IV of record i is nonce
+ * followed by i as a big-endian 32-bit value. root is the SHA-256 of all
+ * tags in record order, so the signature also fixes the set of records.
+ */
+#define TA_OCRAM_AEAD_MAGIC                0x4441434f  /* "OCAD" */
+#define TA_OCRAM_AEAD_TAG_SIZE             16
+#define TA_OCRAM_AEAD_NONCE_SIZE           8
+/* Largest chunk_size, a record is held in TA memory until its tag checks */
+#define TA_OCRAM_AEAD_CHUNK_MAX            (16 * 1024)
+
+struct ta_ocram_aead_hdr {
+    uint32_t magic;
+    uint32_t chunk_size;        /* multiple of 16 */
+    uint32_t data_size;         /* plaintext size of the image */
+    uint32_t count;             /* records that follow the signature */
+    uint8_t nonce[TA_OCRAM_AEAD_NONCE_SIZE];
+    uint8_t digest[32];         /* SHA-256 of the plaintext image */
+    uint8_t root[32];           /* SHA-256 over the record tags */
+};
+
+/*
+ * TA_OCRAM_LOAD_CMD_AEAD_BEGIN - Start loading an AES-GCM chunked image
+ * param[0] (memref) struct ta_ocram_aead_hdr followed by its signature
+ * param[1] (memref) AES key, 16 or 32 bytes
+ * param[2] (value) a: TA_OCRAM_LOAD_FLAG_xxx
+ * param[3] (value) output a: image size, b: TA_OCRAM_LOAD_RESIDENT if kept
+ *
+ * The header signature is checked before OCRAM is touched. With
+ * TA_OCRAM_LOAD_FLAG_IF_CHANGED a resident image with the header's digest
+ * is kept and no records are expected.
+ */
+#define TA_OCRAM_LOAD_CMD_AEAD_BEGIN       27
+
+/*
+ * TA_OCRAM_LOAD_CMD_AEAD_CHUNK - Decrypt and load whole records
+ * param[0] (memref) one or more consecutive records
+ * param[1] (value) output a: records accepted so far
+ * param[2] unused
+ * param[3] unused
+ *
+ * Each record is authenticated before any of it is written to OCRAM. At
+ * the first bad tag the image is wiped from OCRAM and
+ * TEE_ERROR_MAC_INVALID is returned.
+ */
+#define TA_OCRAM_LOAD_CMD_AEAD_CHUNK       28
+
+/*
+ * TA_OCRAM_LOAD_CMD_AEAD_END - Check record count, tag root and digest
+ * param[0] (value) output a: bytes loaded
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ *
+ * A root mismatch, or a SHA-256 of the decrypted plaintext other than the
+ * header's digest, wipes OCRAM and returns TEE_ERROR_SIGNATURE_INVALID.
+ */
+#define TA_OCRAM_LOAD_CMD_AEAD_END         29
+
+/*
+ * TA_OCRAM_LOAD_CMD_AEAD_SEAL - Encrypt one record, for packaging
+ * param[0] (memref) AES key followed by the header nonce
+ * param[1] (value) a: record index
+ * param[2] (memref) plaintext chunk
+ * param[3] (memref) output: ciphertext followed by the tag
+ */
+#define TA_OCRAM_LOAD_CMD_AEAD_SEAL        30
+
+/*
+ * Merkle image: a header, its RSA signature (TA_ACIPHER_CMD_SIGN over the
+ * header), then one record per block, in any order. The plaintext is cut
+ * into block_size blocks and AES-CTR encrypted as a whole. A record is a
+ * struct ta_ocram_merkle_rec, the ciphertext of block 'index' and 'nodes'
+ * sibling digests from the leaf up. leaf = SHA-256(0x00 || block), node =
+ * SHA-256(0x01 || left || right), an unpaired last node moves up a level
+ * unchanged. Only the root is signed.
+ */
+#define TA_OCRAM_MERKLE_MAGIC              0x4b4d434f  /* "OCMK" */
+
+struct ta_ocram_merkle_hdr {
+    uint32_t magic;
+    uint32_t block_size;        /* multiple of 16, at most 4096 */
+    uint32_t data_size;         /* plaintext size of the image */
+    uint32_t count;             /* blocks */
+    uint8_t root[32];
+};
+
+struct ta_ocram_merkle_rec {
+    uint32_t index;
+    uint32_t nodes;             /* path digests after the ciphertext */
+};
+
+/*
+ * TA_OCRAM_LOAD_CMD_MERKLE_BEGIN - Start loading a Merkle image
+ * param[0] (memref) struct ta_ocram_merkle_hdr followed by its signature
+ * param[1] (memref) AES key followed by the 16-byte CTR initial vector
+ * param[2] (value) a: TA_OCRAM_LOAD_FLAG_xxx
+ * param[3] (value) output a: image size, b: TA_OCRAM_LOAD_RESIDENT if kept
+ *
+ * With TA_OCRAM_LOAD_FLAG_PARTIAL the image must be the resident one (same
+ * root), else TEE_ERROR_BAD_STATE; only the blocks sent are rewritten.
+ */
+#define TA_OCRAM_LOAD_CMD_MERKLE_BEGIN     31
+
+/*
+ * TA_OCRAM_LOAD_CMD_MERKLE_BLOCKS - Verify and load whole records
+ * param[0] (memref) one or more records
+ * param[1] (value) output a: blocks loaded so far, b: index of a bad block
+ * param[2] unused
+ * param[3] unused
+ *
+ * Each block is decrypted in the TA and checked against the signed root
+ * before it is written to OCRAM. A bad block returns
+ * TEE_ERROR_SIGNATURE_INVALID; a full load is then wiped from OCRAM.
+ */
+#define TA_OCRAM_LOAD_CMD_MERKLE_BLOCKS    32
+
+/*
+ * TA_OCRAM_LOAD_CMD_MERKLE_END - Finish a Merkle load
+ * param[0] (value) output a: bytes written, b: blocks written
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ *
+ * A full load must have written every block.
+ */
+#define TA_OCRAM_LOAD_CMD_MERKLE_END       33
+
+/*
+ * TA_OCRAM_LOAD_CMD_STAGE - Verified load into the OCRAM staging area
+ * param[0] (memref) encrypted 'data || signature', as for LOAD_VERIFIED
+ * param[1] (memref) AES key followed by the 16-byte CTR initial vector
+ * param[2] (value) a: TA_OCRAM_LOAD_FLAG_xxx, b: bytes at OCRAM offset 0
+ *                  to leave untouched (the image the M-core is running)
+ * param[3] (value) output a: image size, b: staging offset
+ *
+ * Decrypts, hashes and checks the signature of the next image while the
+ * current one keeps running; TA_OCRAM_LOAD_CMD_COMMIT then moves it to
+ * offset 0. The staging area is the top of the CFG_OCRAM_SIZE bytes of
+ * OCRAM, so the two images must fit side by side, else
+ * TEE_ERROR_OUT_OF_MEMORY. Needs the PTA offset commands, as slots do;
+ * pinned slots in the way give TEE_ERROR_ACCESS_CONFLICT.
+ * A new STAGE replaces a staged image not yet committed.
+ */
+#define TA_OCRAM_LOAD_CMD_STAGE            34
+
+/*
+ * TA_OCRAM_LOAD_CMD_COMMIT - Move the staged image to OCRAM offset 0
+ * param[0] (value) output a: image size, b: unused
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ *
+ * The M-core must be stopped. The image becomes the resident one and the
+ * staging area is cleared. TEE_ERROR_BAD_STATE if nothing is staged or
+ * the staged copy changed since it was verified.
+ */
+#define TA_OCRAM_LOAD_CMD_COMMIT           35
+
+/*
+ * TA_OCRAM_LOAD_CMD_GET_STATS - Counters of this TA instance
+ * param[0] (memref) output: struct ta_ocram_stats
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ *
+ * Each session has its own TA instance, so the counters cover the
+ * commands of the calling session. Times are from TEE_GetSystemTime()
+ * and have its millisecond resolution; bytes are the memref sizes a
+ * command was given plus those it returned.
+ */
+#define TA_OCRAM_LOAD_CMD_GET_STATS        36
+
+/*
+ * TA_OCRAM_LOAD_CMD_RESET_STATS - Clear the counters
+ * No parameters. The heap peak restarts from the current heap use.
+ */
+#define TA_OCRAM_LOAD_CMD_RESET_STATS      37
+
+/* Command ids counted by GET_STATS, 0 .. TA_OCRAM_STATS_CMDS - 1 */
+#define TA_OCRAM_STATS_CMDS                48
+
+struct ta_ocram_cmd_stats {
+    uint32_t count;
+    uint32_t max_ms;
+    uint64_t total_ms;
+    uint64_t bytes;
+};
+
+struct ta_ocram_stats {
+    uint32_t pta_calls;         /* invokes of the OCRAM PTAs */
+    uint32_t pta_max_ms;
+    uint64_t pta_total_ms;
+    uint32_t heap_now;          /* bytes from TEE_Malloc in use */
+    uint32_t heap_peak;
+    struct ta_ocram_cmd_stats cmd[TA_OCRAM_STATS_CMDS];
+};
+
+/*
+ * TA_OCRAM_LOAD_CMD_BATCH - Run several commands in one invoke
+ * param[0] (memref) inout: descriptor, struct ta_batch_hdr followed by
+ *          count struct ta_batch_op, then the inline blobs they use
+ * param[1] (memref) data buffer the ops may refer to, or unused
+ * param[2] (memref) data buffer the ops may refer to, or unused
+ * param[3] (memref) data buffer the ops may refer to, or unused
+ *
+ * The ops run in order and the batch stops at the first one that fails.
+ * Each op gives TEE_PARAM_TYPES() for its own params: a value param is
+ * a/b, a memref param is offset a and size b into the descriptor
+ * (ref TA_BATCH_REF_DESC, past the op table) or into batch param[ref].
+ * Output values and memref sizes are written back into the op along
+ * with its result, and hdr.done counts the ops that ran. The invoke
+ * returns the result of the failing op, else TEE_SUCCESS. BATCH cannot
+ * be nested.
+ */
+#define TA_OCRAM_LOAD_CMD_BATCH            38
+
+#define TA_BATCH_MAX_OPS                   8
+#define TA_BATCH_DESC_MAX                  1024
+#define TA_BATCH_REF_DESC                  0
+
+struct ta_batch_param {
+    uint32_t a;
+    uint32_t b;
+    uint32_t ref;               /* memrefs: TA_BATCH_REF_DESC or 1..3 */
+};
+
+struct ta_batch_op {
+    uint32_t cmd;
+    uint32_t param_types;
+    uint32_t result;            /* out: TEE_Result of the op */
+    struct ta_batch_param p[4];
+};
+
+struct ta_batch_hdr {
+    uint32_t count;
+    uint32_t done;              /* out: ops that ran */
+};
+
 /*
  * TA_AES_CMD_PREPARE - Allocate resources for the AES ciphering
  * param[0] (value) a: TA_AES_ALGO_xxx, b: unused
  * param[1] (value) a: key size in bytes, b: unused
  * param[2] (value) a: TA_AES_MODE_ENCODE/_DECODE, b: unused
- * param[3] unused
+ * param[3] unused, or (value) output a: handle of a new context, b: unused
+ *
+ * A session holds up to TA_AES_HANDLES cipher contexts by handle, next
+ * to the one prepared without a handle. SET_KEY, SET_IV, CIPHER,
+ * CIPHER_SG and CIPHER_AT take a handle as param[3] (value) input a;
+ * without one they use the context last prepared or named by a handle,
+ * which is also the one streamed loads decrypt with. Handles are never
+ * 0 and stay valid until TA_AES_CMD_RELEASE or the end of the session.
  */
 #define TA_AES_CMD_PREPARE		0
 
+#define TA_AES_HANDLES			4
+
 #define TA_AES_ALGO_ECB			0
 #define TA_AES_ALGO_CBC			1
 #define TA_AES_ALGO_CTR			2
@@ -43,7 +587,7 @@
  * param[0] (memref) key data, size shall equal key length
  * param[1] unused
  * param[2] unused
- * param[3] unused
+ * param[3] unused, or (value) a: context handle, b: unused
  */
 #define TA_AES_CMD_SET_KEY		6
 
@@ -52,7 +596,7 @@
  * param[0] (memref) initial vector, size shall equal block length
  * param[1] unused
  * param[2] unused
- * param[3] unused
+ * param[3] unused, or (value) a: context handle, b: unused
  */
 #define TA_AES_CMD_SET_IV		7
 
@@ -61,10 +605,61 @@
  * param[0] (memref) input buffer
  * param[1] (memref) output buffer (shall be bigger than input buffer)
  * param[2] unused
- * param[3] unused
+ * param[3] unused, or (value) a: context handle, b: unused
+ *
+ * Or in place, in a single buffer:
+ * param[0] (memref) inout: data, size set to the bytes output
+ * param[1] unused
  */
 #define TA_AES_CMD_CIPHER		8
 
+/*
+ * TA_AES_CMD_CIPHER_SG - Cipher a list of segments of one buffer
+ * param[0] (memref) input: table of struct ta_aes_sg
+ * param[1] (memref) data buffer holding the segments: inout, or input
+ *          when param[2] is used
+ * param[2] (memref) output buffer, or unused to cipher in place
+ * param[3] unused, or (value) a: context handle, b: unused
+ *
+ * The segments are ciphered in table order as one stream, so CBC and CTR
+ * chaining carries from one segment to the next. With param[2], the
+ * ciphered segments are packed back to back into it and its size is set
+ * to the total. For ECB and CBC each length shall be a multiple of the
+ * AES block size.
+ */
+#define TA_AES_CMD_CIPHER_SG		39
+
+struct ta_aes_sg {
+    uint32_t offset;            /* into param[1] */
+    uint32_t length;
+};
+
+/*
+ * TA_AES_CMD_RELEASE - Drop a context handle from TA_AES_CMD_PREPARE
+ * param[0] (value) a: handle, b: unused
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_AES_CMD_RELEASE		40
+
+/*
+ * TA_AES_CMD_CIPHER_AT - Cipher a range of an AES-CTR stream
+ * param[0] (value) a: byte offset of the range in the stream, low 32 bits
+ *                  b: high 32 bits
+ * param[1] (memref) data: inout, or input when param[2] is used
+ * param[2] (memref) output buffer, or unused to cipher in place
+ * param[3] unused, or (value) a: context handle, b: unused
+ *
+ * The counter block is derived from the IV last given to SET_IV and the
+ * offset, which need not be block aligned: the keystream of the bytes
+ * before it in its block is skipped. Ranges can so be ciphered in any
+ * order, or split over sessions holding the same key and IV, and a
+ * following TA_AES_CMD_CIPHER continues right after the range. CTR only,
+ * and SET_IV shall have been given since PREPARE.
+ */
+#define TA_AES_CMD_CIPHER_AT		41
+
 #define TA_ACIPHER_CMD_GEN_KEY    9
 #define TA_ACIPHER_CMD_ENCRYPT    10
 #define TA_ACIPHER_CMD_SIGN       11
@@ -16,8 +16,38 @@
  
  /* Constants for OCRAM PTA commands and UUIDs */
  #define MODEL_DATA_OBJ_ID     "model_data.bin"
+ #define RESIDENT_OBJ_ID       "ocram_resident"
+ #define SLOTS_OBJ_ID          "ocram_slots"
+ #define BLOCKS_OBJ_ID         "ocram_blocks"
  #define OCRAM_LOAD_CMD        0
+ #define OCRAM_LOAD_AT_CMD     1   /* memref input, value a: OCRAM offset */
  #define OCRAM_READ_CMD        0
+ #define OCRAM_READ_AT_CMD     1   /* memref output, value a: OCRAM offset */
+ 
+ /*
+  * The stock OCRAM PTAs only implement command 0, which writes a buffer
+  * at the start of OCRAM or reads from there. Chunked and offset access
+  * needs the _AT extension of both PTAs: param[0] as for command 0, plus
+  * param[1].value.a with the OCRAM offset; reads may return less than
+  * asked for, and an empty buffer is a no-op. pta_need_at() probes for
+  * it once per session, and every path that writes at an offset checks
+  * it before touching OCRAM, so a stock PTA gets TEE_ERROR_NOT_SUPPORTED
+  * up front instead of a load that stops halfway. The legacy LOAD falls
+  * back to a single command 0 there.
+  */
+ #define PTA_AT_UNKNOWN        0
+ #define PTA_AT_MISSING        1
+ #define PTA_AT_PRESENT        2
+ 
+ /*
+  * Bytes of OCRAM the load PTA addresses, from CFG_OCRAM_SIZE in sub.mk.
+  * Slots, staging and delta updates need it to place images; 0 leaves
+  * them unsupported.
+  */
+ #ifndef CFG_OCRAM_SIZE
+ #define CFG_OCRAM_SIZE        0
+ #endif
+ 
  static const TEE_UUID pta_ocram_load_uuid = {
      0xd9e00de1, 0x950b, 0x4eb8,
      { 0xb7, 0xd1, 0x6b, 0x32, 0xde, 0xec, 0x18, 0x57 }
@@ -33,17 +63,48 @@
  #define AES256_KEY_BIT_SIZE    256
  #define AES256_KEY_BYTE_SIZE   (AES256_KEY_BIT_SIZE / 8)
  
+ /* Streamed load: plaintext is bounced through a buffer of this size */
+ #define OCRAM_CHUNK_SIZE      4096
+ #define SHA256_DIGEST_SIZE    32
+ #define AES_BLOCK_SIZE        16
+ 
+ /* Internal stream_start() flag: keep per-block digests for delta loads */
+ #define STREAM_FLAG_BLOCKS    (1u << 31)
+ /* Internal stream_start() flag: records come through struct ocram_aead */
+ #define STREAM_FLAG_AEAD      (1u << 30)
+ 
  /* ACIPHER definitions */
  #define ACIPHER_KEY_ID         "acipher_key"
  #define ACIPHER_KEY_ID_LEN     (sizeof(ACIPHER_KEY_ID) - 1)
  
+ /*
+  * Prepared AES operations kept per session, see aes_prepare(): the
+  * contexts held by handle plus two for the unheld encode/decode pair.
+  */
+ #define AES_OP_CACHE           (TA_AES_HANDLES + 2)
+ 
+ struct aes_op {
+     uint32_t algo;                  /* TEE_ALG_xxx */
+     uint32_t mode;                  /* TEE_MODE_xxx */
+     uint32_t key_size;              /* bytes */
+     uint32_t last_use;
+     bool held;                      /* by handle (index + 1), not evicted */
+     bool iv_set;                    /* iv given by SET_IV since PREPARE */
+     uint8_t iv[AES_BLOCK_SIZE];     /* for CIPHER_AT */
+     TEE_OperationHandle op;         /* TEE_HANDLE_NULL: entry unused */
+     TEE_ObjectHandle key;
+ };
+ 
  /* AES cipher context per session */
  struct aes_cipher {
      uint32_t algo;
      uint32_t mode;
      uint32_t key_size;
-     TEE_OperationHandle op_handle;
+     TEE_OperationHandle op_handle;  /* of the selected cache entry */
      TEE_ObjectHandle key_handle;
+     struct aes_op *cur;             /* the selected cache entry */
+     uint32_t tick;                  /* LRU clock of the cache */
+     struct aes_op cache[AES_OP_CACHE];
  };
  
  /* ACIPHER context per session */
@@ -51,10 +112,121 @@
      TEE_ObjectHandle key;
  };
  
+ /* LZ stream decoder, between decrypt and OCRAM for COMPRESSED loads */
+ enum lz_state { LZ_HDR, LZ_BLOCK_HDR, LZ_BLOCK, LZ_DONE };
+ 
+ struct ocram_lz {
+     enum lz_state state;
+     uint32_t need;                  /* bytes of in[] the state waits for */
+     uint32_t have;
+     struct ta_ocram_lz_block blk;   /* block being collected */
+     uint8_t in[TA_OCRAM_LZ_BLOCK];
+     uint8_t out[TA_OCRAM_LZ_BLOCK];
+ };
+ 
+ /* Streamed OCRAM load state per session */
+ struct ocram_stream {
+     bool active;
+     uint32_t base;                  /* OCRAM offset of the image */
+     uint32_t total;                 /* plaintext bytes to write to OCRAM */
+     uint32_t offset;                /* next offset to write, from base */
+     uint8_t *buf;                   /* OCRAM_CHUNK_SIZE bounce buffer */
+     TEE_OperationHandle cipher;     /* caller's own, else the session op */
+     uint8_t trailer[TA_OCRAM_LOAD_TRAILER_MAX];
+     uint32_t trailer_len;           /* plaintext bytes past total */
+     TEE_OperationHandle digest_op;  /* SHA-256 over loaded plaintext */
+     TEE_OperationHandle block_op;   /* SHA-256 of the current block */
+     uint8_t *blocks;                /* per TA_OCRAM_DELTA_BLOCK digests */
+     bool aead;                      /* fed by AEAD_CHUNK, not LOAD_CHUNK */
+     bool verify;                    /* TA_OCRAM_LOAD_FLAG_VERIFY */
+     struct ocram_lz *lz;            /* TA_OCRAM_LOAD_FLAG_COMPRESSED */
+ };
+ 
+ /* AES-GCM chunked load state per session */
+ struct ocram_aead {
+     struct ta_ocram_aead_hdr hdr;   /* header, signature checked */
+     uint32_t index;                 /* next record */
+     TEE_OperationHandle op;         /* AES-GCM decrypt */
+     TEE_OperationHandle root_op;    /* SHA-256 over the record tags */
+     uint8_t *rec;                   /* plaintext until its tag checks */
+ };
+ 
+ /* Merkle image load state per session */
+ struct ocram_merkle {
+     bool active;
+     bool partial;                   /* TA_OCRAM_LOAD_FLAG_PARTIAL */
+     struct ta_ocram_merkle_hdr hdr; /* header, signature checked */
+     uint8_t iv[AES_BLOCK_SIZE];     /* CTR initial vector of the image */
+     uint32_t done;                  /* distinct blocks written */
+     uint32_t bytes;                 /* plaintext bytes in those blocks */
+     uint8_t *seen;                  /* bitmap of blocks written */
+     uint8_t *buf;                   /* one decrypted block */
+     TEE_OperationHandle cipher;     /* AES-CTR decrypt of the blocks */
+     TEE_OperationHandle hash_op;
+ };
+ 
+ /* Image verified into the staging area, waiting for COMMIT */
+ struct ocram_stage {
+     bool valid;
+     uint32_t base;                  /* OCRAM offset of the staged copy */
+     uint32_t size;
+     uint8_t digest[SHA256_DIGEST_SIZE];
+ };
+ 
+ /*
+  * OCRAM PTA sessions, opened on first use and kept for the lifetime of
+  * the TA session instead of being set up and torn down per command.
+  */
+ struct pta_sessions {
+     TEE_TASessionHandle load;
+     TEE_TASessionHandle read;
+     uint8_t load_at;                /* PTA_AT_xxx */
+     uint8_t read_at;
+ };
+ 
+ /*
+  * Persistent record of the verified image last loaded into OCRAM. The
+  * generation is bumped by every recorded load and when the record is
+  * found stale.
+  */
+ struct ocram_resident {
+     uint32_t generation;
+     uint32_t valid;
+     uint32_t size;
+     uint8_t digest[SHA256_DIGEST_SIZE];   /* as given by the load */
+     uint8_t content[SHA256_DIGEST_SIZE];  /* SHA-256 of the OCRAM range */
+     TEE_Time loaded_at;                   /* TEE_GetSystemTime() */
+ };
+ 
+ /* One verified image held in a region of the OCRAM window */
+ struct ocram_slot {
+     uint32_t valid;
+     uint32_t flags;                       /* TA_OCRAM_SLOT_xxx */
+     uint32_t offset;
+     uint32_t size;
+     uint32_t generation;
+     uint32_t last_use;
+     uint8_t digest[SHA256_DIGEST_SIZE];   /* SHA-256 of the slot range */
+ };
+ 
+ /* Slot table, persisted like struct ocram_resident */
+ struct ocram_slots {
+     uint32_t tick;                        /* LRU clock */
+     uint32_t generation;                  /* bumped on every slot load */
+     TEE_Time stamp;                       /* last update */
+     struct ocram_slot slot[TA_OCRAM_LOAD_SLOTS];
+ };
+ 
  /* Combined session context */
  struct ta_ctx {
      struct aes_cipher aes;
      struct acipher aci;
+     struct ocram_stream stream;
+     struct ocram_aead aead;
+     struct ocram_merkle merkle;
+     struct ocram_stage stage;
+     struct pta_sessions pta;
+     struct ocram_slots slots;       /* scratch copy of the stored table */
  };
  
  /* Forward declarations for AES helpers */
@@ -87,6 +259,171 @@
                               TEE_Param params[TEE_NUM_PARAMS]);
  static TEE_Result cmd_digest(struct acipher *state, uint32_t pt,
                               TEE_Param params[TEE_NUM_PARAMS]);
+ static TEE_Result rsa_verify(struct acipher *state, const void *inbuf,
+                              uint32_t in_len, const void *sig,
+                              uint32_t sig_len);
+ 
+ /* Forward declarations for OCRAM PTA helpers */
+ static TEE_Result pta_invoke(TEE_TASessionHandle *sess,
+                              const TEE_UUID *uuid, uint32_t cmd,
+                              uint32_t pt, TEE_Param params[TEE_NUM_PARAMS]);
+ static void pta_close(TEE_TASessionHandle *sess);
+ 
+ /* Forward declarations for OCRAM streaming helpers */
+ static void stream_release(struct ocram_stream *st);
+ static TEE_Result stream_start(struct ta_ctx *ctx, uint32_t base,
+                                uint32_t total, uint32_t flags,
+                                TEE_OperationHandle cipher);
+ static TEE_Result stream_feed(struct ta_ctx *ctx, const uint8_t *in,
+                               uint32_t len);
+ static TEE_Result stream_scrub(struct ta_ctx *ctx, uint32_t base,
+                                uint32_t len);
+ static void merkle_abort(struct ta_ctx *ctx);
+ static TEE_Result cmd_map_memory(struct ta_ctx *ctx, uint32_t pt,
+                                  TEE_Param params[TEE_NUM_PARAMS]);
+ static TEE_Result cmd_load_begin(struct ta_ctx *ctx, uint32_t pt,
+                                  TEE_Param params[TEE_NUM_PARAMS]);
+ static TEE_Result cmd_load_chunk(struct ta_ctx *ctx, uint32_t pt,
+                                  TEE_Param params[TEE_NUM_PARAMS]);
+ static TEE_Result cmd_load_end(struct ta_ctx *ctx, uint32_t pt,
+                                TEE_Param params[TEE_NUM_PARAMS]);
+ static TEE_Result cmd_load_from_storage(struct ta_ctx *ctx, uint32_t pt,
+                                         TEE_Param params[TEE_NUM_PARAMS]);
+ static TEE_Result cmd_load_verified(struct ta_ctx *ctx, uint32_t pt,
+                                     TEE_Param params[TEE_NUM_PARAMS]);
+ 
+ /* Forward declarations for OCRAM residency helpers */
+ static void ocram_dirty(struct ta_ctx *ctx, uint32_t base, uint32_t len);
+ static void resident_set(struct ta_ctx *ctx, const uint8_t *digest,
+                          uint32_t size);
+ 
+ /*----------------------------------------------------------
+  * TA statistics (TA_OCRAM_LOAD_CMD_GET_STATS)
+  *
+  * The TA is not single instance, so these counters belong to the one
+  * session of this instance. Heap use is tracked by ta_malloc() and
+  * ta_free(), which every allocation in this file goes through: each
+  * block carries its size in a STATS_HEAP_HDR header, sized to keep the
+  * alignment TEE_Malloc() gives.
+  *---------------------------------------------------------*/
+ #define STATS_HEAP_HDR        16
+ 
+ static struct ta_ocram_stats stats;
+ 
+ static uint32_t stats_ms_since(const TEE_Time *t0)
+ {
+     TEE_Time t1;
+ 
+     TEE_GetSystemTime(&t1);
+     if (t1.seconds < t0->seconds ||
+         (t1.seconds == t0->seconds && t1.millis < t0->millis))
+         return 0;
+     return (t1.seconds - t0->seconds) * 1000 + t1.millis - t0->millis;
+ }
+ 
+ static void *ta_malloc(uint32_t size, uint32_t hint)
+ {
+     uint8_t *p;
+ 
+     if (size > UINT32_MAX - STATS_HEAP_HDR)
+         return NULL;
+     p = TEE_Malloc(size + STATS_HEAP_HDR, hint);
+     if (!p)
+         return NULL;
+     memcpy(p, &size, sizeof(size));
+     stats.heap_now += size;
+     if (stats.heap_now > stats.heap_peak)
+         stats.heap_peak = stats.heap_now;
+     return p + STATS_HEAP_HDR;
+ }
+ 
+ static void ta_free(void *buf)
+ {
+     uint8_t *p = buf;
+     uint32_t size;
+ 
+     if (!p)
+         return;
+     p -= STATS_HEAP_HDR;
+     memcpy(&size, p, sizeof(size));
+     stats.heap_now -= size;
+     TEE_Free(p);
+ }
+ 
+ /* Sum of the sizes of the memrefs passed in (out = false) or out */
+ static uint64_t stats_memref_bytes(uint32_t pt, TEE_Param params[4],
+                                    bool out)
+ {
+     uint64_t bytes = 0;
+     uint32_t i;
+ 
+     for (i = 0; i < TEE_NUM_PARAMS; i++) {
+         switch (TEE_PARAM_TYPE_GET(pt, i)) {
+         case TEE_PARAM_TYPE_MEMREF_INPUT:
+             if (!out)
+                 bytes += params[i].memref.size;
+             break;
+         case TEE_PARAM_TYPE_MEMREF_OUTPUT:
+             if (out)
+                 bytes += params[i].memref.size;
+             break;
+         case TEE_PARAM_TYPE_MEMREF_INOUT:
+             bytes += params[i].memref.size;
+             break;
+         default:
+             break;
+         }
+     }
+     return bytes;
+ }
+ 
+ static void stats_cmd(uint32_t cmd, const TEE_Time *t0, uint64_t bytes)
+ {
+     struct ta_ocram_cmd_stats *cs;
+     uint32_t ms = stats_ms_since(t0);
+ 
+     if (cmd >= TA_OCRAM_STATS_CMDS)
+         return;
+     cs = &stats.cmd[cmd];
+     cs->count++;
+     cs->total_ms += ms;
+     if (ms > cs->max_ms)
+         cs->max_ms = ms;
+     cs->bytes += bytes;
+ }
+ 
+ static TEE_Result cmd_get_stats(uint32_t pt,
+                                 TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_OUTPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     if (params[0].memref.size < sizeof(stats)) {
+         params[0].memref.size = sizeof(stats);
+         return TEE_ERROR_SHORT_BUFFER;
+     }
+     memcpy(params[0].memref.buffer, &stats, sizeof(stats));
+     params[0].memref.size = sizeof(stats);
+     return TEE_SUCCESS;
+ }
+ 
+ static TEE_Result cmd_reset_stats(uint32_t pt)
+ {
+     uint32_t heap_now = stats.heap_now;
+ 
+     if (pt != TEE_PARAM_TYPES(TEE_PARAM_TYPE_NONE, TEE_PARAM_TYPE_NONE,
+                               TEE_PARAM_TYPE_NONE, TEE_PARAM_TYPE_NONE))
+         return TEE_ERROR_BAD_PARAMETERS;
+     memset(&stats, 0, sizeof(stats));
+     stats.heap_now = heap_now;
+     stats.heap_peak = heap_now;
+     return TEE_SUCCESS;
+ }
  
  /*----------------------------------------------------------
   * AES helper implementations (from optee_examples/aes/ta)
@@ -137,85 +474,223 @@
      }
  }
  
- static TEE_Result alloc_resources(struct aes_cipher *sess,
-                                   uint32_t param_types,
-                                   TEE_Param params[4])
+ static void aes_op_free(struct aes_op *e)
  {
-     const uint32_t exp = TEE_PARAM_TYPES(
-         TEE_PARAM_TYPE_VALUE_INPUT,
-         TEE_PARAM_TYPE_VALUE_INPUT,
-         TEE_PARAM_TYPE_VALUE_INPUT,
-         TEE_PARAM_TYPE_NONE);
-     if (param_types != exp)
-         return TEE_ERROR_BAD_PARAMETERS;
+     if (e->op != TEE_HANDLE_NULL)
+         TEE_FreeOperation(e->op);
+     if (e->key != TEE_HANDLE_NULL)
+         TEE_FreeTransientObject(e->key);
+     e->op = TEE_HANDLE_NULL;
+     e->key = TEE_HANDLE_NULL;
+ }
  
+ /* Allocate an operation and its key object, keyed with zeros */
+ static TEE_Result aes_op_alloc(struct aes_op *e, uint32_t algo,
+                                uint32_t mode, uint32_t key_size)
+ {
+     static const uint8_t zero_key[AES256_KEY_BYTE_SIZE];
+     TEE_Attribute attr;
      TEE_Result res;
-     res = ta2tee_algo_id(params[0].value.a, &sess->algo);
-     if (res != TEE_SUCCESS) return res;
-     res = ta2tee_key_size(params[1].value.a, &sess->key_size);
-     if (res != TEE_SUCCESS) return res;
-     res = ta2tee_mode_id(params[2].value.a, &sess->mode);
-     if (res != TEE_SUCCESS) return res;
  
-     if (sess->op_handle != TEE_HANDLE_NULL)
-         TEE_FreeOperation(sess->op_handle);
-     if (sess->key_handle != TEE_HANDLE_NULL)
-         TEE_FreeTransientObject(sess->key_handle);
- 
-     res = TEE_AllocateOperation(&sess->op_handle,
-                                 sess->algo,
-                                 sess->mode,
-                                 sess->key_size * 8);
+     res = TEE_AllocateOperation(&e->op, algo, mode, key_size * 8);
+     if (res != TEE_SUCCESS) {
+         e->op = TEE_HANDLE_NULL;
+         return res;
+     }
+     res = TEE_AllocateTransientObject(TEE_TYPE_AES, key_size * 8, &e->key);
      if (res != TEE_SUCCESS) {
-         sess->op_handle = TEE_HANDLE_NULL;
+         e->key = TEE_HANDLE_NULL;
+         aes_op_free(e);
          return res;
      }
-     res = TEE_AllocateTransientObject(TEE_TYPE_AES,
-                                       sess->key_size * 8,
-                                       &sess->key_handle);
+     TEE_InitRefAttribute(&attr, TEE_ATTR_SECRET_VALUE,
+                          (void *)zero_key, key_size);
+     res = TEE_PopulateTransientObject(e->key, &attr, 1);
+     if (res == TEE_SUCCESS)
+         res = TEE_SetOperationKey(e->op, e->key);
      if (res != TEE_SUCCESS) {
-         TEE_FreeOperation(sess->op_handle);
-         sess->op_handle = TEE_HANDLE_NULL;
-         sess->key_handle = TEE_HANDLE_NULL;
+         aes_op_free(e);
          return res;
      }
+     e->algo = algo;
+     e->mode = mode;
+     e->key_size = key_size;
+     return TEE_SUCCESS;
+ }
  
-     void *dummy = TEE_Malloc(sess->key_size, 0);
-     if (!dummy)
-         return TEE_ERROR_OUT_OF_MEMORY;
-     {
-         TEE_Attribute attr;
-         TEE_InitRefAttribute(&attr, TEE_ATTR_SECRET_VALUE,
-                              dummy, sess->key_size);
-         res = TEE_PopulateTransientObject(sess->key_handle, &attr, 1);
+ /* Make cache entry e the operation the session ciphers with */
+ static void aes_select(struct aes_cipher *sess, struct aes_op *e)
+ {
+     e->last_use = ++sess->tick;
+     sess->cur = e;
+     sess->algo = e->algo;
+     sess->mode = e->mode;
+     sess->key_size = e->key_size;
+     sess->op_handle = e->op;
+     sess->key_handle = e->key;
+ }
+ 
+ /*
+  * Select the operation for TA_AES_ALGO_xxx/_MODE_xxx and key size.
+  * Operations stay allocated in a small LRU cache, so switching between
+  * encode and decode does not free and reallocate them; only a new
+  * combination allocates, evicting the least recently used entry. A
+  * reused operation still holds its last key until SET_KEY.
+  *
+  * Entries held by a handle are left alone. With handle set, the chosen
+  * entry is held too and its handle returned, up to TA_AES_HANDLES.
+  */
+ static TEE_Result aes_prepare(struct aes_cipher *sess, uint32_t algo,
+                               uint32_t key_size, uint32_t mode,
+                               uint32_t *handle)
+ {
+     struct aes_op *e = NULL;
+     TEE_Result res;
+     uint32_t held = 0;
+     uint32_t i;
+ 
+     res = ta2tee_algo_id(algo, &algo);
+     if (res != TEE_SUCCESS) return res;
+     res = ta2tee_key_size(key_size, &key_size);
+     if (res != TEE_SUCCESS) return res;
+     res = ta2tee_mode_id(mode, &mode);
+     if (res != TEE_SUCCESS) return res;
+ 
+     if (handle) {
+         for (i = 0; i < AES_OP_CACHE; i++)
+             held += sess->cache[i].held;
+         if (held == TA_AES_HANDLES)
+             return TEE_ERROR_OUT_OF_MEMORY;
      }
-     TEE_Free(dummy);
-     if (res != TEE_SUCCESS)
-         return res;
  
-     return TEE_SetOperationKey(sess->op_handle, sess->key_handle);
+     sess->op_handle = TEE_HANDLE_NULL;
+     sess->key_handle = TEE_HANDLE_NULL;
+     sess->cur = NULL;
+     for (i = 0; i < AES_OP_CACHE; i++) {
+         struct aes_op *c = &sess->cache[i];
+ 
+         if (c->held)
+             continue;
+         if (c->op != TEE_HANDLE_NULL && c->algo == algo &&
+             c->mode == mode && c->key_size == key_size) {
+             e = c;
+             break;
+         }
+         if (!e || (e->op != TEE_HANDLE_NULL &&
+                    (c->op == TEE_HANDLE_NULL || c->last_use < e->last_use)))
+             e = c;
+     }
+     if (e->op == TEE_HANDLE_NULL || e->algo != algo || e->mode != mode ||
+         e->key_size != key_size) {
+         aes_op_free(e);
+         res = aes_op_alloc(e, algo, mode, key_size);
+         if (res != TEE_SUCCESS)
+             return res;
+     }
+ 
+     e->iv_set = false;
+     aes_select(sess, e);
+     if (handle) {
+         e->held = true;
+         *handle = (uint32_t)(e - sess->cache) + 1;
+     }
+     return TEE_SUCCESS;
  }
  
- static TEE_Result set_aes_key(struct aes_cipher *sess,
-                               uint32_t param_types,
-                               TEE_Param params[4])
+ /*
+  * param[3] of SET_KEY, SET_IV, CIPHER, CIPHER_SG and CIPHER_AT: a handle
+  * selects that context and is dropped from *pt, so the commands check
+  * their own params as before. Without one the selected context is used.
+  */
+ static TEE_Result aes_handle_param(struct aes_cipher *sess, uint32_t *pt,
+                                    TEE_Param params[4])
+ {
+     uint32_t h;
+ 
+     if (TEE_PARAM_TYPE_GET(*pt, 3) != TEE_PARAM_TYPE_VALUE_INPUT)
+         return TEE_SUCCESS;
+     h = params[3].value.a;
+     if (!h || h > AES_OP_CACHE || !sess->cache[h - 1].held)
+         return TEE_ERROR_BAD_PARAMETERS;
+     aes_select(sess, &sess->cache[h - 1]);
+     *pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_GET(*pt, 0),
+                           TEE_PARAM_TYPE_GET(*pt, 1),
+                           TEE_PARAM_TYPE_GET(*pt, 2),
+                           TEE_PARAM_TYPE_NONE);
+     return TEE_SUCCESS;
+ }
+ 
+ /*
+  * TA_AES_CMD_RELEASE: the context goes back to the LRU cache, so a
+  * later PREPARE of the same kind reuses its operation.
+  */
+ static TEE_Result release_handle(struct aes_cipher *sess, uint32_t pt,
+                                  TEE_Param params[4])
  {
      const uint32_t exp = TEE_PARAM_TYPES(
-         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_VALUE_INPUT,
          TEE_PARAM_TYPE_NONE,
          TEE_PARAM_TYPE_NONE,
          TEE_PARAM_TYPE_NONE);
+     uint32_t h = params[0].value.a;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     if (!h || h > AES_OP_CACHE || !sess->cache[h - 1].held)
+         return TEE_ERROR_BAD_PARAMETERS;
+     sess->cache[h - 1].held = false;
+     return TEE_SUCCESS;
+ }
+ 
+ static void aes_release(struct aes_cipher *sess)
+ {
+     uint32_t i;
+ 
+     for (i = 0; i < AES_OP_CACHE; i++)
+         aes_op_free(&sess->cache[i]);
+     sess->op_handle = TEE_HANDLE_NULL;
+     sess->key_handle = TEE_HANDLE_NULL;
+     sess->cur = NULL;
+ }
+ 
+ static TEE_Result alloc_resources(struct aes_cipher *sess,
+                                   uint32_t param_types,
+                                   TEE_Param params[4])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_NONE);
+     const uint32_t exp_handle = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_VALUE_OUTPUT);
+ 
+     if (param_types == exp_handle) {
+         params[3].value.b = 0;
+         return aes_prepare(sess, params[0].value.a, params[1].value.a,
+                            params[2].value.a, &params[3].value.a);
+     }
      if (param_types != exp)
          return TEE_ERROR_BAD_PARAMETERS;
  
-     uint32_t key_sz = params[0].memref.size;
+     return aes_prepare(sess, params[0].value.a, params[1].value.a,
+                        params[2].value.a, NULL);
+ }
+ 
+ /* Load key material into the prepared operation */
+ static TEE_Result aes_set_key(struct aes_cipher *sess, void *key,
+                               uint32_t key_sz)
+ {
+     if (sess->op_handle == TEE_HANDLE_NULL)
+         return TEE_ERROR_BAD_STATE;
      if (key_sz != sess->key_size)
          return TEE_ERROR_BAD_PARAMETERS;
  
      TEE_Attribute attr;
-     TEE_InitRefAttribute(&attr, TEE_ATTR_SECRET_VALUE,
-                          params[0].memref.buffer,
-                          key_sz);
+     TEE_InitRefAttribute(&attr, TEE_ATTR_SECRET_VALUE, key, key_sz);
  
      TEE_ResetTransientObject(sess->key_handle);
      TEE_Result res = TEE_PopulateTransientObject(sess->key_handle, &attr, 1);
@@ -226,6 +701,58 @@
      return TEE_SetOperationKey(sess->op_handle, sess->key_handle);
  }
  
+ /*
+  * Allocate an AES operation of algo in mode with the raw key. It is not
+  * part of the session's cache: the TA's own loads use these, so the
+  * operations, keys and selection the client prepared stay as they are.
+  */
+ static TEE_Result aes_key_op(TEE_OperationHandle *op, uint32_t algo,
+                              uint32_t mode, const void *key, uint32_t key_sz)
+ {
+     TEE_ObjectHandle obj = TEE_HANDLE_NULL;
+     TEE_Attribute attr;
+     TEE_Result res;
+ 
+     if (key_sz != AES128_KEY_BYTE_SIZE && key_sz != AES256_KEY_BYTE_SIZE)
+         return TEE_ERROR_BAD_PARAMETERS;
+ 
+     res = TEE_AllocateOperation(op, algo, mode, key_sz * 8);
+     if (res != TEE_SUCCESS) {
+         *op = TEE_HANDLE_NULL;
+         return res;
+     }
+     res = TEE_AllocateTransientObject(TEE_TYPE_AES, key_sz * 8, &obj);
+     if (res == TEE_SUCCESS) {
+         TEE_InitRefAttribute(&attr, TEE_ATTR_SECRET_VALUE, key, key_sz);
+         res = TEE_PopulateTransientObject(obj, &attr, 1);
+     }
+     if (res == TEE_SUCCESS)
+         res = TEE_SetOperationKey(*op, obj);
+     /* The operation keeps its own copy of the key */
+     TEE_FreeTransientObject(obj);
+     if (res != TEE_SUCCESS) {
+         TEE_FreeOperation(*op);
+         *op = TEE_HANDLE_NULL;
+     }
+     return res;
+ }
+ 
+ static TEE_Result set_aes_key(struct aes_cipher *sess,
+                               uint32_t param_types,
+                               TEE_Param params[4])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+     if (param_types != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+ 
+     return aes_set_key(sess, params[0].memref.buffer,
+                        params[0].memref.size);
+ }
+ 
  static TEE_Result reset_aes_iv(struct aes_cipher *sess,
                                 uint32_t param_types,
                                 TEE_Param params[4])
@@ -241,6 +768,12 @@
      TEE_CipherInit(sess->op_handle,
                     params[0].memref.buffer,
                     params[0].memref.size);
+     /* Kept for CIPHER_AT to derive counter blocks from */
+     if (sess->cur) {
+         sess->cur->iv_set = params[0].memref.size == AES_BLOCK_SIZE;
+         if (sess->cur->iv_set)
+             memcpy(sess->cur->iv, params[0].memref.buffer, AES_BLOCK_SIZE);
+     }
      return TEE_SUCCESS;
  }
  
@@ -253,6 +786,22 @@
          TEE_PARAM_TYPE_MEMREF_OUTPUT,
          TEE_PARAM_TYPE_NONE,
          TEE_PARAM_TYPE_NONE);
+     const uint32_t exp_inplace = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_INOUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+ 
+     /* One buffer, no second copy of the data in shared memory */
+     if (param_types == exp_inplace) {
+         if (sess->op_handle == TEE_HANDLE_NULL)
+             return TEE_ERROR_BAD_STATE;
+         return TEE_CipherUpdate(sess->op_handle,
+                                 params[0].memref.buffer,
+                                 params[0].memref.size,
+                                 params[0].memref.buffer,
+                                 &params[0].memref.size);
+     }
      if (param_types != exp)
          return TEE_ERROR_BAD_PARAMETERS;
  
@@ -266,6 +815,167 @@
                              &params[1].memref.size);
  }
  
+ /*
+  * Cipher the segments listed in a struct ta_aes_sg table as one stream.
+  * The table is copied out of shared memory and checked in full first,
+  * so a bad entry or a short output buffer leaves the cipher untouched.
+  */
+ static TEE_Result cipher_segments(struct aes_cipher *sess,
+                                   uint32_t param_types,
+                                   TEE_Param params[4])
+ {
+     uint32_t data_type = TEE_PARAM_TYPE_GET(param_types, 1);
+     uint32_t out_type = TEE_PARAM_TYPE_GET(param_types, 2);
+     uint32_t count, data_sz, total = 0, done = 0, n, i;
+     struct ta_aes_sg *table;
+     uint8_t *data, *out;
+     TEE_Result res = TEE_SUCCESS;
+ 
+     if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_MEMREF_INPUT ||
+         TEE_PARAM_TYPE_GET(param_types, 3) != TEE_PARAM_TYPE_NONE)
+         return TEE_ERROR_BAD_PARAMETERS;
+     if (out_type == TEE_PARAM_TYPE_NONE) {
+         if (data_type != TEE_PARAM_TYPE_MEMREF_INOUT)
+             return TEE_ERROR_BAD_PARAMETERS;
+     } else if (out_type != TEE_PARAM_TYPE_MEMREF_OUTPUT ||
+                (data_type != TEE_PARAM_TYPE_MEMREF_INPUT &&
+                 data_type != TEE_PARAM_TYPE_MEMREF_INOUT)) {
+         return TEE_ERROR_BAD_PARAMETERS;
+     }
+     if (sess->op_handle == TEE_HANDLE_NULL)
+         return TEE_ERROR_BAD_STATE;
+ 
+     count = params[0].memref.size / sizeof(*table);
+     if (!count)
+         return TEE_ERROR_BAD_PARAMETERS;
+     table = ta_malloc(count * sizeof(*table), 0);
+     if (!table)
+         return TEE_ERROR_OUT_OF_MEMORY;
+     memcpy(table, params[0].memref.buffer, count * sizeof(*table));
+ 
+     data = params[1].memref.buffer;
+     data_sz = params[1].memref.size;
+     out = out_type == TEE_PARAM_TYPE_NONE ? NULL : params[2].memref.buffer;
+ 
+     /* ECB and CBC (NOPAD) output exactly the full blocks they are given */
+     for (i = 0; i < count; i++) {
+         if (table[i].offset > data_sz ||
+             table[i].length > data_sz - table[i].offset ||
+             table[i].length > UINT32_MAX - total ||
+             (sess->algo != TEE_ALG_AES_CTR &&
+              table[i].length % AES_BLOCK_SIZE)) {
+             res = TEE_ERROR_BAD_PARAMETERS;
+             goto out;
+         }
+         total += table[i].length;
+     }
+     if (out && params[2].memref.size < total) {
+         params[2].memref.size = total;
+         res = TEE_ERROR_SHORT_BUFFER;
+         goto out;
+     }
+ 
+     for (i = 0; i < count; i++) {
+         uint8_t *seg = data + table[i].offset;
+ 
+         n = table[i].length;
+         res = TEE_CipherUpdate(sess->op_handle, seg, table[i].length,
+                                out ? out + done : seg, &n);
+         if (res != TEE_SUCCESS)
+             goto out;
+         done += n;
+     }
+     if (out)
+         params[2].memref.size = done;
+ 
+ out:
+     ta_free(table);
+     return res;
+ }
+ 
+ /*
+  * Big-endian 128-bit counter for the block holding byte offset off of
+  * the CTR stream that starts at iv
+  */
+ static void ctr_iv_at(const uint8_t *iv, uint64_t off, uint8_t *out)
+ {
+     uint64_t carry = off / AES_BLOCK_SIZE;
+     int i;
+ 
+     for (i = AES_BLOCK_SIZE - 1; i >= 0; i--) {
+         carry += iv[i];
+         out[i] = carry & 0xff;
+         carry >>= 8;
+     }
+ }
+ 
+ /*
+  * Cipher a range of the CTR stream at a byte offset, see
+  * TA_AES_CMD_CIPHER_AT. The operation is re-initialised at the counter
+  * block for the offset, and the keystream before the offset in that
+  * block is ciphered into a scratch block and dropped.
+  */
+ static TEE_Result cipher_at(struct aes_cipher *sess, uint32_t param_types,
+                             TEE_Param params[4])
+ {
+     uint32_t data_type = TEE_PARAM_TYPE_GET(param_types, 1);
+     uint32_t out_type = TEE_PARAM_TYPE_GET(param_types, 2);
+     uint8_t ctr[AES_BLOCK_SIZE];
+     uint8_t skip[AES_BLOCK_SIZE];
+     TEE_Result res;
+     uint64_t off;
+     uint32_t n;
+     void *out;
+ 
+     if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_VALUE_INPUT ||
+         TEE_PARAM_TYPE_GET(param_types, 3) != TEE_PARAM_TYPE_NONE)
+         return TEE_ERROR_BAD_PARAMETERS;
+     if (out_type == TEE_PARAM_TYPE_NONE) {
+         if (data_type != TEE_PARAM_TYPE_MEMREF_INOUT)
+             return TEE_ERROR_BAD_PARAMETERS;
+     } else if (out_type != TEE_PARAM_TYPE_MEMREF_OUTPUT ||
+                (data_type != TEE_PARAM_TYPE_MEMREF_INPUT &&
+                 data_type != TEE_PARAM_TYPE_MEMREF_INOUT)) {
+         return TEE_ERROR_BAD_PARAMETERS;
+     }
+     if (!sess->cur || !sess->cur->iv_set)
+         return TEE_ERROR_BAD_STATE;
+     if (sess->algo != TEE_ALG_AES_CTR)
+         return TEE_ERROR_NOT_SUPPORTED;
+ 
+     if (out_type == TEE_PARAM_TYPE_NONE) {
+         out = params[1].memref.buffer;
+     } else {
+         if (params[2].memref.size < params[1].memref.size) {
+             params[2].memref.size = params[1].memref.size;
+             return TEE_ERROR_SHORT_BUFFER;
+         }
+         out = params[2].memref.buffer;
+     }
+ 
+     off = ((uint64_t)params[0].value.b << 32) | params[0].value.a;
+     ctr_iv_at(sess->cur->iv, off, ctr);
+     TEE_CipherInit(sess->op_handle, ctr, sizeof(ctr));
+     n = off % AES_BLOCK_SIZE;
+     if (n) {
+         memset(skip, 0, n);
+         res = TEE_CipherUpdate(sess->op_handle, skip, n, skip, &n);
+         if (res != TEE_SUCCESS)
+             return res;
+     }
+ 
+     n = params[1].memref.size;
+     res = TEE_CipherUpdate(sess->op_handle, params[1].memref.buffer,
+                            params[1].memref.size, out, &n);
+     if (res != TEE_SUCCESS)
+         return res;
+     if (out_type == TEE_PARAM_TYPE_NONE)
+         params[1].memref.size = n;
+     else
+         params[2].memref.size = n;
+     return TEE_SUCCESS;
+ }
+ 
  /*----------------------------------------------------------
   * ACIPHER helper implementations
   *---------------------------------------------------------*/
@@ -425,55 +1135,2882 @@ return load_persistent_key(state);
      if (pt != exp || state->key == TEE_HANDLE_NULL)
          return TEE_ERROR_BAD_PARAMETERS;
  
-     void *inbuf = params[0].memref.buffer;
-     uint32_t in_len = params[0].memref.size;
-     void *sig = params[1].memref.buffer;
-     uint32_t sig_len = params[1].memref.size;
+     TEE_Result res = rsa_verify(state,
+                                 params[0].memref.buffer,
+                                 params[0].memref.size,
+                                 params[1].memref.buffer,
+                                 params[1].memref.size);
+     params[2].value.a = (res == TEE_SUCCESS) ? 1 : 0;
+     return TEE_SUCCESS;
+ }
+ 
+ /* Check sig against SHA-256(inbuf) with the persistent RSA key */
+ static TEE_Result rsa_verify(struct acipher *state, const void *inbuf,
+                              uint32_t in_len, const void *sig,
+                              uint32_t sig_len)
+ {
+     uint8_t digest[32];
+     uint32_t digest_len = sizeof(digest);
+     TEE_OperationHandle d_op;
+     TEE_AllocateOperation(&d_op, TEE_ALG_SHA256, TEE_MODE_DIGEST, 0);
+     TEE_DigestDoFinal(d_op, inbuf, in_len, digest, &digest_len);
+     TEE_FreeOperation(d_op);
+ 
+     TEE_ObjectInfo key_info;
+     TEE_GetObjectInfo1(state->key, &key_info);
+ 
+     TEE_OperationHandle op;
+     TEE_AllocateOperation(&op, TEE_ALG_RSASSA_PKCS1_V1_5_SHA256, TEE_MODE_VERIFY, key_info.keySize);
+     TEE_SetOperationKey(op, state->key);
+     TEE_Result res = TEE_AsymmetricVerifyDigest(op, NULL, 0, digest, digest_len, sig, sig_len);
+     TEE_FreeOperation(op);
+     return res;
+ }
+ 
+ static TEE_Result cmd_digest(struct acipher *state, uint32_t pt,
+                              TEE_Param params[TEE_NUM_PARAMS])
+ {
+    (void) state;
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_MEMREF_OUTPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+ 
+     void *inbuf = params[0].memref.buffer;
+     uint32_t in_len = params[0].memref.size;
+     void *out = params[1].memref.buffer;
+     uint32_t out_len = params[1].memref.size;
+ 
+     TEE_OperationHandle op;
+     TEE_AllocateOperation(&op, TEE_ALG_SHA256, TEE_MODE_DIGEST, 0);
+     TEE_DigestDoFinal(op, inbuf, in_len, out, &out_len);
+     params[1].memref.size = out_len;
+     TEE_FreeOperation(op);
+     return TEE_SUCCESS;
+ }
+ 
+ /*----------------------------------------------------------
+  * OCRAM PTA helpers
+  *---------------------------------------------------------*/
+ static void pta_close(TEE_TASessionHandle *sess)
+ {
+     if (*sess != TEE_HANDLE_NULL)
+         TEE_CloseTASession(*sess);
+     *sess = TEE_HANDLE_NULL;
+ }
+ 
+ static TEE_Result pta_open(TEE_TASessionHandle *sess, const TEE_UUID *uuid)
+ {
+     uint32_t err_orig = 0;
+     TEE_Result res;
+ 
+     res = TEE_OpenTASession(
+         uuid, 0,
+         TEE_PARAM_TYPES(
+             TEE_PARAM_TYPE_NONE,
+             TEE_PARAM_TYPE_NONE,
+             TEE_PARAM_TYPE_NONE,
+             TEE_PARAM_TYPE_NONE),
+         NULL, sess, &err_orig);
+     if (res != TEE_SUCCESS)
+         *sess = TEE_HANDLE_NULL;
+     return res;
+ }
+ 
+ /*
+  * Invoke a PTA command on a cached session, opening it on first use.
+  * The OCRAM PTAs live in the TEE core and cannot die, so a session once
+  * opened stays valid until TA_CloseSessionEntryPoint closes it.
+  */
+ static TEE_Result pta_invoke(TEE_TASessionHandle *sess,
+                              const TEE_UUID *uuid, uint32_t cmd,
+                              uint32_t pt, TEE_Param params[TEE_NUM_PARAMS])
+ {
+     uint32_t err_orig = 0;
+     TEE_Result res;
+     TEE_Time t0;
+     uint32_t ms;
+ 
+     TEE_GetSystemTime(&t0);
+     if (*sess == TEE_HANDLE_NULL) {
+         res = pta_open(sess, uuid);
+         if (res != TEE_SUCCESS)
+             return res;
+     }
+     res = TEE_InvokeTACommand(*sess, TEE_TIMEOUT_INFINITE,
+                               cmd, pt, params, &err_orig);
+     ms = stats_ms_since(&t0);
+     stats.pta_calls++;
+     stats.pta_total_ms += ms;
+     if (ms > stats.pta_max_ms)
+         stats.pta_max_ms = ms;
+     return res;
+ }
+ 
+ /*
+  * TEE_SUCCESS if the load (or, with read, the read) PTA implements its
+  * _AT command, TEE_ERROR_NOT_SUPPORTED if not. Probed with an empty
+  * buffer on first use; the answer is kept for the session.
+  */
+ static TEE_Result pta_need_at(struct ta_ctx *ctx, bool read)
+ {
+     TEE_TASessionHandle *sess = read ? &ctx->pta.read : &ctx->pta.load;
+     uint8_t *at = read ? &ctx->pta.read_at : &ctx->pta.load_at;
+     TEE_Param pt[4] = {0};
+     uint8_t none = 0;
+     TEE_Result res;
+ 
+     if (*at == PTA_AT_UNKNOWN) {
+         pt[0].memref.buffer = &none;
+         pt[0].memref.size   = 0;
+         pt[1].value.a       = 0;
+         res = pta_invoke(
+             sess, read ? &pta_ocram_read_uuid : &pta_ocram_load_uuid,
+             read ? OCRAM_READ_AT_CMD : OCRAM_LOAD_AT_CMD,
+             TEE_PARAM_TYPES(
+                 read ? TEE_PARAM_TYPE_MEMREF_OUTPUT :
+                        TEE_PARAM_TYPE_MEMREF_INPUT,
+                 TEE_PARAM_TYPE_VALUE_INPUT,
+                 TEE_PARAM_TYPE_NONE,
+                 TEE_PARAM_TYPE_NONE),
+             pt);
+         /* Not being able to reach the PTA at all says nothing yet */
+         if (*sess == TEE_HANDLE_NULL)
+             return res;
+         *at = res == TEE_SUCCESS ? PTA_AT_PRESENT : PTA_AT_MISSING;
+         if (*at == PTA_AT_MISSING)
+             DMSG("OCRAM %s PTA has no offset command: %#" PRIx32,
+                  read ? "read" : "load", res);
+     }
+     return *at == PTA_AT_PRESENT ? TEE_SUCCESS : TEE_ERROR_NOT_SUPPORTED;
+ }
+ 
+ /* Placing images anywhere in OCRAM: its size and both offset commands */
+ static TEE_Result ocram_need_window(struct ta_ctx *ctx)
+ {
+     TEE_Result res;
+ 
+     if (!CFG_OCRAM_SIZE)
+         return TEE_ERROR_NOT_SUPPORTED;
+     res = pta_need_at(ctx, false);
+     if (res == TEE_SUCCESS)
+         res = pta_need_at(ctx, true);
+     return res;
+ }
+ 
+ /*----------------------------------------------------------
+  * OCRAM streaming load helpers
+  *
+  * The plaintext never exists in full inside the TA: each ciphertext
+  * chunk is decrypted OCRAM_CHUNK_SIZE bytes at a time and pushed to the
+  * OCRAM PTA at a running offset, so the heap footprint does not depend
+  * on the model size.
+  *---------------------------------------------------------*/
+ /* Release the stream; block digests, like the trailer, stay readable */
+ static void stream_release(struct ocram_stream *st)
+ {
+     if (st->digest_op != TEE_HANDLE_NULL)
+         TEE_FreeOperation(st->digest_op);
+     if (st->block_op != TEE_HANDLE_NULL)
+         TEE_FreeOperation(st->block_op);
+     ta_free(st->buf);
+     ta_free(st->lz);
+     st->digest_op = TEE_HANDLE_NULL;
+     st->block_op = TEE_HANDLE_NULL;
+     st->cipher = TEE_HANDLE_NULL;
+     st->buf = NULL;
+     st->lz = NULL;
+     st->active = false;
+ }
+ 
+ /*
+  * Give up on the current stream. A verified or AEAD load leaves no
+  * unchecked plaintext behind, so what it wrote is wiped first.
+  */
+ static void stream_abort(struct ta_ctx *ctx)
+ {
+     struct ocram_stream *st = &ctx->stream;
+ 
+     if (st->active && st->aead)
+         stream_scrub(ctx, st->base, st->total);
+     else if (st->active && st->verify)
+         stream_scrub(ctx, st->base, st->offset);
+     stream_release(st);
+ }
+ 
+ /*
+  * Start a stream of total bytes to OCRAM at base. Chunks are decrypted
+  * with cipher, which stays owned by the caller, or with the session AES
+  * operation when cipher is TEE_HANDLE_NULL.
+  */
+ static TEE_Result stream_start(struct ta_ctx *ctx, uint32_t base,
+                                uint32_t total, uint32_t flags,
+                                TEE_OperationHandle cipher)
+ {
+     struct ocram_stream *st = &ctx->stream;
+     TEE_Result res;
+ 
+     if (!(flags & STREAM_FLAG_AEAD) && cipher == TEE_HANDLE_NULL &&
+         ctx->aes.op_handle == TEE_HANDLE_NULL)
+         return TEE_ERROR_BAD_STATE;
+     if ((flags & TA_OCRAM_LOAD_FLAG_VERIFY) &&
+         ctx->aci.key == TEE_HANDLE_NULL)
+         return TEE_ERROR_BAD_STATE;
+     /* The OCRAM size of a compressed image comes from its LZ header */
+     if (flags & TA_OCRAM_LOAD_FLAG_COMPRESSED) {
+         total = 0;
+         flags &= ~STREAM_FLAG_BLOCKS;
+     }
+     /* There is no OCRAM mapping, each piece goes to the load PTA */
+     if (flags & TA_OCRAM_LOAD_FLAG_DIRECT)
+         return TEE_ERROR_NOT_SUPPORTED;
+     res = pta_need_at(ctx, false);
+     if (res != TEE_SUCCESS)
+         return res;
+ 
+     /* The new image overwrites whatever an unfinished load wrote */
+     stream_abort(ctx);
+     if (ctx->merkle.active)
+         merkle_abort(ctx);
+     ta_free(st->blocks);
+     st->blocks = NULL;
+     st->base = base;
+     st->total = total;
+     st->offset = 0;
+     st->trailer_len = 0;
+     st->aead = flags & STREAM_FLAG_AEAD;
+     st->verify = flags & TA_OCRAM_LOAD_FLAG_VERIFY;
+     st->cipher = cipher;
+ 
+     /* Whatever was resident there is about to be overwritten */
+     ocram_dirty(ctx, base, total);
+ 
+     st->buf = ta_malloc(OCRAM_CHUNK_SIZE, 0);
+     if (!st->buf)
+         return TEE_ERROR_OUT_OF_MEMORY;
+ 
+     if (flags & TA_OCRAM_LOAD_FLAG_COMPRESSED) {
+         st->lz = ta_malloc(sizeof(*st->lz), 0);
+         if (!st->lz) {
+             res = TEE_ERROR_OUT_OF_MEMORY;
+             goto err;
+         }
+         st->lz->state = LZ_HDR;
+         st->lz->need = sizeof(struct ta_ocram_lz_hdr);
+         st->lz->have = 0;
+     }
+ 
+     res = TEE_AllocateOperation(&st->digest_op, TEE_ALG_SHA256,
+                                 TEE_MODE_DIGEST, 0);
+     if (res != TEE_SUCCESS) {
+         st->digest_op = TEE_HANDLE_NULL;
+         goto err;
+     }
+ 
+     if ((flags & STREAM_FLAG_BLOCKS) && total) {
+         st->blocks = ta_malloc(ROUNDUP(total, TA_OCRAM_DELTA_BLOCK) /
+                                 TA_OCRAM_DELTA_BLOCK * SHA256_DIGEST_SIZE, 0);
+         if (!st->blocks) {
+             res = TEE_ERROR_OUT_OF_MEMORY;
+             goto err;
+         }
+         res = TEE_AllocateOperation(&st->block_op, TEE_ALG_SHA256,
+                                     TEE_MODE_DIGEST, 0);
+         if (res != TEE_SUCCESS) {
+             st->block_op = TEE_HANDLE_NULL;
+             goto err;
+         }
+     }
+ 
+     st->active = true;
+     return TEE_SUCCESS;
+ err:
+     stream_release(st);
+     return res;
+ }
+ 
+ /*
+  * Account for n plaintext bytes about to land at st->offset: the image
+  * digest and, if tracked, the digest of each TA_OCRAM_DELTA_BLOCK.
+  */
+ static void stream_hash(struct ocram_stream *st, const uint8_t *p,
+                         uint32_t n)
+ {
+     uint32_t off = st->offset;
+ 
+     if (st->digest_op != TEE_HANDLE_NULL)
+         TEE_DigestUpdate(st->digest_op, p, n);
+     while (st->block_op != TEE_HANDLE_NULL && n) {
+         uint32_t k = MIN(n, TA_OCRAM_DELTA_BLOCK -
+                             off % TA_OCRAM_DELTA_BLOCK);
+         uint32_t len = SHA256_DIGEST_SIZE;
+ 
+         TEE_DigestUpdate(st->block_op, p, k);
+         off += k;
+         p += k;
+         n -= k;
+         if (off % TA_OCRAM_DELTA_BLOCK == 0 || off == st->total)
+             TEE_DigestDoFinal(st->block_op, NULL, 0,
+                               st->blocks + (off - 1) /
+                               TA_OCRAM_DELTA_BLOCK * SHA256_DIGEST_SIZE,
+                               &len);
+     }
+ }
+ 
+ /* Hand one decrypted piece to the stream: OCRAM first, then trailer */
+ static TEE_Result stream_put(struct ta_ctx *ctx, uint8_t *plain,
+                              uint32_t len)
+ {
+     struct ocram_stream *st = &ctx->stream;
+     uint32_t n = MIN(len, st->total - st->offset);
+     TEE_Result res;
+ 
+     if (n) {
+         TEE_Param pt[4] = {0};
+ 
+         pt[0].memref.buffer = plain;
+         pt[0].memref.size   = n;
+         pt[1].value.a       = st->base + st->offset;
+         res = pta_invoke(
+             &ctx->pta.load, &pta_ocram_load_uuid,
+             OCRAM_LOAD_AT_CMD,
+             TEE_PARAM_TYPES(
+                 TEE_PARAM_TYPE_MEMREF_INPUT,
+                 TEE_PARAM_TYPE_VALUE_INPUT,
+                 TEE_PARAM_TYPE_NONE,
+                 TEE_PARAM_TYPE_NONE),
+             pt);
+         if (res != TEE_SUCCESS)
+             return res;
+         stream_hash(st, plain, n);
+         st->offset += n;
+     }
+ 
+     if (len - n > sizeof(st->trailer) - st->trailer_len)
+         return TEE_ERROR_OVERFLOW;
+     TEE_MemMove(st->trailer + st->trailer_len, plain + n, len - n);
+     st->trailer_len += len - n;
+     return TEE_SUCCESS;
+ }
+ 
+ /*
+  * Decode one LZ4 block of slen bytes into dst, which has room for dlen.
+  * Returns the decoded size, or -1 if the block is malformed or would
+  * read or write out of bounds.
+  */
+ static int lz_decode(const uint8_t *src, uint32_t slen, uint8_t *dst,
+                      uint32_t dlen)
+ {
+     const uint8_t *ip = src, *iend = src + slen;
+     uint8_t *op = dst, *oend = dst + dlen;
+ 
+     while (ip < iend) {
+         uint32_t token = *ip++;
+         uint32_t len = token >> 4;
+         uint32_t off;
+         const uint8_t *m;
+ 
+         if (len == 15) {
+             uint8_t b;
+ 
+             do {
+                 if (ip >= iend)
+                     return -1;
+                 b = *ip++;
+                 len += b;
+             } while (b == 255);
+         }
+         if (len > (uint32_t)(iend - ip) || len > (uint32_t)(oend - op))
+             return -1;
+         TEE_MemMove(op, ip, len);
+         op += len;
+         ip += len;
+         /* The last sequence is literals only */
+         if (ip == iend)
+             break;
+ 
+         if (iend - ip < 2)
+             return -1;
+         off = ip[0] | (uint32_t)ip[1] << 8;
+         ip += 2;
+         if (!off || off > (uint32_t)(op - dst))
+             return -1;
+         len = token & 15;
+         if (len == 15) {
+             uint8_t b;
+ 
+             do {
+                 if (ip >= iend)
+                     return -1;
+                 b = *ip++;
+                 len += b;
+             } while (b == 255);
+         }
+         len += 4;
+         if (len > (uint32_t)(oend - op))
+             return -1;
+         /* Matches may overlap their own output, copy bytewise */
+         for (m = op - off; len; len--)
+             *op++ = *m++;
+     }
+     return op - dst;
+ }
+ 
+ /* A complete block is in lz->in: decode it to OCRAM */
+ static TEE_Result lz_block(struct ta_ctx *ctx)
+ {
+     struct ocram_stream *st = &ctx->stream;
+     struct ocram_lz *lz = st->lz;
+     uint32_t raw = lz->blk.raw;
+ 
+     if (!lz->blk.comp)
+         return stream_put(ctx, lz->in, raw);
+ 
+     if (lz_decode(lz->in, lz->blk.comp, lz->out, raw) != (int)raw)
+         return TEE_ERROR_BAD_FORMAT;
+     return stream_put(ctx, lz->out, raw);
+ }
+ 
+ /* Collect decrypted LZ stream bytes; what follows the stream is trailer */
+ static TEE_Result lz_feed(struct ta_ctx *ctx, uint8_t *plain, uint32_t len)
+ {
+     struct ocram_stream *st = &ctx->stream;
+     struct ocram_lz *lz = st->lz;
+     struct ta_ocram_lz_hdr hdr;
+     TEE_Result res;
+ 
+     while (len) {
+         uint32_t k;
+ 
+         if (lz->state == LZ_DONE)
+             return stream_put(ctx, plain, len);
+ 
+         k = MIN(len, lz->need - lz->have);
+         TEE_MemMove(lz->in + lz->have, plain, k);
+         lz->have += k;
+         plain += k;
+         len -= k;
+         if (lz->have < lz->need)
+             break;
+         lz->have = 0;
+ 
+         switch (lz->state) {
+         case LZ_HDR:
+             TEE_MemMove(&hdr, lz->in, sizeof(hdr));
+             if (hdr.magic != TA_OCRAM_LZ_MAGIC || !hdr.raw_size)
+                 return TEE_ERROR_BAD_FORMAT;
+             st->total = hdr.raw_size;
+             ocram_dirty(ctx, st->base, st->total);
+             lz->state = LZ_BLOCK_HDR;
+             lz->need = sizeof(lz->blk);
+             break;
+         case LZ_BLOCK_HDR:
+             TEE_MemMove(&lz->blk, lz->in, sizeof(lz->blk));
+             if (!lz->blk.raw || lz->blk.raw > TA_OCRAM_LZ_BLOCK ||
+                 lz->blk.raw > st->total - st->offset ||
+                 lz->blk.comp > TA_OCRAM_LZ_BLOCK)
+                 return TEE_ERROR_BAD_FORMAT;
+             lz->state = LZ_BLOCK;
+             lz->need = lz->blk.comp ? lz->blk.comp : lz->blk.raw;
+             break;
+         case LZ_BLOCK:
+             res = lz_block(ctx);
+             if (res != TEE_SUCCESS)
+                 return res;
+             lz->state = st->offset == st->total ? LZ_DONE : LZ_BLOCK_HDR;
+             lz->need = sizeof(lz->blk);
+             break;
+         default:
+             return TEE_ERROR_BAD_STATE;
+         }
+     }
+     return TEE_SUCCESS;
+ }
+ 
+ /* Route decrypted bytes through the decompressor when there is one */
+ static TEE_Result stream_out(struct ta_ctx *ctx, uint8_t *plain,
+                              uint32_t len)
+ {
+     if (ctx->stream.lz)
+         return lz_feed(ctx, plain, len);
+     return stream_put(ctx, plain, len);
+ }
+ 
+ /* The operation decrypting the stream; the session one can change */
+ static TEE_OperationHandle stream_cipher(struct ta_ctx *ctx)
+ {
+     if (ctx->stream.cipher != TEE_HANDLE_NULL)
+         return ctx->stream.cipher;
+     return ctx->aes.op_handle;
+ }
+ 
+ static TEE_Result stream_feed(struct ta_ctx *ctx, const uint8_t *in,
+                               uint32_t len)
+ {
+     struct ocram_stream *st = &ctx->stream;
+     TEE_Result res;
+ 
+     if (!st->active || st->aead)
+         return TEE_ERROR_BAD_STATE;
+ 
+     while (len) {
+         uint32_t n = MIN(len, (uint32_t)OCRAM_CHUNK_SIZE);
+         uint32_t plain_sz = OCRAM_CHUNK_SIZE;
+ 
+         res = TEE_CipherUpdate(stream_cipher(ctx), in, n,
+                                st->buf, &plain_sz);
+         if (res != TEE_SUCCESS)
+             return res;
+         res = stream_out(ctx, st->buf, plain_sz);
+         if (res != TEE_SUCCESS)
+             return res;
+         in  += n;
+         len -= n;
+     }
+     return TEE_SUCCESS;
+ }
+ 
+ static TEE_Result cmd_map_memory(struct ta_ctx *ctx, uint32_t pt,
+                                  TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_VALUE_OUTPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+ 
+     (void)ctx;
+     (void)params;
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+ 
+     /* A user TA has no way to map OCRAM, all access goes through the PTAs */
+     return TEE_ERROR_NOT_SUPPORTED;
+ }
+ 
+ static TEE_Result cmd_load_begin(struct ta_ctx *ctx, uint32_t pt,
+                                  TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+ 
+     return stream_start(ctx, 0, params[0].value.a, params[0].value.b,
+                         TEE_HANDLE_NULL);
+ }
+ 
+ static TEE_Result cmd_load_chunk(struct ta_ctx *ctx, uint32_t pt,
+                                  TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+     TEE_Result res;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+ 
+     res = stream_feed(ctx, params[0].memref.buffer, params[0].memref.size);
+     if (res != TEE_SUCCESS)
+         stream_abort(ctx);
+     return res;
+ }
+ 
+ /*
+  * Complete the stream: flush the cipher, check that everything announced
+  * reached OCRAM and compute the digest of the loaded data. The stream is
+  * left for the caller to read the trailer, base and size from and then
+  * stream_release(), whatever the outcome.
+  */
+ static TEE_Result stream_finish(struct ta_ctx *ctx, void *digest,
+                                 uint32_t *digest_len)
+ {
+     struct ocram_stream *st = &ctx->stream;
+     uint32_t plain_sz = OCRAM_CHUNK_SIZE;
+     TEE_Result res;
+ 
+     if (!st->active || st->aead)
+         return TEE_ERROR_BAD_STATE;
+     if (*digest_len < SHA256_DIGEST_SIZE)
+         return TEE_ERROR_SHORT_BUFFER;
+ 
+     /* Flush a partial last block still buffered by the operation */
+     res = TEE_CipherDoFinal(stream_cipher(ctx), NULL, 0,
+                             st->buf, &plain_sz);
+     if (res != TEE_SUCCESS)
+         return res;
+     res = stream_out(ctx, st->buf, plain_sz);
+     if (res != TEE_SUCCESS)
+         return res;
+ 
+     if (st->offset != st->total || (st->lz && st->lz->state != LZ_DONE)) {
+         EMSG("Short OCRAM load: %" PRIu32 " of %" PRIu32 " bytes",
+              st->offset, st->total);
+         return TEE_ERROR_BAD_STATE;
+     }
+ 
+     return TEE_DigestDoFinal(st->digest_op, NULL, 0, digest, digest_len);
+ }
+ 
+ /* Overwrite len bytes of OCRAM at base with zeroes */
+ static TEE_Result stream_scrub(struct ta_ctx *ctx, uint32_t base,
+                                uint32_t len)
+ {
+     TEE_Param pt[4] = {0};
+     uint8_t *zero = NULL;
+     uint32_t off = 0;
+     TEE_Result res = TEE_SUCCESS;
+ 
+     if (!len)
+         return TEE_SUCCESS;
+ 
+     /* A stock PTA can still clear the start of OCRAM in one command 0 */
+     if (pta_need_at(ctx, false) != TEE_SUCCESS) {
+         if (base)
+             return TEE_ERROR_NOT_SUPPORTED;
+         zero = ta_malloc(len, TEE_MALLOC_FILL_ZERO);
+         if (!zero)
+             return TEE_ERROR_OUT_OF_MEMORY;
+         pt[0].memref.buffer = zero;
+         pt[0].memref.size   = len;
+         res = pta_invoke(
+             &ctx->pta.load, &pta_ocram_load_uuid,
+             OCRAM_LOAD_CMD,
+             TEE_PARAM_TYPES(
+                 TEE_PARAM_TYPE_MEMREF_INPUT,
+                 TEE_PARAM_TYPE_NONE,
+                 TEE_PARAM_TYPE_NONE,
+                 TEE_PARAM_TYPE_NONE),
+             pt);
+         ta_free(zero);
+         return res;
+     }
+ 
+     zero = ta_malloc(OCRAM_CHUNK_SIZE, TEE_MALLOC_FILL_ZERO);
+     if (!zero)
+         return TEE_ERROR_OUT_OF_MEMORY;
+     while (off < len && res == TEE_SUCCESS) {
+         pt[0].memref.buffer = zero;
+         pt[0].memref.size   = MIN(len - off, (uint32_t)OCRAM_CHUNK_SIZE);
+         pt[1].value.a       = base + off;
+         res = pta_invoke(
+             &ctx->pta.load, &pta_ocram_load_uuid,
+             OCRAM_LOAD_AT_CMD,
+             TEE_PARAM_TYPES(
+                 TEE_PARAM_TYPE_MEMREF_INPUT,
+                 TEE_PARAM_TYPE_VALUE_INPUT,
+                 TEE_PARAM_TYPE_NONE,
+                 TEE_PARAM_TYPE_NONE),
+             pt);
+         off += pt[0].memref.size;
+     }
+     ta_free(zero);
+     return res;
+ }
+ 
+ /*
+  * Legacy LOAD on a load PTA without OCRAM_LOAD_AT_CMD: decrypt the whole
+  * buffer with the session AES operation, then write it to the start of
+  * OCRAM in a single command 0.
+  */
+ static TEE_Result load_whole(struct ta_ctx *ctx, const void *enc,
+                              uint32_t len)
+ {
+     TEE_Param pt[4] = {0};
+     uint32_t plain_sz = len;
+     uint8_t *plain;
+     TEE_Result res;
+ 
+     if (ctx->aes.op_handle == TEE_HANDLE_NULL)
+         return TEE_ERROR_BAD_STATE;
+     plain = ta_malloc(len ? len : 1, 0);
+     if (!plain)
+         return TEE_ERROR_OUT_OF_MEMORY;
+     res = TEE_CipherUpdate(ctx->aes.op_handle, enc, len, plain, &plain_sz);
+     if (res == TEE_SUCCESS) {
+         ocram_dirty(ctx, 0, plain_sz);
+         pt[0].memref.buffer = plain;
+         pt[0].memref.size   = plain_sz;
+         res = pta_invoke(
+             &ctx->pta.load, &pta_ocram_load_uuid,
+             OCRAM_LOAD_CMD,
+             TEE_PARAM_TYPES(
+                 TEE_PARAM_TYPE_MEMREF_INPUT,
+                 TEE_PARAM_TYPE_NONE,
+                 TEE_PARAM_TYPE_NONE,
+                 TEE_PARAM_TYPE_NONE),
+             pt);
+     }
+     TEE_MemFill(plain, 0, len);
+     ta_free(plain);
+     return res;
+ }
+ 
+ /*
+  * stream_finish() with digest, trailer and loaded size as TA params.
+  * A TA_OCRAM_LOAD_FLAG_VERIFY stream must end with the signature of its
+  * digest, else what it wrote is wiped; once verified, an image at
+  * offset 0 is recorded as the resident one.
+  */
+ static TEE_Result stream_finish_params(struct ta_ctx *ctx,
+                                        TEE_Param *digest,
+                                        TEE_Param *trailer,
+                                        TEE_Param *loaded)
+ {
+     struct ocram_stream *st = &ctx->stream;
+     uint8_t hash[SHA256_DIGEST_SIZE];
+     uint32_t hash_len = sizeof(hash);
+     bool verify = st->verify;
+     TEE_Result res;
+ 
+     if (!st->active || st->aead)
+         return TEE_ERROR_BAD_STATE;
+     /* Let the client retry with a larger buffer, the stream is kept */
+     if (digest->memref.size < SHA256_DIGEST_SIZE) {
+         digest->memref.size = SHA256_DIGEST_SIZE;
+         return TEE_ERROR_SHORT_BUFFER;
+     }
+ 
+     res = stream_finish(ctx, hash, &hash_len);
+     if (res == TEE_SUCCESS && verify) {
+         res = rsa_verify(&ctx->aci, hash, hash_len,
+                          st->trailer, st->trailer_len);
+         if (res != TEE_SUCCESS) {
+             EMSG("Model signature check failed: %#" PRIx32, res);
+             res = TEE_ERROR_SIGNATURE_INVALID;
+         }
+     }
+     if (res != TEE_SUCCESS) {
+         if (verify)
+             stream_scrub(ctx, st->base, st->offset);
+         goto out;
+     }
+     if (verify && !st->base)
+         resident_set(ctx, hash, st->offset);
+     if (trailer->memref.size < st->trailer_len) {
+         trailer->memref.size = st->trailer_len;
+         res = TEE_ERROR_SHORT_BUFFER;
+         goto out;
+     }
+ 
+     /* Fill the outputs while the stream still describes this load */
+     TEE_MemMove(digest->memref.buffer, hash, hash_len);
+     digest->memref.size = hash_len;
+     TEE_MemMove(trailer->memref.buffer, st->trailer, st->trailer_len);
+     trailer->memref.size = st->trailer_len;
+     loaded->value.a = st->offset;
+ out:
+     stream_release(st);
+     return res;
+ }
+ 
+ static TEE_Result cmd_load_end(struct ta_ctx *ctx, uint32_t pt,
+                                TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_OUTPUT,
+         TEE_PARAM_TYPE_MEMREF_OUTPUT,
+         TEE_PARAM_TYPE_VALUE_OUTPUT,
+         TEE_PARAM_TYPE_NONE);
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+ 
+     return stream_finish_params(ctx, &params[0], &params[1], &params[2]);
+ }
+ 
+ /*
+  * Stream the model stored by TA_OCRAM_LOAD_CMD_STORE from secure storage
+  * into OCRAM, OCRAM_CHUNK_SIZE bytes of ciphertext at a time.
+  */
+ static TEE_Result cmd_load_from_storage(struct ta_ctx *ctx, uint32_t pt,
+                                         TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_MEMREF_OUTPUT,
+         TEE_PARAM_TYPE_MEMREF_OUTPUT,
+         TEE_PARAM_TYPE_VALUE_OUTPUT);
+     TEE_ObjectHandle obj = TEE_HANDLE_NULL;
+     TEE_ObjectInfo info;
+     uint8_t *enc = NULL;
+     uint32_t trailer_sz;
+     uint32_t n;
+     TEE_Result res;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     trailer_sz = params[0].value.a;
+ 
+     res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE,
+                                    MODEL_DATA_OBJ_ID,
+                                    strlen(MODEL_DATA_OBJ_ID),
+                                    TEE_DATA_FLAG_ACCESS_READ,
+                                    &obj);
+     if (res != TEE_SUCCESS) {
+         EMSG("No stored model: %#" PRIx32, res);
+         return res;
+     }
+     res = TEE_GetObjectInfo1(obj, &info);
+     if (res != TEE_SUCCESS)
+         goto out;
+     if (info.dataSize < trailer_sz) {
+         res = TEE_ERROR_BAD_FORMAT;
+         goto out;
+     }
+ 
+     enc = ta_malloc(OCRAM_CHUNK_SIZE, 0);
+     if (!enc) {
+         res = TEE_ERROR_OUT_OF_MEMORY;
+         goto out;
+     }
+ 
+     res = stream_start(ctx, 0, info.dataSize - trailer_sz,
+                        params[0].value.b, TEE_HANDLE_NULL);
+     if (res != TEE_SUCCESS)
+         goto out;
+ 
+     do {
+         res = TEE_ReadObjectData(obj, enc, OCRAM_CHUNK_SIZE, &n);
+         if (res == TEE_SUCCESS && n)
+             res = stream_feed(ctx, enc, n);
+     } while (res == TEE_SUCCESS && n == OCRAM_CHUNK_SIZE);
+ 
+     if (res == TEE_SUCCESS) {
+         res = stream_finish_params(ctx, &params[1], &params[2], &params[3]);
+     } else {
+         stream_abort(ctx);
+     }
+ out:
+     ta_free(enc);
+     TEE_CloseObject(obj);
+     return res;
+ }
+ 
+ /*----------------------------------------------------------
+  * OCRAM access at an offset
+  *---------------------------------------------------------*/
+ 
+ /* Copy len bytes of OCRAM at off via the read PTA */
+ static TEE_Result ocram_read(struct ta_ctx *ctx, uint32_t off, void *buf,
+                              uint32_t len)
+ {
+     TEE_Param pt[4] = {0};
+     TEE_Result res;
+ 
+     res = pta_need_at(ctx, true);
+     if (res != TEE_SUCCESS)
+         return res;
+     while (len) {
+         pt[0].memref.buffer = buf;
+         pt[0].memref.size   = len;
+         pt[1].value.a       = off;
+         res = pta_invoke(
+             &ctx->pta.read, &pta_ocram_read_uuid,
+             OCRAM_READ_AT_CMD,
+             TEE_PARAM_TYPES(
+                 TEE_PARAM_TYPE_MEMREF_OUTPUT,
+                 TEE_PARAM_TYPE_VALUE_INPUT,
+                 TEE_PARAM_TYPE_NONE,
+                 TEE_PARAM_TYPE_NONE),
+             pt);
+         if (res != TEE_SUCCESS)
+             return res;
+         /* The PTA may return less than asked for */
+         if (!pt[0].memref.size || pt[0].memref.size > len)
+             return TEE_ERROR_GENERIC;
+         buf = (uint8_t *)buf + pt[0].memref.size;
+         off += pt[0].memref.size;
+         len -= pt[0].memref.size;
+     }
+     return TEE_SUCCESS;
+ }
+ 
+ /* Write len bytes at OCRAM offset off via the load PTA */
+ static TEE_Result ocram_write(struct ta_ctx *ctx, uint32_t off,
+                               const void *buf, uint32_t len)
+ {
+     TEE_Param pt[4] = {0};
+     TEE_Result res;
+ 
+     res = pta_need_at(ctx, false);
+     if (res != TEE_SUCCESS)
+         return res;
+     pt[0].memref.buffer = (void *)buf;
+     pt[0].memref.size   = len;
+     pt[1].value.a       = off;
+     return pta_invoke(
+         &ctx->pta.load, &pta_ocram_load_uuid,
+         OCRAM_LOAD_AT_CMD,
+         TEE_PARAM_TYPES(
+             TEE_PARAM_TYPE_MEMREF_INPUT,
+             TEE_PARAM_TYPE_VALUE_INPUT,
+             TEE_PARAM_TYPE_NONE,
+             TEE_PARAM_TYPE_NONE),
+         pt);
+ }
+ 
+ static TEE_Result cmd_read_at(struct ta_ctx *ctx, uint32_t pt,
+                               TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_OUTPUT,
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+     TEE_Result res;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     if (params[0].memref.size < params[1].value.b) {
+         params[0].memref.size = params[1].value.b;
+         return TEE_ERROR_SHORT_BUFFER;
+     }
+ 
+     res = ocram_read(ctx, params[1].value.a, params[0].memref.buffer,
+                      params[1].value.b);
+     if (res == TEE_SUCCESS)
+         params[0].memref.size = params[1].value.b;
+     return res;
+ }
+ 
+ /* SHA-256 of OCRAM [off, off + len) */
+ static TEE_Result ocram_hash(struct ta_ctx *ctx, uint32_t off, uint32_t len,
+                              uint8_t *digest)
+ {
+     TEE_OperationHandle op = TEE_HANDLE_NULL;
+     uint32_t digest_len = SHA256_DIGEST_SIZE;
+     uint8_t *buf = NULL;
+     TEE_Result res;
+ 
+     res = TEE_AllocateOperation(&op, TEE_ALG_SHA256, TEE_MODE_DIGEST, 0);
+     if (res != TEE_SUCCESS)
+         return res;
+ 
+     buf = ta_malloc(OCRAM_CHUNK_SIZE, 0);
+     if (!buf) {
+         res = TEE_ERROR_OUT_OF_MEMORY;
+         goto out;
+     }
+     while (len && res == TEE_SUCCESS) {
+         uint32_t n = MIN(len, (uint32_t)OCRAM_CHUNK_SIZE);
+ 
+         res = ocram_read(ctx, off, buf, n);
+         if (res == TEE_SUCCESS)
+             TEE_DigestUpdate(op, buf, n);
+         off += n;
+         len -= n;
+     }
+     if (res == TEE_SUCCESS)
+         res = TEE_DigestDoFinal(op, NULL, 0, digest, &digest_len);
+ out:
+     ta_free(buf);
+     TEE_FreeOperation(op);
+     return res;
+ }
+ 
+ static TEE_Result cmd_read_hash(struct ta_ctx *ctx, uint32_t pt,
+                                 TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_MEMREF_OUTPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+     TEE_Result res;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     if (params[1].memref.size < SHA256_DIGEST_SIZE) {
+         params[1].memref.size = SHA256_DIGEST_SIZE;
+         return TEE_ERROR_SHORT_BUFFER;
+     }
+ 
+     res = ocram_hash(ctx, params[0].value.a, params[0].value.b,
+                      params[1].memref.buffer);
+     if (res == TEE_SUCCESS)
+         params[1].memref.size = SHA256_DIGEST_SIZE;
+     return res;
+ }
+ 
+ /*----------------------------------------------------------
+  * OCRAM residency record
+  *
+  * Remembers which verified image OCRAM holds so an identical load can be
+  * skipped. The record lives in secure storage because each client
+  * session gets a fresh TA instance. Before it is trusted, the system
+  * time must not have gone backwards since the load (a restart clears
+  * OCRAM) and the whole image range must still hash to the value taken
+  * when it was recorded. The digest a load reports need not be that
+  * hash, so both are kept.
+  *---------------------------------------------------------*/
+ static TEE_Result resident_read(struct ocram_resident *r)
+ {
+     TEE_ObjectHandle obj = TEE_HANDLE_NULL;
+     uint32_t n = 0;
+     TEE_Result res;
+ 
+     res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE,
+                                    RESIDENT_OBJ_ID,
+                                    strlen(RESIDENT_OBJ_ID),
+                                    TEE_DATA_FLAG_ACCESS_READ,
+                                    &obj);
+     if (res != TEE_SUCCESS)
+         return res;
+     res = TEE_ReadObjectData(obj, r, sizeof(*r), &n);
+     TEE_CloseObject(obj);
+     if (res == TEE_SUCCESS && n != sizeof(*r))
+         res = TEE_ERROR_CORRUPT_OBJECT;
+     return res;
+ }
+ 
+ static TEE_Result resident_write(const struct ocram_resident *r)
+ {
+     TEE_ObjectHandle obj = TEE_HANDLE_NULL;
+     TEE_Result res;
+ 
+     res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE,
+                                      RESIDENT_OBJ_ID,
+                                      strlen(RESIDENT_OBJ_ID),
+                                      TEE_DATA_FLAG_ACCESS_WRITE |
+                                      TEE_DATA_FLAG_OVERWRITE,
+                                      TEE_HANDLE_NULL,
+                                      r, sizeof(*r),
+                                      &obj);
+     if (res == TEE_SUCCESS)
+         TEE_CloseObject(obj);
+     else
+         EMSG("Cannot persist OCRAM residency: %#" PRIx32, res);
+     return res;
+ }
+ 
+ /*
+  * Per TA_OCRAM_DELTA_BLOCK digests of the resident image, stored after
+  * the digest of the image they belong to.
+  */
+ static TEE_Result blocks_write(const uint8_t *digest, const uint8_t *blocks,
+                                uint32_t nblocks)
+ {
+     TEE_ObjectHandle obj = TEE_HANDLE_NULL;
+     TEE_Result res;
+ 
+     res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE,
+                                      BLOCKS_OBJ_ID,
+                                      strlen(BLOCKS_OBJ_ID),
+                                      TEE_DATA_FLAG_ACCESS_WRITE |
+                                      TEE_DATA_FLAG_OVERWRITE,
+                                      TEE_HANDLE_NULL,
+                                      digest, SHA256_DIGEST_SIZE,
+                                      &obj);
+     if (res != TEE_SUCCESS)
+         return res;
+     res = TEE_WriteObjectData(obj, blocks, nblocks * SHA256_DIGEST_SIZE);
+     TEE_CloseObject(obj);
+     return res;
+ }
+ 
+ /* Read nblocks digests stored for the image with the given digest */
+ static TEE_Result blocks_read(const uint8_t *digest, uint8_t *blocks,
+                               uint32_t nblocks)
+ {
+     TEE_ObjectHandle obj = TEE_HANDLE_NULL;
+     uint8_t owner[SHA256_DIGEST_SIZE];
+     uint32_t n = 0;
+     TEE_Result res;
+ 
+     res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE,
+                                    BLOCKS_OBJ_ID,
+                                    strlen(BLOCKS_OBJ_ID),
+                                    TEE_DATA_FLAG_ACCESS_READ,
+                                    &obj);
+     if (res != TEE_SUCCESS)
+         return res;
+     res = TEE_ReadObjectData(obj, owner, sizeof(owner), &n);
+     if (res == TEE_SUCCESS &&
+         (n != sizeof(owner) || TEE_MemCompare(owner, digest, n)))
+         res = TEE_ERROR_ITEM_NOT_FOUND;
+     if (res == TEE_SUCCESS)
+         res = TEE_ReadObjectData(obj, blocks,
+                                  nblocks * SHA256_DIGEST_SIZE, &n);
+     if (res == TEE_SUCCESS && n != nblocks * SHA256_DIGEST_SIZE)
+         res = TEE_ERROR_CORRUPT_OBJECT;
+     TEE_CloseObject(obj);
+     return res;
+ }
+ 
+ /* Mark the record as describing nothing, bumping the generation */
+ static void resident_drop(struct ocram_resident *r)
+ {
+     r->generation++;
+     r->valid = 0;
+     resident_write(r);
+ }
+ 
+ /* True when the system time went backwards since t, i.e. a restart */
+ static bool restarted_since(const TEE_Time *t)
+ {
+     TEE_Time now;
+ 
+     TEE_GetSystemTime(&now);
+     return now.seconds < t->seconds ||
+            (now.seconds == t->seconds && now.millis < t->millis);
+ }
+ 
+ /* Record a just verified image as the OCRAM content */
+ static void resident_set(struct ta_ctx *ctx, const uint8_t *digest,
+                          uint32_t size)
+ {
+     struct ocram_resident r;
+ 
+     if (resident_read(&r) != TEE_SUCCESS)
+         TEE_MemFill(&r, 0, sizeof(r));
+     if (ocram_hash(ctx, 0, size, r.content) != TEE_SUCCESS)
+         return;
+     r.generation++;
+     r.valid = 1;
+     r.size = size;
+     TEE_MemMove(r.digest, digest, sizeof(r.digest));
+     TEE_GetSystemTime(&r.loaded_at);
+     if (resident_write(&r) == TEE_SUCCESS && ctx->stream.blocks)
+         blocks_write(digest, ctx->stream.blocks,
+                      ROUNDUP(size, TA_OCRAM_DELTA_BLOCK) /
+                      TA_OCRAM_DELTA_BLOCK);
+ }
+ 
+ /* Fetch the record if it still describes what is in OCRAM */
+ static TEE_Result resident_get(struct ta_ctx *ctx, struct ocram_resident *r)
+ {
+     uint8_t content[SHA256_DIGEST_SIZE];
+     TEE_Result res;
+ 
+     res = resident_read(r);
+     if (res != TEE_SUCCESS || !r->valid)
+         return TEE_ERROR_ITEM_NOT_FOUND;
+ 
+     if (restarted_since(&r->loaded_at)) {
+         DMSG("System restarted since OCRAM load");
+         resident_drop(r);
+         return TEE_ERROR_ITEM_NOT_FOUND;
+     }
+ 
+     res = ocram_hash(ctx, 0, r->size, content);
+     if (res != TEE_SUCCESS)
+         return res;
+     if (TEE_MemCompare(content, r->content, sizeof(content))) {
+         DMSG("OCRAM content changed since load");
+         resident_drop(r);
+         return TEE_ERROR_ITEM_NOT_FOUND;
+     }
+     return TEE_SUCCESS;
+ }
+ 
+ static TEE_Result cmd_resident(struct ta_ctx *ctx, uint32_t pt,
+                                TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_OUTPUT,
+         TEE_PARAM_TYPE_VALUE_OUTPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+     struct ocram_resident r;
+     TEE_Result res;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     if (params[0].memref.size < SHA256_DIGEST_SIZE)
+         return TEE_ERROR_SHORT_BUFFER;
+ 
+     res = resident_get(ctx, &r);
+     if (res != TEE_SUCCESS)
+         return res;
+     TEE_MemMove(params[0].memref.buffer, r.digest, sizeof(r.digest));
+     params[0].memref.size = sizeof(r.digest);
+     params[1].value.a = r.size;
+     params[1].value.b = r.generation;
+     return TEE_SUCCESS;
+ }
+ 
+ /*
+  * The expected digest of TA_OCRAM_LOAD_FLAG_IF_CHANGED comes from the
+  * client. Before it may skip a load, decrypt only the signature at the
+  * end of 'data || signature' and check that it signs that digest, so a
+  * resident image is only kept for the image it was actually loaded
+  * from. The checked digest is copied to digest.
+  */
+ static TEE_Result expect_signed(struct ta_ctx *ctx, const uint8_t *enc,
+                                 uint32_t enc_sz, const uint8_t *key_iv,
+                                 uint32_t key_sz, const uint8_t *expect,
+                                 uint8_t *digest)
+ {
+     TEE_OperationHandle op = TEE_HANDLE_NULL;
+     uint8_t sig[TA_OCRAM_LOAD_TRAILER_MAX];
+     uint8_t skip[AES_BLOCK_SIZE];
+     uint8_t ctr[AES_BLOCK_SIZE];
+     TEE_ObjectInfo key_info;
+     uint32_t sig_sz, data_sz, n;
+     TEE_Result res;
+ 
+     if (ctx->aci.key == TEE_HANDLE_NULL)
+         return TEE_ERROR_BAD_STATE;
+     TEE_GetObjectInfo1(ctx->aci.key, &key_info);
+     sig_sz = key_info.keySize / 8;
+     if (enc_sz < sig_sz || sig_sz > sizeof(sig))
+         return TEE_ERROR_BAD_FORMAT;
+     data_sz = enc_sz - sig_sz;
+ 
+     res = aes_key_op(&op, TEE_ALG_AES_CTR, TEE_MODE_DECRYPT, key_iv, key_sz);
+     if (res != TEE_SUCCESS)
+         return res;
+     ctr_iv_at(key_iv + key_sz, data_sz, ctr);
+     TEE_CipherInit(op, ctr, sizeof(ctr));
+     n = data_sz % AES_BLOCK_SIZE;
+     if (n) {
+         TEE_MemFill(skip, 0, n);
+         res = TEE_CipherUpdate(op, skip, n, skip, &n);
+         if (res != TEE_SUCCESS)
+             goto out;
+     }
+ 
+     /* Work on copies, the host can still write to the shared buffers */
+     TEE_MemMove(sig, enc + data_sz, sig_sz);
+     TEE_MemMove(digest, expect, SHA256_DIGEST_SIZE);
+     n = sig_sz;
+     res = TEE_CipherUpdate(op, sig, sig_sz, sig, &n);
+     if (res == TEE_SUCCESS)
+         res = rsa_verify(&ctx->aci, digest, SHA256_DIGEST_SIZE, sig, n);
+ out:
+     TEE_FreeOperation(op);
+     return res;
+ }
+ 
+ /*
+  * Split the key parameter of the verified loads: AES key, then the CTR
+  * initial vector, then with TA_OCRAM_LOAD_FLAG_IF_CHANGED the expected
+  * digest (*expect, NULL otherwise).
+  */
+ static TEE_Result split_key_iv(TEE_Param *param, uint32_t flags,
+                                uint32_t *key_sz, const uint8_t **expect)
+ {
+     uint32_t sz = param->memref.size;
+ 
+     *expect = NULL;
+     if (flags & TA_OCRAM_LOAD_FLAG_IF_CHANGED) {
+         if (sz < SHA256_DIGEST_SIZE)
+             return TEE_ERROR_BAD_PARAMETERS;
+         sz -= SHA256_DIGEST_SIZE;
+         *expect = (uint8_t *)param->memref.buffer + sz;
+     }
+     if (sz <= AES_BLOCK_SIZE)
+         return TEE_ERROR_BAD_PARAMETERS;
+     *key_sz = sz - AES_BLOCK_SIZE;
+     return TEE_SUCCESS;
+ }
+ 
+ /*
+  * Decrypt 'data || signature' into OCRAM at base, hashing the data on
+  * the way, then check the signature trailer. On failure the OCRAM range
+  * written is wiped. The data digest is returned in digest and, when
+  * loaded is not NULL, the number of bytes written in *loaded. The stream
+  * is released before returning.
+  */
+ static TEE_Result load_verified(struct ta_ctx *ctx, const void *enc,
+                                 uint32_t enc_sz, const uint8_t *key_iv,
+                                 uint32_t key_sz, uint32_t base,
+                                 uint32_t flags, uint8_t *digest,
+                                 uint32_t *loaded)
+ {
+     struct ocram_stream *st = &ctx->stream;
+     TEE_OperationHandle op = TEE_HANDLE_NULL;
+     uint32_t digest_len = SHA256_DIGEST_SIZE;
+     TEE_ObjectInfo key_info;
+     uint32_t sig_sz;
+     TEE_Result res;
+ 
+     if (ctx->aci.key == TEE_HANDLE_NULL)
+         return TEE_ERROR_BAD_STATE;
+     TEE_GetObjectInfo1(ctx->aci.key, &key_info);
+     sig_sz = key_info.keySize / 8;
+     if (enc_sz < sig_sz || sig_sz > sizeof(st->trailer))
+         return TEE_ERROR_BAD_FORMAT;
+ 
+     res = aes_key_op(&op, TEE_ALG_AES_CTR, TEE_MODE_DECRYPT, key_iv, key_sz);
+     if (res != TEE_SUCCESS)
+         return res;
+     TEE_CipherInit(op, key_iv + key_sz, AES_BLOCK_SIZE);
+ 
+     /* The image at offset 0 keeps block digests for delta updates */
+     if (!base && CFG_OCRAM_SIZE)
+         flags |= STREAM_FLAG_BLOCKS;
+     res = stream_start(ctx, base, enc_sz - sig_sz, flags, op);
+     if (res != TEE_SUCCESS)
+         goto out;
+     res = stream_feed(ctx, enc, enc_sz);
+     if (res != TEE_SUCCESS)
+         goto wipe;
+     res = stream_finish(ctx, digest, &digest_len);
+     if (res != TEE_SUCCESS)
+         goto wipe;
+ 
+     /* The signature covers SHA-256 of the data digest, as 'make' signs */
+     res = rsa_verify(&ctx->aci, digest, digest_len,
+                      st->trailer, st->trailer_len);
+     if (res != TEE_SUCCESS) {
+         EMSG("Model signature check failed: %#" PRIx32, res);
+         res = TEE_ERROR_SIGNATURE_INVALID;
+         goto wipe;
+     }
+     if (loaded)
+         *loaded = st->offset;
+     stream_release(st);
+     goto out;
+ wipe:
+     stream_scrub(ctx, base, st->offset);
+     stream_release(st);
+ out:
+     TEE_FreeOperation(op);
+     return res;
+ }
+ 
+ /*
+  * Fused inference load: the ciphertext of 'data || signature' crosses the
+  * boundary once. It is decrypted into OCRAM while the SHA-256 state is
+  * updated, then the signature trailer is checked. The M-core is only
+  * released by the client after this returns success; on a bad signature
+  * the OCRAM range just written is wiped before returning.
+  *
+  * With TA_OCRAM_LOAD_FLAG_IF_CHANGED, a resident image whose digest
+  * equals the expected one is kept and only the signature is decrypted,
+  * to check that it covers that digest.
+  */
+ static TEE_Result cmd_load_verified(struct ta_ctx *ctx, uint32_t pt,
+                                     TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_VALUE_OUTPUT);
+     uint8_t digest[SHA256_DIGEST_SIZE];
+     uint32_t flags = params[2].value.a;
+     struct ocram_resident r;
+     const uint8_t *expect;
+     uint32_t loaded = 0;
+     uint32_t key_sz;
+     TEE_Result res;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     res = split_key_iv(&params[1], flags, &key_sz, &expect);
+     if (res != TEE_SUCCESS)
+         return res;
+ 
+     if (expect &&
+         expect_signed(ctx, params[0].memref.buffer, params[0].memref.size,
+                       params[1].memref.buffer, key_sz, expect,
+                       digest) == TEE_SUCCESS &&
+         resident_get(ctx, &r) == TEE_SUCCESS &&
+         !TEE_MemCompare(r.digest, digest, sizeof(r.digest))) {
+         DMSG("Image already resident, generation %" PRIu32, r.generation);
+         params[3].value.a = r.size;
+         params[3].value.b = TA_OCRAM_LOAD_RESIDENT;
+         return TEE_SUCCESS;
+     }
+ 
+     res = load_verified(ctx, params[0].memref.buffer, params[0].memref.size,
+                         params[1].memref.buffer, key_sz, 0, flags, digest,
+                         &loaded);
+     if (res != TEE_SUCCESS)
+         return res;
+ 
+     resident_set(ctx, digest, loaded);
+     params[3].value.a = loaded;
+     params[3].value.b = 0;
+     return TEE_SUCCESS;
+ }
+ 
+ /*----------------------------------------------------------
+  * AES-GCM chunked load
+  *
+  * Each record carries its own GCM tag, so a corrupted image is rejected
+  * at the first bad record. The GCM key comes from the client, though,
+  * and whoever holds it can forge tags: the plaintext is also hashed as
+  * it is decrypted and must match the digest in the signed header before
+  * the image is recorded as resident. Records are decrypted into a TA
+  * buffer and only written to OCRAM once their tag checks; on any
+  * failure the whole image range is wiped.
+  *---------------------------------------------------------*/
+ static void aead_release(struct ocram_aead *a)
+ {
+     if (a->op != TEE_HANDLE_NULL)
+         TEE_FreeOperation(a->op);
+     if (a->root_op != TEE_HANDLE_NULL)
+         TEE_FreeOperation(a->root_op);
+     if (a->rec)
+         TEE_MemFill(a->rec, 0, a->hdr.chunk_size);
+     ta_free(a->rec);
+     a->op = TEE_HANDLE_NULL;
+     a->root_op = TEE_HANDLE_NULL;
+     a->rec = NULL;
+ }
+ 
+ /* GCM IV of record index: the 8-byte nonce, then the big-endian index */
+ static void aead_iv(const uint8_t *nonce, uint32_t index, uint8_t *iv)
+ {
+     TEE_MemMove(iv, nonce, TA_OCRAM_AEAD_NONCE_SIZE);
+     iv[8]  = index >> 24;
+     iv[9]  = index >> 16;
+     iv[10] = index >> 8;
+     iv[11] = index;
+ }
+ 
+ /*
+  * Decrypt record a->index of n bytes into a->rec and check its tag (a
+  * copy in TA memory); only then write it to OCRAM, hashing the plaintext
+  */
+ static TEE_Result aead_open(struct ta_ctx *ctx, const uint8_t *in,
+                             uint32_t n, const uint8_t *tag)
+ {
+     struct ocram_aead *a = &ctx->aead;
+     uint8_t iv[TA_OCRAM_AEAD_NONCE_SIZE + 4];
+     uint32_t out = n;
+     TEE_Result res;
+ 
+     aead_iv(a->hdr.nonce, a->index, iv);
+     res = TEE_AEInit(a->op, iv, sizeof(iv), TA_OCRAM_AEAD_TAG_SIZE * 8,
+                      0, n);
+     if (res != TEE_SUCCESS)
+         return res;
+     res = TEE_AEDecryptFinal(a->op, in, n, a->rec, &out,
+                              (void *)tag, TA_OCRAM_AEAD_TAG_SIZE);
+     if (res == TEE_SUCCESS)
+         res = stream_put(ctx, a->rec, out);
+     /* Nothing of a rejected record is left behind in the TA either */
+     TEE_MemFill(a->rec, 0, n);
+     return res;
+ }
+ 
+ /* Abandon the image: wipe what may have been written */
+ static void aead_abort(struct ta_ctx *ctx)
+ {
+     stream_scrub(ctx, ctx->stream.base, ctx->stream.total);
+     stream_release(&ctx->stream);
+     aead_release(&ctx->aead);
+ }
+ 
+ static TEE_Result cmd_aead_begin(struct ta_ctx *ctx, uint32_t pt,
+                                  TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_VALUE_OUTPUT);
+     struct ocram_aead *a = &ctx->aead;
+     struct ta_ocram_aead_hdr hdr;
+     uint32_t flags = params[2].value.a;
+     struct ocram_resident r;
+     TEE_Result res;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     if (flags & TA_OCRAM_LOAD_FLAG_DIRECT)
+         return TEE_ERROR_NOT_SUPPORTED;
+     if (ctx->aci.key == TEE_HANDLE_NULL)
+         return TEE_ERROR_BAD_STATE;
+     if (params[0].memref.size < sizeof(hdr))
+         return TEE_ERROR_BAD_FORMAT;
+ 
+     /* An unfinished image was never authenticated, do not leave it */
+     stream_abort(ctx);
+     aead_release(a);
+ 
+     /* Work on a copy the client cannot change after it is checked */
+     TEE_MemMove(&hdr, params[0].memref.buffer, sizeof(hdr));
+     if (hdr.magic != TA_OCRAM_AEAD_MAGIC || !hdr.data_size ||
+         !hdr.chunk_size || hdr.chunk_size % AES_BLOCK_SIZE ||
+         hdr.chunk_size > TA_OCRAM_AEAD_CHUNK_MAX ||
+         hdr.count != (hdr.data_size - 1) / hdr.chunk_size + 1)
+         return TEE_ERROR_BAD_FORMAT;
+ 
+     res = rsa_verify(&ctx->aci, &hdr, sizeof(hdr),
+                      (uint8_t *)params[0].memref.buffer + sizeof(hdr),
+                      params[0].memref.size - sizeof(hdr));
+     if (res != TEE_SUCCESS) {
+         EMSG("Image header signature check failed: %#" PRIx32, res);
+         return TEE_ERROR_SIGNATURE_INVALID;
+     }
+ 
+     if ((flags & TA_OCRAM_LOAD_FLAG_IF_CHANGED) &&
+         resident_get(ctx, &r) == TEE_SUCCESS &&
+         !TEE_MemCompare(r.digest, hdr.digest, sizeof(r.digest))) {
+         DMSG("Image already resident, generation %" PRIu32, r.generation);
+         params[3].value.a = r.size;
+         params[3].value.b = TA_OCRAM_LOAD_RESIDENT;
+         return TEE_SUCCESS;
+     }
+ 
+     a->hdr = hdr;
+     a->index = 0;
+     res = aes_key_op(&a->op, TEE_ALG_AES_GCM, TEE_MODE_DECRYPT,
+                      params[1].memref.buffer, params[1].memref.size);
+     if (res != TEE_SUCCESS)
+         return res;
+     res = TEE_AllocateOperation(&a->root_op, TEE_ALG_SHA256,
+                                 TEE_MODE_DIGEST, 0);
+     if (res != TEE_SUCCESS) {
+         a->root_op = TEE_HANDLE_NULL;
+         goto err;
+     }
+     a->rec = ta_malloc(hdr.chunk_size, 0);
+     if (!a->rec) {
+         res = TEE_ERROR_OUT_OF_MEMORY;
+         goto err;
+     }
+     res = stream_start(ctx, 0, hdr.data_size, STREAM_FLAG_AEAD,
+                        TEE_HANDLE_NULL);
+     if (res != TEE_SUCCESS)
+         goto err;
+ 
+     params[3].value.a = hdr.data_size;
+     params[3].value.b = 0;
+     return TEE_SUCCESS;
+ err:
+     aead_release(a);
+     return res;
+ }
+ 
+ static TEE_Result cmd_aead_chunk(struct ta_ctx *ctx, uint32_t pt,
+                                  TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_VALUE_OUTPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+     struct ocram_stream *st = &ctx->stream;
+     struct ocram_aead *a = &ctx->aead;
+     const uint8_t *in = params[0].memref.buffer;
+     uint32_t len = params[0].memref.size;
+     uint8_t tag[TA_OCRAM_AEAD_TAG_SIZE];
+     TEE_Result res = TEE_SUCCESS;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     if (!st->active || !st->aead)
+         return TEE_ERROR_BAD_STATE;
+ 
+     while (len && res == TEE_SUCCESS) {
+         uint32_t n = MIN(a->hdr.chunk_size, st->total - st->offset);
+ 
+         /* Only whole records, and no more than the header announced */
+         if (!n || len < TA_OCRAM_AEAD_TAG_SIZE ||
+             len - TA_OCRAM_AEAD_TAG_SIZE < n) {
+             res = TEE_ERROR_BAD_FORMAT;
+             break;
+         }
+         /* One fetch of the tag, checked and hashed from the same copy */
+         TEE_MemMove(tag, in + n, sizeof(tag));
+         res = aead_open(ctx, in, n, tag);
+         if (res == TEE_ERROR_MAC_INVALID)
+             EMSG("Record %" PRIu32 " failed authentication", a->index);
+         if (res != TEE_SUCCESS)
+             break;
+         TEE_DigestUpdate(a->root_op, tag, sizeof(tag));
+         a->index++;
+         in  += n + TA_OCRAM_AEAD_TAG_SIZE;
+         len -= n + TA_OCRAM_AEAD_TAG_SIZE;
+     }
+ 
+     params[1].value.a = a->index;
+     if (res != TEE_SUCCESS)
+         aead_abort(ctx);
+     return res;
+ }
+ 
+ static TEE_Result cmd_aead_end(struct ta_ctx *ctx, uint32_t pt,
+                                TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_VALUE_OUTPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+     struct ocram_stream *st = &ctx->stream;
+     struct ocram_aead *a = &ctx->aead;
+     uint8_t root[SHA256_DIGEST_SIZE];
+     uint32_t root_len = sizeof(root);
+     TEE_Result res;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     if (!st->active || !st->aead)
+         return TEE_ERROR_BAD_STATE;
+ 
+     if (a->index != a->hdr.count || st->offset != st->total) {
+         EMSG("Short image: %" PRIu32 " of %" PRIu32 " records",
+              a->index, a->hdr.count);
+         res = TEE_ERROR_BAD_STATE;
+         goto err;
+     }
+     res = TEE_DigestDoFinal(a->root_op, NULL, 0, root, &root_len);
+     if (res != TEE_SUCCESS)
+         goto err;
+     if (TEE_MemCompare(root, a->hdr.root, sizeof(root))) {
+         EMSG("Record tags do not match the signed header");
+         res = TEE_ERROR_SIGNATURE_INVALID;
+         goto err;
+     }
+     /* Tags can be forged with the key, the signed digest cannot */
+     root_len = sizeof(root);
+     res = TEE_DigestDoFinal(st->digest_op, NULL, 0, root, &root_len);
+     if (res != TEE_SUCCESS)
+         goto err;
+     if (TEE_MemCompare(root, a->hdr.digest, sizeof(root))) {
+         EMSG("Image digest does not match the signed header");
+         res = TEE_ERROR_SIGNATURE_INVALID;
+         goto err;
+     }
+ 
+     resident_set(ctx, a->hdr.digest, st->offset);
+     params[0].value.a = st->offset;
+     stream_release(st);
+     aead_release(a);
+     return TEE_SUCCESS;
+ err:
+     aead_abort(ctx);
+     return res;
+ }
+ 
+ static TEE_Result cmd_aead_seal(struct ta_ctx *ctx, uint32_t pt,
+                                 TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_MEMREF_OUTPUT);
+     TEE_OperationHandle op = TEE_HANDLE_NULL;
+     uint8_t iv[TA_OCRAM_AEAD_NONCE_SIZE + 4];
+     uint8_t *key = params[0].memref.buffer;
+     uint32_t key_sz = params[0].memref.size;
+     uint32_t in_sz = params[2].memref.size;
+     uint32_t out_sz = in_sz;
+     uint32_t tag_sz = TA_OCRAM_AEAD_TAG_SIZE;
+     uint8_t *out = params[3].memref.buffer;
+     TEE_Result res;
+ 
+     (void)ctx;
+     if (pt != exp || key_sz < TA_OCRAM_AEAD_NONCE_SIZE)
+         return TEE_ERROR_BAD_PARAMETERS;
+     if (params[3].memref.size < in_sz + TA_OCRAM_AEAD_TAG_SIZE) {
+         params[3].memref.size = in_sz + TA_OCRAM_AEAD_TAG_SIZE;
+         return TEE_ERROR_SHORT_BUFFER;
+     }
+     key_sz -= TA_OCRAM_AEAD_NONCE_SIZE;
+ 
+     res = aes_key_op(&op, TEE_ALG_AES_GCM, TEE_MODE_ENCRYPT, key, key_sz);
+     if (res != TEE_SUCCESS)
+         return res;
+     aead_iv(key + key_sz, params[1].value.a, iv);
+     res = TEE_AEInit(op, iv, sizeof(iv), TA_OCRAM_AEAD_TAG_SIZE * 8,
+                      0, in_sz);
+     if (res == TEE_SUCCESS)
+         res = TEE_AEEncryptFinal(op, params[2].memref.buffer, in_sz,
+                                  out, &out_sz, out + in_sz, &tag_sz);
+     if (res == TEE_SUCCESS)
+         params[3].memref.size = out_sz + tag_sz;
+     TEE_FreeOperation(op);
+     return res;
+ }
+ 
+ /*----------------------------------------------------------
+  * OCRAM slots
+  *
+  * The table is kept in secure storage next to the residency record and
+  * re-read by every command, since each client session has its own TA
+  * instance. A slot's range is hashed again before it is reused.
+  *---------------------------------------------------------*/
+ static void slots_read(struct ta_ctx *ctx)
+ {
+     struct ocram_slots *t = &ctx->slots;
+     TEE_ObjectHandle obj = TEE_HANDLE_NULL;
+     uint32_t n = 0;
+     uint32_t i;
+ 
+     if (TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, SLOTS_OBJ_ID,
+                                  strlen(SLOTS_OBJ_ID),
+                                  TEE_DATA_FLAG_ACCESS_READ,
+                                  &obj) == TEE_SUCCESS) {
+         if (TEE_ReadObjectData(obj, t, sizeof(*t), &n) != TEE_SUCCESS)
+             n = 0;
+         TEE_CloseObject(obj);
+     }
+     if (n != sizeof(*t)) {
+         TEE_MemFill(t, 0, sizeof(*t));
+         return;
+     }
+ 
+     /* OCRAM does not survive a restart */
+     if (restarted_since(&t->stamp))
+         for (i = 0; i < TA_OCRAM_LOAD_SLOTS; i++)
+             t->slot[i].valid = 0;
+ }
+ 
+ static TEE_Result slots_write(struct ta_ctx *ctx)
+ {
+     struct ocram_slots *t = &ctx->slots;
+     TEE_ObjectHandle obj = TEE_HANDLE_NULL;
+     TEE_Result res;
+ 
+     TEE_GetSystemTime(&t->stamp);
+     res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE,
+                                      SLOTS_OBJ_ID,
+                                      strlen(SLOTS_OBJ_ID),
+                                      TEE_DATA_FLAG_ACCESS_WRITE |
+                                      TEE_DATA_FLAG_OVERWRITE,
+                                      TEE_HANDLE_NULL,
+                                      t, sizeof(*t),
+                                      &obj);
+     if (res == TEE_SUCCESS)
+         TEE_CloseObject(obj);
+     else
+         EMSG("Cannot persist OCRAM slots: %#" PRIx32, res);
+     return res;
+ }
+ 
+ /* Drop slots overlapping [base, base + len); true if any was dropped */
+ static bool slots_clear_range(struct ocram_slots *t, uint32_t base,
+                               uint32_t len)
+ {
+     bool changed = false;
+     uint32_t i;
+ 
+     for (i = 0; i < TA_OCRAM_LOAD_SLOTS; i++) {
+         struct ocram_slot *sl = &t->slot[i];
+ 
+         if (sl->valid && sl->offset < base + len &&
+             base < sl->offset + sl->size) {
+             sl->valid = 0;
+             sl->flags = 0;
+             changed = true;
+         }
+     }
+     return changed;
+ }
+ 
+ /*
+  * OCRAM [base, base + len) is about to be overwritten. Only the slots
+  * in the way are dropped, so secure storage is written only when a load
+  * displaces a slot. The residency record is left as is: resident_get()
+  * hashes the whole range and drops a record OCRAM no longer matches.
+  */
+ static void ocram_dirty(struct ta_ctx *ctx, uint32_t base, uint32_t len)
+ {
+     slots_read(ctx);
+     if (slots_clear_range(&ctx->slots, base, len))
+         slots_write(ctx);
+ }
+ 
+ /* First fit free range of size bytes, UINT32_MAX if there is none */
+ static uint32_t slots_find_gap(struct ocram_slots *t, uint32_t window,
+                                uint32_t size)
+ {
+     uint32_t start = 0;
+     uint32_t i;
+ 
+     while (start <= window && size <= window - start) {
+         uint32_t next = start;
+ 
+         for (i = 0; i < TA_OCRAM_LOAD_SLOTS; i++) {
+             struct ocram_slot *sl = &t->slot[i];
+ 
+             if (sl->valid && sl->offset < start + size &&
+                 start < sl->offset + sl->size)
+                 next = MAX(next, sl->offset + sl->size);
+         }
+         if (next == start)
+             return start;
+         start = ROUNDUP(next, TA_OCRAM_LOAD_SLOT_ALIGN);
+     }
+     return UINT32_MAX;
+ }
+ 
+ /*
+  * Reserve a slot of size bytes, evicting least recently used unpinned
+  * slots until a range is free. Returns the slot index or -1.
+  */
+ static int slots_alloc(struct ta_ctx *ctx, uint32_t size)
+ {
+     struct ocram_slots *t = &ctx->slots;
+     uint32_t off;
+     int idx;
+     int i;
+ 
+     while (true) {
+         idx = -1;
+         for (i = 0; i < TA_OCRAM_LOAD_SLOTS && idx < 0; i++)
+             if (!t->slot[i].valid)
+                 idx = i;
+         off = slots_find_gap(t, CFG_OCRAM_SIZE, size);
+         if (idx >= 0 && off != UINT32_MAX)
+             break;
+ 
+         /* Nothing fits: evict the LRU unpinned slot */
+         idx = -1;
+         for (i = 0; i < TA_OCRAM_LOAD_SLOTS; i++) {
+             struct ocram_slot *sl = &t->slot[i];
+ 
+             if (!sl->valid || (sl->flags & TA_OCRAM_SLOT_PINNED))
+                 continue;
+             if (idx < 0 || sl->last_use < t->slot[idx].last_use)
+                 idx = i;
+         }
+         if (idx < 0)
+             return -1;
+         DMSG("Evicting OCRAM slot %d", idx);
+         stream_scrub(ctx, t->slot[idx].offset, t->slot[idx].size);
+         t->slot[idx].valid = 0;
+     }
+ 
+     t->slot[idx].flags = 0;
+     t->slot[idx].offset = off;
+     t->slot[idx].size = size;
+     return idx;
+ }
+ 
+ /* Valid slot holding digest whose range still hashes to it, -1 if none */
+ static int slots_lookup(struct ta_ctx *ctx, const uint8_t *digest)
+ {
+     struct ocram_slots *t = &ctx->slots;
+     uint8_t content[SHA256_DIGEST_SIZE];
+     int i;
+ 
+     for (i = 0; i < TA_OCRAM_LOAD_SLOTS; i++) {
+         struct ocram_slot *sl = &t->slot[i];
+ 
+         if (!sl->valid ||
+             TEE_MemCompare(sl->digest, digest, sizeof(sl->digest)))
+             continue;
+         if (ocram_hash(ctx, sl->offset, sl->size, content) == TEE_SUCCESS &&
+             !TEE_MemCompare(content, sl->digest, sizeof(content)))
+             return i;
+         DMSG("OCRAM slot %d changed since load", i);
+         sl->valid = 0;
+         slots_write(ctx);
+     }
+     return -1;
+ }
+ 
+ static TEE_Result cmd_slot_load(struct ta_ctx *ctx, uint32_t pt,
+                                 TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_VALUE_INOUT,
+         TEE_PARAM_TYPE_VALUE_OUTPUT);
+     struct ocram_slots *t = &ctx->slots;
+     uint8_t digest[SHA256_DIGEST_SIZE];
+     uint32_t flags = params[2].value.a;
+     uint32_t enc_sz = params[0].memref.size;
+     struct ocram_slot *sl;
+     const uint8_t *expect;
+     TEE_ObjectInfo key_info;
+     uint32_t key_sz;
+     TEE_Result res;
+     int idx;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     res = ocram_need_window(ctx);
+     if (res != TEE_SUCCESS)
+         return res;
+     if (ctx->aci.key == TEE_HANDLE_NULL)
+         return TEE_ERROR_BAD_STATE;
+     /* The slot is sized from the ciphertext before anything is decoded */
+     if (flags & TA_OCRAM_LOAD_FLAG_COMPRESSED)
+         return TEE_ERROR_NOT_SUPPORTED;
+     res = split_key_iv(&params[1], flags, &key_sz, &expect);
+     if (res != TEE_SUCCESS)
+         return res;
+ 
+     slots_read(ctx);
+     idx = -1;
+     if (expect &&
+         expect_signed(ctx, params[0].memref.buffer, enc_sz,
+                       params[1].memref.buffer, key_sz, expect,
+                       digest) == TEE_SUCCESS)
+         idx = slots_lookup(ctx, digest);
+     if (idx >= 0) {
+         params[2].value.b = TA_OCRAM_LOAD_RESIDENT;
+         goto done;
+     }
+ 
+     TEE_GetObjectInfo1(ctx->aci.key, &key_info);
+     if (enc_sz <= key_info.keySize / 8)
+         return TEE_ERROR_BAD_FORMAT;
+     idx = slots_alloc(ctx, enc_sz - key_info.keySize / 8);
+     if (idx < 0)
+         return TEE_ERROR_OUT_OF_MEMORY;
+     sl = &t->slot[idx];
+     /* Persist the evictions before OCRAM is overwritten */
+     slots_write(ctx);
+ 
+     res = load_verified(ctx, params[0].memref.buffer, enc_sz,
+                         params[1].memref.buffer, key_sz, sl->offset,
+                         flags, digest, NULL);
+     if (res != TEE_SUCCESS)
+         return res;
+ 
+     /* stream_start() re-read the table, sl still points into it */
+     TEE_MemMove(sl->digest, digest, sizeof(sl->digest));
+     sl->generation = ++t->generation;
+     sl->valid = 1;
+     params[2].value.b = 0;
+ done:
+     t->slot[idx].last_use = ++t->tick;
+     slots_write(ctx);
+     params[2].value.a = idx;
+     params[3].value.a = t->slot[idx].offset;
+     params[3].value.b = t->slot[idx].size;
+     return TEE_SUCCESS;
+ }
+ 
+ static TEE_Result cmd_slot_list(struct ta_ctx *ctx, uint32_t pt,
+                                 TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_OUTPUT,
+         TEE_PARAM_TYPE_VALUE_OUTPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+     struct ta_ocram_slot_info *info = params[0].memref.buffer;
+     uint32_t max = params[0].memref.size / sizeof(*info);
+     uint32_t n = 0;
+     uint32_t i;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+ 
+     slots_read(ctx);
+     for (i = 0; i < TA_OCRAM_LOAD_SLOTS; i++) {
+         struct ocram_slot *sl = &ctx->slots.slot[i];
+ 
+         if (!sl->valid)
+             continue;
+         if (n < max) {
+             info[n].id = i;
+             info[n].offset = sl->offset;
+             info[n].size = sl->size;
+             info[n].flags = sl->flags;
+             info[n].generation = sl->generation;
+             info[n].last_use = sl->last_use;
+             TEE_MemMove(info[n].digest, sl->digest, sizeof(info[n].digest));
+         }
+         n++;
+     }
+ 
+     params[0].memref.size = n * sizeof(*info);
+     params[1].value.a = n;
+     return n > max ? TEE_ERROR_SHORT_BUFFER : TEE_SUCCESS;
+ }
+ 
+ /* Look up a valid slot by id for PIN/EVICT */
+ static struct ocram_slot *slot_by_id(struct ta_ctx *ctx, uint32_t id)
+ {
+     slots_read(ctx);
+     if (id >= TA_OCRAM_LOAD_SLOTS || !ctx->slots.slot[id].valid)
+         return NULL;
+     return &ctx->slots.slot[id];
+ }
+ 
+ static TEE_Result cmd_slot_pin(struct ta_ctx *ctx, uint32_t pt,
+                                TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+     struct ocram_slot *sl;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     sl = slot_by_id(ctx, params[0].value.a);
+     if (!sl)
+         return TEE_ERROR_ITEM_NOT_FOUND;
+ 
+     if (params[0].value.b)
+         sl->flags |= TA_OCRAM_SLOT_PINNED;
+     else
+         sl->flags &= ~TA_OCRAM_SLOT_PINNED;
+     return slots_write(ctx);
+ }
+ 
+ static TEE_Result cmd_slot_evict(struct ta_ctx *ctx, uint32_t pt,
+                                  TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+     struct ocram_slot *sl;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     sl = slot_by_id(ctx, params[0].value.a);
+     if (!sl)
+         return TEE_ERROR_ITEM_NOT_FOUND;
+     if (sl->flags & TA_OCRAM_SLOT_PINNED)
+         return TEE_ERROR_ACCESS_CONFLICT;
+ 
+     sl->valid = 0;
+     slots_write(ctx);
+     return stream_scrub(ctx, sl->offset, sl->size);
+ }
+ 
+ /*----------------------------------------------------------
+  * Staged load
+  *
+  * Batch inference overlaps loading with M-core execution: the next image
+  * is decrypted and verified at the top of the OCRAM window while the
+  * current one runs from offset 0, so once the core stops COMMIT only
+  * has to move already verified plaintext into place.
+  *---------------------------------------------------------*/
+ static TEE_Result cmd_stage(struct ta_ctx *ctx, uint32_t pt,
+                             TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_VALUE_OUTPUT);
+     struct ocram_stage *sg = &ctx->stage;
+     uint32_t flags = params[2].value.a;
+     uint32_t keep = params[2].value.b;
+     uint32_t enc_sz = params[0].memref.size;
+     TEE_ObjectInfo key_info;
+     const uint8_t *expect;
+     uint32_t key_sz, size, base;
+     TEE_Result res;
+     uint32_t i;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     res = ocram_need_window(ctx);
+     if (res != TEE_SUCCESS)
+         return res;
+     if (ctx->aci.key == TEE_HANDLE_NULL)
+         return TEE_ERROR_BAD_STATE;
+     /* The staging offset is set from the ciphertext size */
+     if (flags)
+         return TEE_ERROR_NOT_SUPPORTED;
+     res = split_key_iv(&params[1], flags, &key_sz, &expect);
+     if (res != TEE_SUCCESS)
+         return res;
+ 
+     TEE_GetObjectInfo1(ctx->aci.key, &key_info);
+     if (enc_sz <= key_info.keySize / 8)
+         return TEE_ERROR_BAD_FORMAT;
+     size = enc_sz - key_info.keySize / 8;
+     if (keep > CFG_OCRAM_SIZE)
+         return TEE_ERROR_OUT_OF_MEMORY;
+     keep = ROUNDUP(keep, TA_OCRAM_LOAD_SLOT_ALIGN);
+     if (keep > CFG_OCRAM_SIZE || size > CFG_OCRAM_SIZE - keep)
+         return TEE_ERROR_OUT_OF_MEMORY;
+     base = ROUNDDOWN(CFG_OCRAM_SIZE - size, TA_OCRAM_LOAD_SLOT_ALIGN);
+ 
+     if (sg->valid) {
+         sg->valid = false;
+         stream_scrub(ctx, sg->base, sg->size);
+     }
+     slots_read(ctx);
+     for (i = 0; i < TA_OCRAM_LOAD_SLOTS; i++) {
+         struct ocram_slot *sl = &ctx->slots.slot[i];
+ 
+         if (sl->valid && (sl->flags & TA_OCRAM_SLOT_PINNED) &&
+             sl->offset < base + size && base < sl->offset + sl->size)
+             return TEE_ERROR_ACCESS_CONFLICT;
+     }
+ 
+     res = load_verified(ctx, params[0].memref.buffer, enc_sz,
+                         params[1].memref.buffer, key_sz, base, flags,
+                         sg->digest, NULL);
+     if (res != TEE_SUCCESS)
+         return res;
+     sg->base = base;
+     sg->size = size;
+     sg->valid = true;
+     params[3].value.a = size;
+     params[3].value.b = base;
+     return TEE_SUCCESS;
+ }
+ 
+ static TEE_Result cmd_commit(struct ta_ctx *ctx, uint32_t pt,
+                              TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_VALUE_OUTPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+     struct ocram_stage *sg = &ctx->stage;
+     uint8_t digest[SHA256_DIGEST_SIZE];
+     uint8_t *buf;
+     uint32_t off, tail;
+     TEE_Result res;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     if (!sg->valid)
+         return TEE_ERROR_BAD_STATE;
+ 
+     /*
+      * Another load, or the M-core itself, may have written to the
+      * staging area since, so check the whole copy against the digest
+      * verified at STAGE before it becomes the resident image.
+      */
+     res = ocram_hash(ctx, sg->base, sg->size, digest);
+     if (res != TEE_SUCCESS)
+         return res;
+     sg->valid = false;
+     if (TEE_MemCompare(digest, sg->digest, sizeof(digest))) {
+         EMSG("Staged image changed before commit");
+         stream_scrub(ctx, sg->base, sg->size);
+         return TEE_ERROR_BAD_STATE;
+     }
+ 
+     buf = ta_malloc(OCRAM_CHUNK_SIZE, 0);
+     if (!buf) {
+         stream_scrub(ctx, sg->base, sg->size);
+         return TEE_ERROR_OUT_OF_MEMORY;
+     }
+     ocram_dirty(ctx, 0, sg->size);
+     /* The copy goes down, so chunks are read before they are overwritten */
+     for (off = 0; off < sg->size && res == TEE_SUCCESS;
+          off += OCRAM_CHUNK_SIZE) {
+         uint32_t n = MIN(sg->size - off, (uint32_t)OCRAM_CHUNK_SIZE);
+ 
+         res = ocram_read(ctx, sg->base + off, buf, n);
+         if (res == TEE_SUCCESS)
+             res = ocram_write(ctx, off, buf, n);
+     }
+     ta_free(buf);
+     if (res != TEE_SUCCESS) {
+         EMSG("Moving the staged image failed: %#" PRIx32, res);
+         stream_scrub(ctx, 0, sg->base + sg->size);
+         return res;
+     }
+     /* Clear the part of the staged copy the move left behind */
+     tail = MAX(sg->base, sg->size);
+     stream_scrub(ctx, tail, sg->base + sg->size - tail);
+ 
+     /* Block digests kept by this session belong to some other image */
+     ta_free(ctx->stream.blocks);
+     ctx->stream.blocks = NULL;
+     resident_set(ctx, sg->digest, sg->size);
+     params[0].value.a = sg->size;
+     params[0].value.b = 0;
+     return TEE_SUCCESS;
+ }
+ 
+ /*----------------------------------------------------------
+  * Delta load
+  *
+  * AES-CTR lets any block of the encrypted file be decrypted on its own,
+  * with the counter advanced to the block offset. A delta update thus
+  * only decrypts the blocks the packager found changed, writes those
+  * whose plaintext differs from the resident block digests, and then
+  * re-hashes the image in OCRAM to check the new signature.
+  *---------------------------------------------------------*/
+ 
+ /* SHA-256 of OCRAM [0, size), refreshing the per-block digests */
+ static TEE_Result delta_rehash(struct ta_ctx *ctx, uint32_t size,
+                                uint8_t *digest, uint8_t *blocks)
+ {
+     TEE_OperationHandle op = TEE_HANDLE_NULL;
+     TEE_OperationHandle blk = TEE_HANDLE_NULL;
+     uint32_t len = SHA256_DIGEST_SIZE;
+     uint8_t *buf = NULL;
+     uint32_t off;
+     TEE_Result res;
+ 
+     res = TEE_AllocateOperation(&op, TEE_ALG_SHA256, TEE_MODE_DIGEST, 0);
+     if (res != TEE_SUCCESS)
+         return res;
+     res = TEE_AllocateOperation(&blk, TEE_ALG_SHA256, TEE_MODE_DIGEST, 0);
+     if (res != TEE_SUCCESS)
+         goto out;
+     buf = ta_malloc(TA_OCRAM_DELTA_BLOCK, 0);
+     if (!buf) {
+         res = TEE_ERROR_OUT_OF_MEMORY;
+         goto out;
+     }
+ 
+     for (off = 0; off < size && res == TEE_SUCCESS;
+          off += TA_OCRAM_DELTA_BLOCK) {
+         uint32_t n = MIN(size - off, (uint32_t)TA_OCRAM_DELTA_BLOCK);
+ 
+         res = ocram_read(ctx, off, buf, n);
+         if (res != TEE_SUCCESS)
+             break;
+         TEE_DigestUpdate(op, buf, n);
+         len = SHA256_DIGEST_SIZE;
+         res = TEE_DigestDoFinal(blk, buf, n,
+                                 blocks + off / TA_OCRAM_DELTA_BLOCK *
+                                 SHA256_DIGEST_SIZE, &len);
+     }
+     len = SHA256_DIGEST_SIZE;
+     if (res == TEE_SUCCESS)
+         res = TEE_DigestDoFinal(op, NULL, 0, digest, &len);
+ out:
+     ta_free(buf);
+     if (blk != TEE_HANDLE_NULL)
+         TEE_FreeOperation(blk);
+     TEE_FreeOperation(op);
+     return res;
+ }
+ 
+ static TEE_Result cmd_load_delta(struct ta_ctx *ctx, uint32_t pt,
+                                  TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_VALUE_OUTPUT);
+     struct ocram_stream *st = &ctx->stream;
+     TEE_OperationHandle cipher = TEE_HANDLE_NULL;
+     struct ta_ocram_delta_hdr hdr;
+     const uint8_t *p = (const uint8_t *)params[0].memref.buffer;
+     uint32_t left = params[0].memref.size;
+     uint8_t digest[SHA256_DIGEST_SIZE];
+     uint8_t iv[AES_BLOCK_SIZE];
+     uint8_t *key = params[1].memref.buffer;
+     uint32_t key_sz = params[1].memref.size;
+     uint8_t *blocks = NULL;
+     uint8_t *buf = NULL;
+     struct ocram_resident r;
+     TEE_ObjectInfo key_info;
+     uint32_t old_blocks, new_blocks;
+     uint32_t written = 0, nwritten = 0;
+     uint32_t sig_sz, sig_len = 0;
+     uint32_t span, i;
+     TEE_Result res;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     res = ocram_need_window(ctx);
+     if (res != TEE_SUCCESS)
+         return res;
+     /* The trailer and block digests below belong to an open stream */
+     if (st->active || ctx->aci.key == TEE_HANDLE_NULL)
+         return TEE_ERROR_BAD_STATE;
+ 
+     /* Work on a copy, the host can still write to the shared buffer */
+     if (left < sizeof(hdr))
+         return TEE_ERROR_BAD_FORMAT;
+     TEE_MemMove(&hdr, p, sizeof(hdr));
+     if (hdr.magic != TA_OCRAM_DELTA_MAGIC ||
+         hdr.block_size != TA_OCRAM_DELTA_BLOCK ||
+         hdr.data_size > CFG_OCRAM_SIZE)
+         return TEE_ERROR_BAD_FORMAT;
+     TEE_GetObjectInfo1(ctx->aci.key, &key_info);
+     sig_sz = key_info.keySize / 8;
+     if (sig_sz > sizeof(st->trailer))
+         return TEE_ERROR_BAD_FORMAT;
+ 
+     /* The delta only applies on top of the image it was made against */
+     if (resident_get(ctx, &r) != TEE_SUCCESS ||
+         TEE_MemCompare(r.digest, hdr.base_digest, sizeof(r.digest)))
+         return TEE_ERROR_BAD_STATE;
+     old_blocks = ROUNDUP(r.size, TA_OCRAM_DELTA_BLOCK) / TA_OCRAM_DELTA_BLOCK;
+     new_blocks = ROUNDUP(hdr.data_size, TA_OCRAM_DELTA_BLOCK) /
+                  TA_OCRAM_DELTA_BLOCK;
+     span = MAX(r.size, hdr.data_size);
+ 
+     blocks = ta_malloc(MAX(old_blocks, new_blocks) * SHA256_DIGEST_SIZE,
+                         TEE_MALLOC_FILL_ZERO);
+     buf = ta_malloc(TA_OCRAM_DELTA_BLOCK, 0);
+     if (!blocks || !buf) {
+         res = TEE_ERROR_OUT_OF_MEMORY;
+         goto out;
+     }
+     res = blocks_read(r.digest, blocks, old_blocks);
+     if (res != TEE_SUCCESS) {
+         res = TEE_ERROR_BAD_STATE;
+         goto out;
+     }
  
-     uint8_t digest[32];
-     uint32_t digest_len = sizeof(digest);
-     TEE_OperationHandle d_op;
-     TEE_AllocateOperation(&d_op, TEE_ALG_SHA256, TEE_MODE_DIGEST, 0);
-     TEE_DigestDoFinal(d_op, inbuf, in_len, digest, &digest_len);
-     TEE_FreeOperation(d_op);
+     res = aes_key_op(&cipher, TEE_ALG_AES_CTR, TEE_MODE_DECRYPT, key, key_sz);
+     if (res != TEE_SUCCESS)
+         goto out;
  
-     TEE_ObjectInfo key_info;
-     TEE_GetObjectInfo1(state->key, &key_info);
+     /* From here on OCRAM no longer holds the recorded image */
+     ocram_dirty(ctx, 0, span);
  
-     TEE_OperationHandle op;
-     TEE_AllocateOperation(&op, TEE_ALG_RSASSA_PKCS1_V1_5_SHA256, TEE_MODE_VERIFY, key_info.keySize);
-     TEE_SetOperationKey(op, state->key);
-     TEE_Result res = TEE_AsymmetricVerifyDigest(op, NULL, 0, digest, digest_len, sig, sig_len);
-     params[2].value.a = (res == TEE_SUCCESS) ? 1 : 0;
-     TEE_FreeOperation(op);
+     p += sizeof(hdr);
+     left -= sizeof(hdr);
+     for (i = 0; i < hdr.count; i++) {
+         struct ta_ocram_delta_entry e;
+         uint32_t done = 0;
+ 
+         if (left < sizeof(e)) {
+             res = TEE_ERROR_BAD_FORMAT;
+             goto wipe;
+         }
+         TEE_MemMove(&e, p, sizeof(e));
+         p += sizeof(e);
+         left -= sizeof(e);
+         if (e.offset % TA_OCRAM_DELTA_BLOCK || e.size > left ||
+             e.offset > hdr.data_size + sig_sz ||
+             e.size > hdr.data_size + sig_sz - e.offset) {
+             res = TEE_ERROR_BAD_FORMAT;
+             goto wipe;
+         }
+ 
+         /* The new revision has its own IV, see struct ta_ocram_delta_hdr */
+         ctr_iv_at(hdr.iv, e.offset, iv);
+         TEE_CipherInit(cipher, iv, AES_BLOCK_SIZE);
+         while (done < e.size) {
+             uint32_t off = e.offset + done;
+             uint32_t n = MIN(e.size - done, (uint32_t)TA_OCRAM_DELTA_BLOCK);
+             uint32_t plain_sz = TA_OCRAM_DELTA_BLOCK;
+             uint32_t data_n = off < hdr.data_size ?
+                               MIN(n, hdr.data_size - off) : 0;
+             uint8_t *old = blocks + off / TA_OCRAM_DELTA_BLOCK *
+                            SHA256_DIGEST_SIZE;
+             uint8_t h[SHA256_DIGEST_SIZE];
+             uint32_t h_len = sizeof(h);
+             TEE_OperationHandle op = TEE_HANDLE_NULL;
+ 
+             if (done + n == e.size)
+                 res = TEE_CipherDoFinal(cipher, p + done, n,
+                                         buf, &plain_sz);
+             else
+                 res = TEE_CipherUpdate(cipher, p + done, n,
+                                        buf, &plain_sz);
+             if (res != TEE_SUCCESS)
+                 goto wipe;
+ 
+             /* Rewrite the block unless it is unchanged */
+             if (data_n) {
+                 res = TEE_AllocateOperation(&op, TEE_ALG_SHA256,
+                                             TEE_MODE_DIGEST, 0);
+                 if (res != TEE_SUCCESS)
+                     goto wipe;
+                 TEE_DigestDoFinal(op, buf, data_n, h, &h_len);
+                 TEE_FreeOperation(op);
+                 if (off / TA_OCRAM_DELTA_BLOCK >= old_blocks ||
+                     TEE_MemCompare(h, old, sizeof(h))) {
+                     res = ocram_write(ctx, off, buf, data_n);
+                     if (res != TEE_SUCCESS)
+                         goto wipe;
+                     written += data_n;
+                     nwritten++;
+                 }
+             }
+             /* Bytes past the data are the signature */
+             if (n > data_n) {
+                 uint32_t sig_off = off + data_n - hdr.data_size;
+ 
+                 TEE_MemMove(st->trailer + sig_off, buf + data_n,
+                             n - data_n);
+                 sig_len = MAX(sig_len, sig_off + n - data_n);
+             }
+             done += n;
+         }
+         p += e.size;
+         left -= e.size;
+     }
+ 
+     if (sig_len != sig_sz) {
+         res = TEE_ERROR_BAD_FORMAT;
+         goto wipe;
+     }
+     if (hdr.data_size < r.size)
+         stream_scrub(ctx, hdr.data_size, r.size - hdr.data_size);
+ 
+     res = delta_rehash(ctx, hdr.data_size, digest, blocks);
+     if (res != TEE_SUCCESS)
+         goto wipe;
+     res = rsa_verify(&ctx->aci, digest, sizeof(digest),
+                      st->trailer, sig_sz);
+     if (res != TEE_SUCCESS) {
+         EMSG("Delta image signature check failed: %#" PRIx32, res);
+         res = TEE_ERROR_SIGNATURE_INVALID;
+         goto wipe;
+     }
+ 
+     /* Record the new image together with its fresh block digests */
+     ta_free(st->blocks);
+     st->blocks = blocks;
+     blocks = NULL;
+     resident_set(ctx, digest, hdr.data_size);
+     params[3].value.a = written;
+     params[3].value.b = nwritten;
+     goto out;
+ wipe:
+     stream_scrub(ctx, 0, span);
+ out:
+     if (cipher != TEE_HANDLE_NULL)
+         TEE_FreeOperation(cipher);
+     ta_free(buf);
+     ta_free(blocks);
+     return res;
+ }
+ 
+ /*----------------------------------------------------------
+  * Merkle image load
+  *
+  * Each block is decrypted into a bounce buffer, hashed and its
+  * authentication path folded up to the signed root before it is written,
+  * so nothing unverified reaches OCRAM and no pass over the whole image is
+  * needed. Records may come in any order. A partial load rewrites blocks
+  * of the resident image and verifies only those.
+  *---------------------------------------------------------*/
+ static void merkle_release(struct ocram_merkle *m)
+ {
+     if (m->cipher != TEE_HANDLE_NULL)
+         TEE_FreeOperation(m->cipher);
+     if (m->hash_op != TEE_HANDLE_NULL)
+         TEE_FreeOperation(m->hash_op);
+     ta_free(m->seen);
+     ta_free(m->buf);
+     m->cipher = TEE_HANDLE_NULL;
+     m->hash_op = TEE_HANDLE_NULL;
+     m->seen = NULL;
+     m->buf = NULL;
+     m->active = false;
+ }
+ 
+ /* Stop the load; a full load is wiped, partial ones wrote verified data */
+ static void merkle_abort(struct ta_ctx *ctx)
+ {
+     if (!ctx->merkle.partial)
+         stream_scrub(ctx, 0, ctx->merkle.hdr.data_size);
+     merkle_release(&ctx->merkle);
+ }
+ 
+ /* Hash block 'index' and fold its path up; it must give the signed root */
+ static TEE_Result merkle_check(struct ocram_merkle *m, uint32_t index,
+                                const uint8_t *block, uint32_t n,
+                                const uint8_t *path, uint32_t nodes)
+ {
+     const uint8_t leaf = 0x00, inner = 0x01;
+     uint8_t node[SHA256_DIGEST_SIZE];
+     uint8_t sib[SHA256_DIGEST_SIZE];
+     uint32_t count = m->hdr.count;
+     uint32_t len = sizeof(node);
+     TEE_Result res;
+ 
+     TEE_DigestUpdate(m->hash_op, &leaf, 1);
+     res = TEE_DigestDoFinal(m->hash_op, block, n, node, &len);
+     if (res != TEE_SUCCESS)
+         return res;
+ 
+     for (; count > 1; index /= 2, count = (count + 1) / 2) {
+         /* An unpaired last node moves up unchanged */
+         if (!(index & 1) && index == count - 1)
+             continue;
+         if (!nodes--)
+             return TEE_ERROR_SIGNATURE_INVALID;
+         /* The path is in client memory: read each digest once */
+         TEE_MemMove(sib, path, sizeof(sib));
+         path += sizeof(sib);
+ 
+         TEE_DigestUpdate(m->hash_op, &inner, 1);
+         TEE_DigestUpdate(m->hash_op, index & 1 ? sib : node, sizeof(node));
+         TEE_DigestUpdate(m->hash_op, index & 1 ? node : sib, sizeof(node));
+         len = sizeof(node);
+         res = TEE_DigestDoFinal(m->hash_op, NULL, 0, node, &len);
+         if (res != TEE_SUCCESS)
+             return res;
+     }
+ 
+     if (nodes || TEE_MemCompare(node, m->hdr.root, sizeof(node)))
+         return TEE_ERROR_SIGNATURE_INVALID;
      return TEE_SUCCESS;
  }
  
- static TEE_Result cmd_digest(struct acipher *state, uint32_t pt,
-                              TEE_Param params[TEE_NUM_PARAMS])
+ static TEE_Result cmd_merkle_begin(struct ta_ctx *ctx, uint32_t pt,
+                                    TEE_Param params[TEE_NUM_PARAMS])
  {
-    (void) state;
      const uint32_t exp = TEE_PARAM_TYPES(
          TEE_PARAM_TYPE_MEMREF_INPUT,
-         TEE_PARAM_TYPE_MEMREF_OUTPUT,
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_VALUE_INPUT,
+         TEE_PARAM_TYPE_VALUE_OUTPUT);
+     struct ocram_merkle *m = &ctx->merkle;
+     struct ta_ocram_merkle_hdr hdr;
+     uint32_t flags = params[2].value.a;
+     uint8_t *key = params[1].memref.buffer;
+     uint32_t key_sz = params[1].memref.size;
+     struct ocram_resident r;
+     bool resident;
+     TEE_Result res;
+ 
+     if (pt != exp || key_sz <= AES_BLOCK_SIZE)
+         return TEE_ERROR_BAD_PARAMETERS;
+     if (ctx->aci.key == TEE_HANDLE_NULL)
+         return TEE_ERROR_BAD_STATE;
+     if (params[0].memref.size < sizeof(hdr))
+         return TEE_ERROR_BAD_FORMAT;
+     key_sz -= AES_BLOCK_SIZE;
+     /* Blocks are written at their own offsets */
+     res = pta_need_at(ctx, false);
+     if (res != TEE_SUCCESS)
+         return res;
+ 
+     /* An unfinished full load was never completely verified */
+     if (m->active)
+         merkle_abort(ctx);
+ 
+     /* Work on a copy the client cannot change after it is checked */
+     TEE_MemMove(&hdr, params[0].memref.buffer, sizeof(hdr));
+     if (hdr.magic != TA_OCRAM_MERKLE_MAGIC || !hdr.data_size ||
+         !hdr.block_size || hdr.block_size % AES_BLOCK_SIZE ||
+         hdr.block_size > OCRAM_CHUNK_SIZE ||
+         hdr.count != (hdr.data_size - 1) / hdr.block_size + 1)
+         return TEE_ERROR_BAD_FORMAT;
+ 
+     res = rsa_verify(&ctx->aci, &hdr, sizeof(hdr),
+                      (uint8_t *)params[0].memref.buffer + sizeof(hdr),
+                      params[0].memref.size - sizeof(hdr));
+     if (res != TEE_SUCCESS) {
+         EMSG("Image header signature check failed: %#" PRIx32, res);
+         return TEE_ERROR_SIGNATURE_INVALID;
+     }
+ 
+     /* A Merkle image is recorded as resident under its root */
+     resident = resident_get(ctx, &r) == TEE_SUCCESS &&
+                r.size == hdr.data_size &&
+                !TEE_MemCompare(r.digest, hdr.root, sizeof(r.digest));
+     if (flags & TA_OCRAM_LOAD_FLAG_PARTIAL) {
+         if (!resident)
+             return TEE_ERROR_BAD_STATE;
+     } else if ((flags & TA_OCRAM_LOAD_FLAG_IF_CHANGED) && resident) {
+         DMSG("Image already resident, generation %" PRIu32, r.generation);
+         params[3].value.a = r.size;
+         params[3].value.b = TA_OCRAM_LOAD_RESIDENT;
+         return TEE_SUCCESS;
+     }
+ 
+     res = aes_key_op(&m->cipher, TEE_ALG_AES_CTR, TEE_MODE_DECRYPT,
+                      key, key_sz);
+     if (res != TEE_SUCCESS)
+         return res;
+     TEE_MemMove(m->iv, key + key_sz, AES_BLOCK_SIZE);
+ 
+     m->buf = ta_malloc(hdr.block_size, 0);
+     m->seen = ta_malloc((hdr.count + 7) / 8, TEE_MALLOC_FILL_ZERO);
+     if (!m->buf || !m->seen) {
+         res = TEE_ERROR_OUT_OF_MEMORY;
+         goto err;
+     }
+     res = TEE_AllocateOperation(&m->hash_op, TEE_ALG_SHA256,
+                                 TEE_MODE_DIGEST, 0);
+     if (res != TEE_SUCCESS) {
+         m->hash_op = TEE_HANDLE_NULL;
+         goto err;
+     }
+ 
+     if (!(flags & TA_OCRAM_LOAD_FLAG_PARTIAL)) {
+         /* Block digests of an earlier stream do not describe this image */
+         stream_abort(ctx);
+         ta_free(ctx->stream.blocks);
+         ctx->stream.blocks = NULL;
+         ocram_dirty(ctx, 0, hdr.data_size);
+     }
+ 
+     m->hdr = hdr;
+     m->partial = flags & TA_OCRAM_LOAD_FLAG_PARTIAL;
+     m->done = 0;
+     m->bytes = 0;
+     m->active = true;
+     params[3].value.a = hdr.data_size;
+     params[3].value.b = 0;
+     return TEE_SUCCESS;
+ err:
+     merkle_release(m);
+     return res;
+ }
+ 
+ static TEE_Result cmd_merkle_blocks(struct ta_ctx *ctx, uint32_t pt,
+                                     TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_MEMREF_INPUT,
+         TEE_PARAM_TYPE_VALUE_OUTPUT,
          TEE_PARAM_TYPE_NONE,
          TEE_PARAM_TYPE_NONE);
+     struct ocram_merkle *m = &ctx->merkle;
+     const uint8_t *in = params[0].memref.buffer;
+     uint32_t len = params[0].memref.size;
+     TEE_Result res = TEE_SUCCESS;
+ 
      if (pt != exp)
          return TEE_ERROR_BAD_PARAMETERS;
+     if (!m->active)
+         return TEE_ERROR_BAD_STATE;
  
-     void *inbuf = params[0].memref.buffer;
-     uint32_t in_len = params[0].memref.size;
-     void *out = params[1].memref.buffer;
-     uint32_t out_len = params[1].memref.size;
+     params[1].value.b = 0;
+     while (len) {
+         struct ta_ocram_merkle_rec rec;
+         uint8_t ctr[AES_BLOCK_SIZE];
+         uint32_t off, n, need;
+         uint32_t plain_sz = m->hdr.block_size;
  
-     TEE_OperationHandle op;
-     TEE_AllocateOperation(&op, TEE_ALG_SHA256, TEE_MODE_DIGEST, 0);
-     TEE_DigestDoFinal(op, inbuf, in_len, out, &out_len);
-     params[1].memref.size = out_len;
-     TEE_FreeOperation(op);
+         if (len < sizeof(rec)) {
+             res = TEE_ERROR_BAD_FORMAT;
+             break;
+         }
+         TEE_MemMove(&rec, in, sizeof(rec));
+         /* 32 path digests cover any 32-bit block count */
+         if (rec.index >= m->hdr.count || rec.nodes > 32) {
+             res = TEE_ERROR_BAD_FORMAT;
+             break;
+         }
+         off = rec.index * m->hdr.block_size;
+         n = MIN(m->hdr.block_size, m->hdr.data_size - off);
+         need = sizeof(rec) + n + rec.nodes * SHA256_DIGEST_SIZE;
+         if (len < need) {
+             res = TEE_ERROR_BAD_FORMAT;
+             break;
+         }
+ 
+         ctr_iv_at(m->iv, off, ctr);
+         TEE_CipherInit(m->cipher, ctr, sizeof(ctr));
+         res = TEE_CipherDoFinal(m->cipher, in + sizeof(rec), n,
+                                 m->buf, &plain_sz);
+         if (res != TEE_SUCCESS)
+             break;
+         res = merkle_check(m, rec.index, m->buf, n,
+                            in + sizeof(rec) + n, rec.nodes);
+         if (res == TEE_ERROR_SIGNATURE_INVALID) {
+             EMSG("Block %" PRIu32 " failed verification", rec.index);
+             params[1].value.b = rec.index;
+         }
+         if (res != TEE_SUCCESS)
+             break;
+         res = ocram_write(ctx, off, m->buf, n);
+         if (res != TEE_SUCCESS)
+             break;
+ 
+         if (!(m->seen[rec.index / 8] & (1 << rec.index % 8))) {
+             m->seen[rec.index / 8] |= 1 << rec.index % 8;
+             m->done++;
+             m->bytes += n;
+         }
+         in  += need;
+         len -= need;
+     }
+ 
+     params[1].value.a = m->done;
+     if (res != TEE_SUCCESS)
+         merkle_abort(ctx);
+     return res;
+ }
+ 
+ static TEE_Result cmd_merkle_end(struct ta_ctx *ctx, uint32_t pt,
+                                  TEE_Param params[TEE_NUM_PARAMS])
+ {
+     const uint32_t exp = TEE_PARAM_TYPES(
+         TEE_PARAM_TYPE_VALUE_OUTPUT,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE,
+         TEE_PARAM_TYPE_NONE);
+     struct ocram_merkle *m = &ctx->merkle;
+ 
+     if (pt != exp)
+         return TEE_ERROR_BAD_PARAMETERS;
+     if (!m->active)
+         return TEE_ERROR_BAD_STATE;
+ 
+     if (!m->partial) {
+         if (m->done != m->hdr.count) {
+             EMSG("Short image: %" PRIu32 " of %" PRIu32 " blocks",
+                  m->done, m->hdr.count);
+             merkle_abort(ctx);
+             return TEE_ERROR_BAD_STATE;
+         }
+         resident_set(ctx, m->hdr.root, m->hdr.data_size);
+     }
+     params[0].value.a = m->bytes;
+     params[0].value.b = m->done;
+     merkle_release(m);
+     return TEE_SUCCESS;
+ }
+ 
+ /*----------------------------------------------------------
+  * Batched commands
+  *
+  * The descriptor is copied into the TA before any op runs, so the
+  * client cannot change ops or inline key material while the batch
+  * executes, and it is scrubbed once written back.
+  *---------------------------------------------------------*/
+ static TEE_Result dispatch(struct ta_ctx *ctx, uint32_t command_id,
+                            uint32_t param_types, TEE_Param params[4]);
+ 
+ static bool memref_type(uint32_t type)
+ {
+     return type == TEE_PARAM_TYPE_MEMREF_INPUT ||
+            type == TEE_PARAM_TYPE_MEMREF_OUTPUT ||
+            type == TEE_PARAM_TYPE_MEMREF_INOUT;
+ }
+ 
+ /* Build param p of an op from its descriptor entry */
+ static TEE_Result batch_param(uint8_t *desc, uint32_t desc_sz,
+                               uint32_t ops_end, uint32_t type,
+                               const struct ta_batch_param *bp,
+                               uint32_t pt, TEE_Param params[4],
+                               TEE_Param *p)
+ {
+     uint32_t btype, size, lo = 0;
+     uint8_t *base;
+ 
+     switch (type) {
+     case TEE_PARAM_TYPE_NONE:
+         return TEE_SUCCESS;
+     case TEE_PARAM_TYPE_VALUE_INPUT:
+     case TEE_PARAM_TYPE_VALUE_OUTPUT:
+     case TEE_PARAM_TYPE_VALUE_INOUT:
+         p->value.a = bp->a;
+         p->value.b = bp->b;
+         return TEE_SUCCESS;
+     default:
+         if (!memref_type(type))
+             return TEE_ERROR_BAD_PARAMETERS;
+     }
+ 
+     if (bp->ref == TA_BATCH_REF_DESC) {
+         /* Inline blobs must not alias the op table */
+         base = desc;
+         size = desc_sz;
+         lo = ops_end;
+     } else {
+         if (bp->ref >= TEE_NUM_PARAMS)
+             return TEE_ERROR_BAD_PARAMETERS;
+         btype = TEE_PARAM_TYPE_GET(pt, bp->ref);
+         if (!memref_type(btype) ||
+             (type != TEE_PARAM_TYPE_MEMREF_OUTPUT &&
+              btype == TEE_PARAM_TYPE_MEMREF_OUTPUT) ||
+             (type != TEE_PARAM_TYPE_MEMREF_INPUT &&
+              btype == TEE_PARAM_TYPE_MEMREF_INPUT))
+             return TEE_ERROR_BAD_PARAMETERS;
+         base = params[bp->ref].memref.buffer;
+         size = params[bp->ref].memref.size;
+     }
+     if (bp->a < lo || bp->a > size || bp->b > size - bp->a)
+         return TEE_ERROR_BAD_PARAMETERS;
+     p->memref.buffer = base + bp->a;
+     p->memref.size = bp->b;
      return TEE_SUCCESS;
  }
  
+ /* Copy output values and memref sizes of an op back to its entry */
+ static void batch_result(struct ta_batch_op *op, TEE_Param sub[4])
+ {
+     uint32_t i;
+ 
+     for (i = 0; i < TEE_NUM_PARAMS; i++) {
+         switch (TEE_PARAM_TYPE_GET(op->param_types, i)) {
+         case TEE_PARAM_TYPE_VALUE_OUTPUT:
+         case TEE_PARAM_TYPE_VALUE_INOUT:
+             op->p[i].a = sub[i].value.a;
+             op->p[i].b = sub[i].value.b;
+             break;
+         case TEE_PARAM_TYPE_MEMREF_OUTPUT:
+         case TEE_PARAM_TYPE_MEMREF_INOUT:
+             op->p[i].b = sub[i].memref.size;
+             break;
+         default:
+             break;
+         }
+     }
+ }
+ 
+ static TEE_Result cmd_batch(struct ta_ctx *ctx, uint32_t pt,
+                             TEE_Param params[TEE_NUM_PARAMS])
+ {
+     struct ta_batch_hdr *hdr;
+     struct ta_batch_op *ops;
+     uint32_t desc_sz, ops_end, i, j;
+     TEE_Result res = TEE_SUCCESS;
+     uint8_t *desc;
+ 
+     if (TEE_PARAM_TYPE_GET(pt, 0) != TEE_PARAM_TYPE_MEMREF_INOUT)
+         return TEE_ERROR_BAD_PARAMETERS;
+     for (i = 1; i < TEE_NUM_PARAMS; i++)
+         if (TEE_PARAM_TYPE_GET(pt, i) != TEE_PARAM_TYPE_NONE &&
+             !memref_type(TEE_PARAM_TYPE_GET(pt, i)))
+             return TEE_ERROR_BAD_PARAMETERS;
+     desc_sz = params[0].memref.size;
+     if (desc_sz < sizeof(*hdr) || desc_sz > TA_BATCH_DESC_MAX)
+         return TEE_ERROR_BAD_PARAMETERS;
+ 
+     desc = ta_malloc(desc_sz, 0);
+     if (!desc)
+         return TEE_ERROR_OUT_OF_MEMORY;
+     memcpy(desc, params[0].memref.buffer, desc_sz);
+     hdr = (struct ta_batch_hdr *)desc;
+     ops = (struct ta_batch_op *)(hdr + 1);
+     if (hdr->count > TA_BATCH_MAX_OPS) {
+         res = TEE_ERROR_BAD_PARAMETERS;
+         goto out;
+     }
+     ops_end = sizeof(*hdr) + hdr->count * sizeof(*ops);
+     if (ops_end > desc_sz) {
+         res = TEE_ERROR_BAD_PARAMETERS;
+         goto out;
+     }
+ 
+     hdr->done = 0;
+     for (i = 0; i < hdr->count; i++) {
+         struct ta_batch_op *op = &ops[i];
+         TEE_Param sub[TEE_NUM_PARAMS];
+         uint64_t bytes;
+         TEE_Time t0;
+ 
+         memset(sub, 0, sizeof(sub));
+         res = op->cmd == TA_OCRAM_LOAD_CMD_BATCH ?
+               TEE_ERROR_BAD_PARAMETERS : TEE_SUCCESS;
+         for (j = 0; j < TEE_NUM_PARAMS && res == TEE_SUCCESS; j++)
+             res = batch_param(desc, desc_sz, ops_end,
+                               TEE_PARAM_TYPE_GET(op->param_types, j),
+                               &op->p[j], pt, params, &sub[j]);
+         if (res == TEE_SUCCESS) {
+             /* Count each op as if it had been invoked on its own */
+             bytes = stats_memref_bytes(op->param_types, sub, false);
+             TEE_GetSystemTime(&t0);
+             res = dispatch(ctx, op->cmd, op->param_types, sub);
+             batch_result(op, sub);
+             if (res == TEE_SUCCESS)
+                 bytes += stats_memref_bytes(op->param_types, sub, true);
+             stats_cmd(op->cmd, &t0, bytes);
+         }
+         op->result = res;
+         hdr->done++;
+         if (res != TEE_SUCCESS)
+             break;
+     }
+ 
+ out:
+     memcpy(params[0].memref.buffer, desc, desc_sz);
+     TEE_MemFill(desc, 0, desc_sz);
+     ta_free(desc);
+     return res;
+ }
+ 
  /*----------------------------------------------------------
   * TA Entry Points
   *---------------------------------------------------------*/
@@ -491,18 +4028,41 @@ return load_persistent_key(state);
                                       void **session)
  {
      (void)param_types; (void)params;
-     struct ta_ctx *ctx = TEE_Malloc(sizeof(*ctx), 0);
+     struct ta_ctx *ctx = ta_malloc(sizeof(*ctx), 0);
+     uint32_t i;
      if (!ctx)
          return TEE_ERROR_OUT_OF_MEMORY;
  
-     /* Initialize AES context */
+     /* Initialize AES context, no operation prepared or cached */
      ctx->aes.op_handle = TEE_HANDLE_NULL;
      ctx->aes.key_handle = TEE_HANDLE_NULL;
+     ctx->aes.cur = NULL;
+     ctx->aes.tick = 0;
+     for (i = 0; i < AES_OP_CACHE; i++) {
+         ctx->aes.cache[i].held = false;
+         ctx->aes.cache[i].iv_set = false;
+         ctx->aes.cache[i].op = TEE_HANDLE_NULL;
+         ctx->aes.cache[i].key = TEE_HANDLE_NULL;
+     }
  
      /* Initialize ACIPHER context */
      ctx->aci.key = TEE_HANDLE_NULL;
      load_persistent_key(&ctx->aci);
  
+     /* No streamed load in progress */
+     ctx->stream.active = false;
+     ctx->stream.buf = NULL;
+     ctx->stream.cipher = TEE_HANDLE_NULL;
+     ctx->stream.digest_op = TEE_HANDLE_NULL;
+     ctx->stream.block_op = TEE_HANDLE_NULL;
+     ctx->stream.blocks = NULL;
+ 
+     /* PTA sessions are opened lazily by pta_invoke() */
+     ctx->pta.load = TEE_HANDLE_NULL;
+     ctx->pta.read = TEE_HANDLE_NULL;
+     ctx->pta.load_at = PTA_AT_UNKNOWN;
+     ctx->pta.read_at = PTA_AT_UNKNOWN;
+ 
      *session = ctx;
      return TEE_SUCCESS;
  }
@@ -511,24 +4071,30 @@ return load_persistent_key(state);
  {
      struct ta_ctx *ctx = session;
      /* Free AES resources */
-     if (ctx->aes.key_handle != TEE_HANDLE_NULL)
-         TEE_FreeTransientObject(ctx->aes.key_handle);
-     if (ctx->aes.op_handle != TEE_HANDLE_NULL)
-         TEE_FreeOperation(ctx->aes.op_handle);
+     aes_release(&ctx->aes);
      /* Free ACIPHER key */
      if (ctx->aci.key != TEE_HANDLE_NULL)
      TEE_CloseObject(ctx->aci.key);
-     TEE_Free(ctx);
+     /* Abort any unfinished load, wiping what was never verified */
+     stream_abort(ctx);
+     ta_free(ctx->stream.blocks);
+     aead_release(&ctx->aead);
+     if (ctx->merkle.active)
+         merkle_abort(ctx);
+     merkle_release(&ctx->merkle);
+     /* Do not leave an uncommitted image behind in OCRAM */
+     if (ctx->stage.valid)
+         stream_scrub(ctx, ctx->stage.base, ctx->stage.size);
+     /* Close cached PTA sessions */
+     pta_close(&ctx->pta.load);
+     pta_close(&ctx->pta.read);
+     ta_free(ctx);
  }
  
- TEE_Result TA_InvokeCommandEntryPoint(void *session,
-                                       uint32_t command_id,
-                                       uint32_t param_types,
-                                       TEE_Param params[4])
+ static TEE_Result dispatch(struct ta_ctx *ctx, uint32_t command_id,
+                            uint32_t param_types, TEE_Param params[4])
  {
-     struct ta_ctx *ctx = session;
      TEE_Result res = TEE_ERROR_BAD_PARAMETERS;
-     uint32_t err_orig = 0;
  
      switch (command_id) {
      /* Store into Secure Storage */
@@ -561,7 +4127,10 @@ return load_persistent_key(state);
          TEE_CloseObject(obj);
          break;
      }
-     /* Load (decrypt then PTA-load) */
+     /*
+      * Load (decrypt then PTA-load), bounced in OCRAM_CHUNK_SIZE pieces,
+      * or in one piece when the load PTA only has command 0
+      */
      case TA_OCRAM_LOAD_CMD_LOAD: {
          const uint32_t exp = TEE_PARAM_TYPES(
              TEE_PARAM_TYPE_MEMREF_INPUT,
@@ -570,52 +4139,89 @@ return load_persistent_key(state);
              TEE_PARAM_TYPE_NONE);
          if (param_types != exp)
              return TEE_ERROR_BAD_PARAMETERS;
-         /* Decrypt */
-         void *enc_buf   = params[0].memref.buffer;
-         uint32_t enc_sz = params[0].memref.size;
-         void *plain_buf = TEE_Malloc(enc_sz, 0);
-         if (!plain_buf)
-             return TEE_ERROR_OUT_OF_MEMORY;
-         uint32_t plain_sz = enc_sz;
-         res = TEE_CipherUpdate(
-             ctx->aes.op_handle,
-             enc_buf, enc_sz,
-             plain_buf, &plain_sz);
-         if (res != TEE_SUCCESS) {
-             TEE_Free(plain_buf);
-             return res;
+         if (pta_need_at(ctx, false) != TEE_SUCCESS) {
+             res = load_whole(ctx, params[0].memref.buffer,
+                              params[0].memref.size);
+             break;
          }
-         /* PTA load to OCRAM */
-         TEE_TASessionHandle s1;
-         res = TEE_OpenTASession(
-             &pta_ocram_load_uuid, 0,
-             TEE_PARAM_TYPES(
-                 TEE_PARAM_TYPE_NONE,
-                 TEE_PARAM_TYPE_NONE,
-                 TEE_PARAM_TYPE_NONE,
-                 TEE_PARAM_TYPE_NONE),
-             NULL, &s1, &err_orig);
-         if (res != TEE_SUCCESS) {
-             TEE_Free(plain_buf);
+         res = stream_start(ctx, 0, params[0].memref.size, 0,
+                            TEE_HANDLE_NULL);
+         if (res != TEE_SUCCESS)
              return res;
-         }
-         TEE_Param pt[4] = {0};
-         pt[0].memref.buffer = plain_buf;
-         pt[0].memref.size   = plain_sz;
-         res = TEE_InvokeTACommand(
-             s1,
-             TEE_TIMEOUT_INFINITE,
-             OCRAM_LOAD_CMD,
-             TEE_PARAM_TYPES(
-                 TEE_PARAM_TYPE_MEMREF_INPUT,
-                 TEE_PARAM_TYPE_NONE,
-                 TEE_PARAM_TYPE_NONE,
-                 TEE_PARAM_TYPE_NONE),
-             pt, &err_orig);
-         TEE_CloseTASession(s1);
-         TEE_Free(plain_buf);
+         res = stream_feed(ctx, params[0].memref.buffer,
+                           params[0].memref.size);
+         stream_release(&ctx->stream);
          break;
      }
+     case TA_OCRAM_LOAD_CMD_MAP_MEMORY:
+         res = cmd_map_memory(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_LOAD_BEGIN:
+         res = cmd_load_begin(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_LOAD_CHUNK:
+         res = cmd_load_chunk(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_LOAD_END:
+         res = cmd_load_end(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_LOAD_FROM_STORAGE:
+         res = cmd_load_from_storage(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_LOAD_VERIFIED:
+         res = cmd_load_verified(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_RESIDENT:
+         res = cmd_resident(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_SLOT_LOAD:
+         res = cmd_slot_load(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_SLOT_LIST:
+         res = cmd_slot_list(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_SLOT_PIN:
+         res = cmd_slot_pin(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_SLOT_EVICT:
+         res = cmd_slot_evict(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_LOAD_DELTA:
+         res = cmd_load_delta(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_READ_AT:
+         res = cmd_read_at(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_READ_HASH:
+         res = cmd_read_hash(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_AEAD_BEGIN:
+         res = cmd_aead_begin(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_AEAD_CHUNK:
+         res = cmd_aead_chunk(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_AEAD_END:
+         res = cmd_aead_end(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_AEAD_SEAL:
+         res = cmd_aead_seal(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_MERKLE_BEGIN:
+         res = cmd_merkle_begin(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_MERKLE_BLOCKS:
+         res = cmd_merkle_blocks(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_MERKLE_END:
+         res = cmd_merkle_end(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_STAGE:
+         res = cmd_stage(ctx, param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_COMMIT:
+         res = cmd_commit(ctx, param_types, params);
+         break;
      /* Read back from OCRAM via PTA */
      case TA_OCRAM_LOAD_CMD_READ: {
          const uint32_t exp = TEE_PARAM_TYPES(
@@ -625,28 +4231,15 @@ return load_persistent_key(state);
              TEE_PARAM_TYPE_NONE);
          if (param_types != exp)
              return TEE_ERROR_BAD_PARAMETERS;
-         TEE_TASessionHandle s2;
-         res = TEE_OpenTASession(
-             &pta_ocram_read_uuid, 0,
-             TEE_PARAM_TYPES(
-                 TEE_PARAM_TYPE_NONE,
-                 TEE_PARAM_TYPE_NONE,
-                 TEE_PARAM_TYPE_NONE,
-                 TEE_PARAM_TYPE_NONE),
-             NULL, &s2, &err_orig);
-         if (res != TEE_SUCCESS)
-             return res;
          TEE_Param pt[4] = {0};
          pt[0].memref.buffer = params[0].memref.buffer;
          pt[0].memref.size   = params[0].memref.size;
-         res = TEE_InvokeTACommand(
-             s2,
-             TEE_TIMEOUT_INFINITE,
+         res = pta_invoke(
+             &ctx->pta.read, &pta_ocram_read_uuid,
              OCRAM_READ_CMD,
-             exp, pt, &err_orig);
+             exp, pt);
          if (res == TEE_SUCCESS)
              params[0].memref.size = pt[0].memref.size;
-         TEE_CloseTASession(s2);
          break;
      }
      /* AES commands */
@@ -654,13 +4247,32 @@ return load_persistent_key(state);
          res = alloc_resources(&ctx->aes, param_types, params);
          break;
      case TA_AES_CMD_SET_KEY:
-         res = set_aes_key(&ctx->aes, param_types, params);
+         res = aes_handle_param(&ctx->aes, &param_types, params);
+         if (res == TEE_SUCCESS)
+             res = set_aes_key(&ctx->aes, param_types, params);
          break;
      case TA_AES_CMD_SET_IV:
-         res = reset_aes_iv(&ctx->aes, param_types, params);
+         res = aes_handle_param(&ctx->aes, &param_types, params);
+         if (res == TEE_SUCCESS)
+             res = reset_aes_iv(&ctx->aes, param_types, params);
          break;
      case TA_AES_CMD_CIPHER:
-         res = cipher_buffer(&ctx->aes, param_types, params);
+         res = aes_handle_param(&ctx->aes, &param_types, params);
+         if (res == TEE_SUCCESS)
+             res = cipher_buffer(&ctx->aes, param_types, params);
+         break;
+     case TA_AES_CMD_CIPHER_SG:
+         res = aes_handle_param(&ctx->aes, &param_types, params);
+         if (res == TEE_SUCCESS)
+             res = cipher_segments(&ctx->aes, param_types, params);
+         break;
+     case TA_AES_CMD_CIPHER_AT:
+         res = aes_handle_param(&ctx->aes, &param_types, params);
+         if (res == TEE_SUCCESS)
+             res = cipher_at(&ctx->aes, param_types, params);
+         break;
+     case TA_AES_CMD_RELEASE:
+         res = release_handle(&ctx->aes, param_types, params);
          break;
      /* ACIPHER commands */
      case TA_ACIPHER_CMD_GEN_KEY:
@@ -678,9 +4290,37 @@ return load_persistent_key(state);
      case TA_ACIPHER_CMD_DIGEST:
          res = cmd_digest(&ctx->aci, param_types, params);
          break;
+     /* Statistics */
+     case TA_OCRAM_LOAD_CMD_GET_STATS:
+         res = cmd_get_stats(param_types, params);
+         break;
+     case TA_OCRAM_LOAD_CMD_RESET_STATS:
+         res = cmd_reset_stats(param_types);
+         break;
+     case TA_OCRAM_LOAD_CMD_BATCH:
+         res = cmd_batch(ctx, param_types, params);
+         break;
      default:
          return TEE_ERROR_NOT_SUPPORTED;
      }
      return res;
  }
+ 
+ TEE_Result TA_InvokeCommandEntryPoint(void *session,
+                                       uint32_t command_id,
+                                       uint32_t param_types,
+                                       TEE_Param params[4])
+ {
+     uint64_t bytes = stats_memref_bytes(param_types, params, false);
+     TEE_Result res;
+     TEE_Time t0;
+ 
+     TEE_GetSystemTime(&t0);
+     res = dispatch(session, command_id, param_types, params);
+     /* Output sizes only mean something once the command succeeded */
+     if (res == TEE_SUCCESS)
+         bytes += stats_memref_bytes(param_types, params, true);
+     stats_cmd(command_id, &t0, bytes);
+     return res;
+ }
  
\ No newline at end of file
@@ -1,5 +1,11 @@
 global-incdirs-y += include
 srcs-y += ocram_load_ta.c
 
+# Bytes of OCRAM the load PTA can address. OCRAM slots, staged batch
+# loads and delta updates place images inside it; 0 leaves them
+# unsupported.
+CFG_OCRAM_SIZE ?= 0
+cflags-ocram_load_ta.c-y += -DCFG_OCRAM_SIZE=$(CFG_OCRAM_SIZE)
+
 # To remove a certain compiler flag, add a line like this
 #cflags-template_ta.c-y += -Wno-strict-prototypes
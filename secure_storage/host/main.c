@@ -39,7 +39,7 @@ void terminate_tee_session(struct test_ctx *ctx)
 }
 
 TEEC_Result write_secure_object(struct test_ctx *ctx, char *id,
-                                char *data, size_t data_len)
+                                TEEC_SharedMemory *data, size_t data_len)
 {
     TEEC_Operation op;
     uint32_t origin;
@@ -48,13 +48,14 @@ TEEC_Result write_secure_object(struct test_ctx *ctx, char *id,
 
     memset(&op, 0, sizeof(op));
     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
-                                     TEEC_MEMREF_TEMP_INPUT,
+                                     TEEC_MEMREF_PARTIAL_INPUT,
                                      TEEC_NONE, TEEC_NONE);
 
     op.params[0].tmpref.buffer = id;
     op.params[0].tmpref.size = id_len;
-    op.params[1].tmpref.buffer = data;
-    op.params[1].tmpref.size = data_len;
+    op.params[1].memref.parent = data;
+    op.params[1].memref.offset = 0;
+    op.params[1].memref.size = data_len;
 
     res = TEEC_InvokeCommand(&ctx->sess,
                              TA_SECURE_STORAGE_CMD_WRITE_RAW,
@@ -66,7 +67,7 @@ TEEC_Result write_secure_object(struct test_ctx *ctx, char *id,
 }
 
 TEEC_Result read_secure_object(struct test_ctx *ctx, char *id,
-                               char *data, size_t data_len)
+                               TEEC_SharedMemory *data, size_t data_len)
 {
     TEEC_Operation op;
     uint32_t origin;
@@ -75,13 +76,14 @@ TEEC_Result read_secure_object(struct test_ctx *ctx, char *id,
 
     memset(&op, 0, sizeof(op));
     op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
-                                     TEEC_MEMREF_TEMP_OUTPUT,
+                                     TEEC_MEMREF_PARTIAL_OUTPUT,
                                      TEEC_NONE, TEEC_NONE);
 
     op.params[0].tmpref.buffer = id;
     op.params[0].tmpref.size = id_len;
-    op.params[1].tmpref.buffer = data;
-    op.params[1].tmpref.size = data_len;
+    op.params[1].memref.parent = data;
+    op.params[1].memref.offset = 0;
+    op.params[1].memref.size = data_len;
 
     res = TEEC_InvokeCommand(&ctx->sess,
                              TA_SECURE_STORAGE_CMD_READ_RAW,
@@ -92,12 +94,27 @@ TEEC_Result read_secure_object(struct test_ctx *ctx, char *id,
     return res;
 }
 
+/* 分配共享内存, 数据直接读写到其中, 调用时无需再拷贝 */
+static void alloc_shm(struct test_ctx *ctx, TEEC_SharedMemory *shm,
+                      size_t size, uint32_t flags)
+{
+    TEEC_Result res;
+
+    memset(shm, 0, sizeof(*shm));
+    shm->size = size;
+    shm->flags = flags;
+    res = TEEC_AllocateSharedMemory(&ctx->ctx, shm);
+    if (res != TEEC_SUCCESS)
+        errx(1, "TEEC_AllocateSharedMemory failed with code 0x%x", res);
+}
+
 /*
  * 存储操作：读取文件后，在数据前附加4字节文件大小头，然后存储到安全存储中。
  */
 void store_file_data(struct test_ctx *ctx, const char *filename, const char *obj_id)
 {
     FILE *file = NULL;
+    TEEC_SharedMemory shm;
     char *file_buffer = NULL;
     size_t file_size = 0;
     TEEC_Result res;
@@ -118,12 +135,11 @@ void store_file_data(struct test_ctx *ctx, const char *filename, const char *obj
         fclose(file);
         return;
     }
-    file_buffer = malloc(total_size);
-    if (!file_buffer) {
-        perror("Failed to allocate memory for file data");
-        fclose(file);
-        return;
-    }
+
+    printf("Prepare session with the TA\n");
+    prepare_tee_session(ctx);
+    alloc_shm(ctx, &shm, total_size, TEEC_MEM_INPUT);
+    file_buffer = shm.buffer;
 
     /* 将文件大小（4字节）写入缓冲区头部 */
     uint32_t file_size_le = (uint32_t)file_size; // 假设小于4GB
@@ -133,17 +149,14 @@ void store_file_data(struct test_ctx *ctx, const char *filename, const char *obj
     fread(file_buffer + sizeof(uint32_t), 1, file_size, file);
     fclose(file);
 
-    printf("Prepare session with the TA\n");
-    prepare_tee_session(ctx);
-
     printf("- Write file data to secure storage\n");
-    res = write_secure_object(ctx, (char *)obj_id, file_buffer, total_size);
+    res = write_secure_object(ctx, (char *)obj_id, &shm, total_size);
     if (res != TEEC_SUCCESS)
         errx(1, "Failed to store file data in secure storage");
 
     printf("File data has been securely stored.\n");
 
-    free(file_buffer);
+    TEEC_ReleaseSharedMemory(&shm);
     terminate_tee_session(ctx);
 }
 
@@ -153,17 +166,16 @@ void store_file_data(struct test_ctx *ctx, const char *filename, const char *obj
  */
 void retrieve_file_data(struct test_ctx *ctx, const char *obj_id)
 {
-    char *read_buffer = malloc(MAX_BUFFER_SIZE);
-    if (!read_buffer) {
-        perror("Failed to allocate memory for reading file data");
-        return;
-    }
+    TEEC_SharedMemory shm;
+    char *read_buffer;
 
     printf("Prepare session with the TA\n");
     prepare_tee_session(ctx);
+    alloc_shm(ctx, &shm, MAX_BUFFER_SIZE, TEEC_MEM_OUTPUT);
+    read_buffer = shm.buffer;
 
     printf("- Read file data from secure storage\n");
-    TEEC_Result res = read_secure_object(ctx, (char *)obj_id, read_buffer, MAX_BUFFER_SIZE);
+    TEEC_Result res = read_secure_object(ctx, (char *)obj_id, &shm, MAX_BUFFER_SIZE);
     if (res != TEEC_SUCCESS)
         errx(1, "Failed to read file data from secure storage");
 
@@ -172,7 +184,7 @@ void retrieve_file_data(struct test_ctx *ctx, const char *obj_id)
     memcpy(&stored_file_size, read_buffer, sizeof(uint32_t));
     if (stored_file_size > MAX_BUFFER_SIZE - sizeof(uint32_t)) {
         fprintf(stderr, "Invalid stored file size\n");
-        free(read_buffer);
+        TEEC_ReleaseSharedMemory(&shm);
         terminate_tee_session(ctx);
         return;
     }
@@ -180,7 +192,7 @@ void retrieve_file_data(struct test_ctx *ctx, const char *obj_id)
     FILE *outfile = fopen(RETRIEVED_FILENAME, "wb");
     if (!outfile) {
         perror("Failed to open output file for writing");
-        free(read_buffer);
+        TEEC_ReleaseSharedMemory(&shm);
         terminate_tee_session(ctx);
         return;
     }
@@ -192,7 +204,7 @@ void retrieve_file_data(struct test_ctx *ctx, const char *obj_id)
     printf("Retrieved file data has been written to %s (size: %u bytes)\n",
            RETRIEVED_FILENAME, stored_file_size);
 
-    free(read_buffer);
+    TEEC_ReleaseSharedMemory(&shm);
     terminate_tee_session(ctx);
 }
 